@@ -0,0 +1,383 @@
+// etupirka-bench: 画像処理カーネルと検出器の段毎のマイクロベンチマーク
+//   合成フレーム（と --video-file で与えた録画のフレーム）を複数の解像度で処理し、
+//   1行1件の JSON（JSON Lines）で ns/pixel と遅延の分位点を標準出力へ出す。
+//   例: etupirka-bench --resolutions 320x240,640x480 --iterations 200 > bench.jsonl
+
+#include <algorithm>
+#include <array>
+#include <chrono>
+#include <functional>
+#include <iostream>
+#include <random>
+#include <string>
+#include <vector>
+
+#include <opencv2/core/core.hpp>
+#include <opencv2/imgproc/imgproc.hpp>
+#include <opencv2/highgui/highgui.hpp>
+
+#include "commandline_helper.hxx"
+#include "finger-detector.hxx"
+#include "hsv-filter.hxx"
+#include "image_processor.hxx"
+#include "logger.hxx"
+
+namespace
+{
+  using namespace arisin::etupirka;
+  using clock_type = std::chrono::steady_clock;
+  
+  struct options_t
+  {
+    std::vector<cv::Size> resolutions = { { 320, 240 }, { 640, 480 }, { 1280, 720 } };
+    int iterations = 100;
+    int warmup = 10;
+    std::string video_file;
+    int video_frames = 30;
+    std::string conf_file = "etupirka.conf";
+    std::string filter;
+  };
+  
+  struct input_t
+  {
+    std::string name;
+    std::vector<cv::Mat> frames;
+  };
+  
+  std::vector<cv::Size> parse_resolutions(const std::string& s)
+  {
+    std::vector<cv::Size> resolutions;
+    std::vector<std::string> items;
+    boost::split(items, s, boost::is_any_of(","));
+    for(const auto& item : items)
+    {
+      const auto x = item.find('x');
+      if(x == std::string::npos)
+      {
+        LOG(WARNING) << "ignore resolution: " << item;
+        continue;
+      }
+      resolutions.emplace_back(std::stoi(item.substr(0, x)), std::stoi(item.substr(x + 1)));
+    }
+    return resolutions;
+  }
+  
+  options_t interpret(const std::vector<std::string>& arguments)
+  {
+    options_t o;
+    for(auto i = std::begin(arguments) + 1, e = std::end(arguments); i < e; ++i)
+    {
+      const auto has_value = i + 1 < e;
+      if(*i == "--resolutions" && has_value)
+        o.resolutions = parse_resolutions(*++i);
+      else if(*i == "--iterations" && has_value)
+        o.iterations = std::max(1, std::stoi(*++i));
+      else if(*i == "--warmup" && has_value)
+        o.warmup = std::max(0, std::stoi(*++i));
+      else if(*i == "--video-file" && has_value)
+        o.video_file = *++i;
+      else if(*i == "--video-frames" && has_value)
+        o.video_frames = std::max(1, std::stoi(*++i));
+      else if((*i == "-c" || *i == "--conf-file") && has_value)
+        o.conf_file = *++i;
+      else if(*i == "--filter" && has_value)
+        o.filter = *++i;
+      else
+      {
+        std::cerr
+          << "usage: etupirka-bench [options]\n"
+             "  --resolutions WxH[,WxH...]  (default: 320x240,640x480,1280x720)\n"
+             "  --iterations N              measured runs per benchmark (default: 100)\n"
+             "  --warmup N                  unmeasured runs per benchmark (default: 10)\n"
+             "  --video-file PATH           also run on frames from a recorded video\n"
+             "  --video-frames N            frames to take from the video (default: 30)\n"
+             "  -c, --conf-file PATH        detector configuration (default: etupirka.conf)\n"
+             "  --filter TEXT               run only benchmarks whose name contains TEXT\n"
+          ;
+        exit(*i == "-h" || *i == "--help" ? 0 : 1);
+      }
+    }
+    return o;
+  }
+  
+  // 雑音の上に爪らしい色の円を散らした合成フレーム
+  //   HSV の閾値の中央の色で塗るので、検出器の後段（Hough）にも仕事が回る。
+  cv::Mat make_synthetic_frame(const cv::Size& size, const configuration_t::finger_detector_configuration_t& c, const unsigned seed)
+  {
+    cv::Mat frame(size, CV_8UC3);
+    cv::randu(frame, cv::Scalar::all(0), cv::Scalar::all(96));
+    
+    // 閾値の中央の HSV を BGR へ戻す
+    const auto h = std::fmod((c.hsv_h_min + c.hsv_h_max) / 2, 360.f);
+    const auto s = (c.hsv_s_min + c.hsv_s_max) / 2;
+    const auto v = (c.hsv_v_min + c.hsv_v_max) / 2;
+    cv::Mat hsv(1, 1, CV_32FC3, cv::Scalar(h, s, v / 255.f));
+    cv::Mat bgr;
+    cv::cvtColor(hsv, bgr, CV_HSV2BGR);
+    const auto& p = bgr.at<cv::Vec3f>(0, 0);
+    const cv::Scalar nail(p[0] * 255, p[1] * 255, p[2] * 255);
+    
+    std::mt19937 engine(seed);
+    const auto radius = std::max(2, (c.circles_min_radius + c.circles_max_radius) / 2 * size.width / 640);
+    std::uniform_int_distribution<int> x(radius, size.width - radius - 1);
+    std::uniform_int_distribution<int> y(radius, size.height - radius - 1);
+    for(int n = 0; n < 5; ++n)
+      cv::circle(frame, cv::Point(x(engine), y(engine)), radius, nail, -1);
+    
+    return frame;
+  }
+  
+  std::vector<cv::Mat> load_video_frames(const std::string& path, const int count)
+  {
+    std::vector<cv::Mat> frames;
+    cv::VideoCapture capture(path);
+    if(!capture.isOpened())
+    {
+      LOG(ERROR) << "can not open video file: " << path;
+      return frames;
+    }
+    
+    cv::Mat frame;
+    while(int(frames.size()) < count && capture.read(frame))
+      frames.push_back(frame.clone());
+    
+    DLOG(INFO) << "loaded " << frames.size() << " frames from " << path;
+    return frames;
+  }
+  
+  std::string json_escape(const std::string& s)
+  {
+    std::string r;
+    for(const auto c : s)
+      switch(c)
+      {
+        case '"':  r += "\\\""; break;
+        case '\\': r += "\\\\"; break;
+        default:   r += c;
+      }
+    return r;
+  }
+  
+  class bench_t final
+  {
+    const options_t& options_;
+    
+  public:
+    explicit bench_t(const options_t& options)
+      : options_(options)
+    { }
+    
+    bool enabled(const std::string& name) const
+    { return options_.filter.empty() || name.find(options_.filter) != std::string::npos; }
+    
+    const int warmup() const
+    { return options_.warmup; }
+    
+    // body を warmup + iterations 回呼び、計測した回の時間を報告する
+    //   body には何回目かを渡す（入力フレームを巡回させるため）
+    void run(const std::string& name, const input_t& input, const cv::Size& size, const std::function<void(size_t)>& body) const
+    {
+      if(!enabled(name))
+        return;
+      
+      for(int n = 0; n < options_.warmup; ++n)
+        body(size_t(n));
+      
+      std::vector<double> ns(size_t(options_.iterations));
+      for(size_t n = 0; n < ns.size(); ++n)
+      {
+        const auto start = clock_type::now();
+        body(size_t(options_.warmup) + n);
+        ns[n] = std::chrono::duration<double, std::nano>(clock_type::now() - start).count();
+      }
+      
+      report(name, input, size, ns);
+    }
+    
+    // 1行分の JSON を出す（ns は並べ替える）
+    void report(const std::string& name, const input_t& input, const cv::Size& size, std::vector<double>& ns) const
+    {
+      if(ns.empty())
+        return;
+      
+      std::sort(std::begin(ns), std::end(ns));
+      const auto percentile = [&](const double p){ return ns[std::min(ns.size() - 1, size_t(p / 100 * (ns.size() - 1) + .5))]; };
+      double total = 0;
+      for(const auto t : ns)
+        total += t;
+      const auto pixels = double(size.width) * size.height;
+      
+      std::cout
+        << "{\"benchmark\":\"" << json_escape(name) << "\""
+        << ",\"input\":\""     << json_escape(input.name) << "\""
+        << ",\"width\":"       << size.width
+        << ",\"height\":"      << size.height
+        << ",\"simd\":\""      << simd_name() << "\""
+        << ",\"iterations\":"  << ns.size()
+        << ",\"ns_per_pixel\":" << percentile(50) / pixels
+        << ",\"mean_ns\":"     << total / ns.size()
+        << ",\"min_ns\":"      << ns.front()
+        << ",\"p50_ns\":"      << percentile(50)
+        << ",\"p90_ns\":"      << percentile(90)
+        << ",\"p99_ns\":"      << percentile(99)
+        << ",\"max_ns\":"      << ns.back()
+        << "}" << std::endl;
+    }
+  };
+  
+  void run_kernels(const bench_t& bench, const configuration_t& conf, const input_t& input, const cv::Size& size)
+  {
+    const auto& c = conf.finger_detector_top;
+    const auto frame_at = [&](const size_t n) -> const cv::Mat& { return input.frames[n % input.frames.size()]; };
+    
+    filter_scratch_t scratch;
+    cv::Mat bgr, gray, border;
+    
+    bench.run("bilateralFilter_8u", input, size, [&](size_t n)
+    { ::bilateralFilter_8u(frame_at(n), bgr, int(c.pre_bilateral_d), c.pre_bilateral_sc, c.pre_bilateral_ss, scratch); });
+    
+    hsv_filter_t hsv_filter;
+    hsv_filter.set(c.hsv_h_min, c.hsv_h_max, c.hsv_s_min, c.hsv_s_max, c.hsv_v_min, c.hsv_v_max);
+    bench.run(std::string("hsv_filter(") + hsv_filter.kernel_name() + ")", input, size, [&](size_t n)
+    { hsv_filter(frame_at(n), gray); });
+    
+    hsv_filter.set_lookup_table(true);
+    bench.run("hsv_filter(lookup-table)", input, size, [&](size_t n)
+    { hsv_filter(frame_at(n), gray); });
+    hsv_filter.set_lookup_table(false);
+    
+    // median は HSV を通した単チャンネル画像に対し、medianBlur の振り分けを通さず各実装を直接呼ぶ
+    std::vector<cv::Mat> singles(input.frames.size());
+    for(size_t n = 0; n < singles.size(); ++n)
+      hsv_filter(input.frames[n], singles[n]);
+    const auto single_at = [&](const size_t n) -> const cv::Mat& { return singles[n % singles.size()]; };
+    
+    const auto ksize = c.nail_median_blur_ksize;
+    cv::Mat median(size, CV_8UC1);
+    
+    bench.run("medianBlur(SortNet,3)", input, size, [&](size_t n)
+    { medianBlur_SortNet<MinMax8u, MinMaxVec8u>(single_at(n), median, 3); });
+    
+    bench.run("medianBlur(SortNet,5)", input, size, [&](size_t n)
+    { medianBlur_SortNet<MinMax8u, MinMaxVec8u>(single_at(n), median, 5); });
+    
+    // Om, O1 は左右に ksize / 2 の境界を付けた入力を取る（medianBlur と同じ前処理）
+    bench.run("medianBlur(Om," + std::to_string(ksize) + ")", input, size, [&](size_t n)
+    {
+      cv::copyMakeBorder(single_at(n), border, 0, 0, ksize / 2, ksize / 2, cv::BORDER_REPLICATE);
+      medianBlur_8u_Om(border, median, ksize);
+    });
+    
+    bench.run("medianBlur(O1," + std::to_string(ksize) + ")", input, size, [&](size_t n)
+    {
+      cv::copyMakeBorder(single_at(n), border, 0, 0, ksize / 2, ksize / 2, cv::BORDER_REPLICATE);
+      medianBlur_8u_O1(border, median, ksize, scratch);
+    });
+    
+    std::vector<cv::Mat> nails(singles.size());
+    for(size_t n = 0; n < nails.size(); ++n)
+      ::medianBlur(singles[n], nails[n], ksize, scratch);
+    
+    finger_detector_t::circles_t circles;
+    bench.run("HoughCircles", input, size, [&](size_t n)
+    {
+      cv::HoughCircles
+      ( nails[n % nails.size()], circles, CV_HOUGH_GRADIENT
+      , c.circles_dp, c.circles_min_dist
+      , c.circles_param_1, c.circles_param_2
+      , c.circles_min_radius, c.circles_max_radius
+      );
+    });
+  }
+  
+  // 検出器全体と、同じ呼び出しの中の段毎の時間
+  void run_detector(const bench_t& bench, const std::string& name, finger_detector_t& detector, const input_t& input, const cv::Size& size)
+  {
+    if(!bench.enabled(name))
+      return;
+    
+    using stage_ns_t = std::array<std::vector<double>, finger_detector_t::stages>;
+    stage_ns_t stage_ns;
+    finger_detector_t::circles_t circles;
+    
+    detector.set_stage_timing_report(0);
+    
+    bench.run(name, input, size, [&](size_t n)
+    {
+      detector(input.frames[n % input.frames.size()], circles);
+      
+      if(n < size_t(bench.warmup()))
+        return;
+      
+      const auto& timings = detector.last_frame_stage_timings();
+      for(size_t s = 0; s < finger_detector_t::stages; ++s)
+        if(timings[s].calls)
+          stage_ns[s].push_back(std::chrono::duration<double, std::nano>(timings[s].total).count());
+    });
+    
+    for(size_t s = 0; s < finger_detector_t::stages; ++s)
+      bench.report(name + "/" + finger_detector_t::stage_name(finger_detector_t::stage_t(s)), input, size, stage_ns[s]);
+  }
+  
+  void run_detectors(const bench_t& bench, const configuration_t& conf, const input_t& input, const cv::Size& size)
+  {
+    {
+      finger_detector_t detector(conf, true);
+      run_detector(bench, "finger_detector", detector, input, size);
+    }
+    
+    {
+      finger_detector_t detector(conf, true);
+      detector.set_roi_tracking(true, conf.finger_detector_top.roi_margin, conf.finger_detector_top.roi_full_scan_interval);
+      run_detector(bench, "finger_detector(roi-tracking)", detector, input, size);
+    }
+    
+    {
+      finger_detector_t detector(conf, true);
+      detector.set_pyramid(.5);
+      run_detector(bench, "finger_detector(pyramid=0.5)", detector, input, size);
+    }
+  }
+}
+
+int main(const int number_of_arguments, const char* const* const arguments)
+{
+  using namespace arisin::etupirka;
+  logger::initialize();
+  
+  const auto options = interpret({arguments, arguments + number_of_arguments});
+  
+  auto conf = commandline_helper_t::load_default();
+  commandline_helper_t::load_file(conf, options.conf_file);
+  
+  std::vector<cv::Mat> video_frames;
+  if(!options.video_file.empty())
+    video_frames = load_video_frames(options.video_file, options.video_frames);
+  
+  const bench_t bench(options);
+  
+  for(const auto& size : options.resolutions)
+  {
+    std::vector<input_t> inputs;
+    
+    inputs.push_back({ "synthetic", {} });
+    for(unsigned seed = 0; seed < 8; ++seed)
+      inputs.back().frames.push_back(make_synthetic_frame(size, conf.finger_detector_top, seed));
+    
+    if(!video_frames.empty())
+    {
+      inputs.push_back({ options.video_file, {} });
+      for(const auto& frame : video_frames)
+      {
+        inputs.back().frames.emplace_back();
+        cv::resize(frame, inputs.back().frames.back(), size, 0, 0, cv::INTER_AREA);
+      }
+    }
+    
+    for(const auto& input : inputs)
+    {
+      run_kernels(bench, conf, input, size);
+      run_detectors(bench, conf, input, size);
+    }
+  }
+}
@@ -0,0 +1,109 @@
+#pragma once
+
+#include <vector>
+#include <mutex>
+#include <condition_variable>
+#include <functional>
+
+#include "logger.hxx"
+
+namespace arisin
+{
+  namespace etupirka
+  {
+    // パイプラインの段間をつなぐ固定長キュー
+    //   単一の生産者・単一の消費者で使う前提。要素領域は生成時に確保し、以後は再確保しない。
+    //   満杯の時に push されると最古の要素を捨てて on_drop に渡す（遅延を容量分に抑えるため）。
+    //   close 後の pop は残りの要素を全て返してから false を返す。
+    template<class T>
+    class bounded_queue_t final
+    {
+    public:
+      using value_type = T;
+      using on_drop_t  = std::function<void(value_type&)>;
+      
+    private:
+      std::vector<value_type> buffer_;
+      size_t head_;
+      size_t size_;
+      bool   closed_;
+      size_t dropped_count_;
+      on_drop_t on_drop_;
+      
+      mutable std::mutex      mutex_;
+      std::condition_variable not_empty_;
+      
+    public:
+      explicit bounded_queue_t(const size_t capacity, on_drop_t on_drop = on_drop_t())
+        : buffer_(capacity ? capacity : 1)
+        , head_(0)
+        , size_(0)
+        , closed_(false)
+        , dropped_count_(0)
+        , on_drop_(std::move(on_drop))
+      { }
+      
+      // 満杯なら最古の要素を捨てて積む。捨てた場合は true を返す。
+      bool push(value_type&& value)
+      {
+        bool dropped = false;
+        {
+          std::lock_guard<std::mutex> lock(mutex_);
+          
+          if(size_ == buffer_.size())
+          {
+            if(on_drop_)
+              on_drop_(buffer_[head_]);
+            head_ = (head_ + 1) % buffer_.size();
+            --size_;
+            ++dropped_count_;
+            dropped = true;
+          }
+          
+          buffer_[(head_ + size_) % buffer_.size()] = std::move(value);
+          ++size_;
+        }
+        not_empty_.notify_one();
+        return dropped;
+      }
+      
+      // 要素が来るか close されるまで待つ。取り出せた場合は true を返す。
+      bool pop(value_type& value)
+      {
+        std::unique_lock<std::mutex> lock(mutex_);
+        not_empty_.wait(lock, [this]{ return size_ || closed_; });
+        
+        if(!size_)
+          return false;
+        
+        value = std::move(buffer_[head_]);
+        head_ = (head_ + 1) % buffer_.size();
+        --size_;
+        return true;
+      }
+      
+      void close()
+      {
+        {
+          std::lock_guard<std::mutex> lock(mutex_);
+          closed_ = true;
+        }
+        not_empty_.notify_all();
+      }
+      
+      size_t capacity() const { return buffer_.size(); }
+      
+      size_t size() const
+      {
+        std::lock_guard<std::mutex> lock(mutex_);
+        return size_;
+      }
+      
+      size_t dropped_count() const
+      {
+        std::lock_guard<std::mutex> lock(mutex_);
+        return dropped_count_;
+      }
+    };
+  }
+}
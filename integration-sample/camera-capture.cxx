@@ -1,5 +1,7 @@
 #include "camera-capture.hxx"
 
+#include <algorithm>
+
 namespace arisin
 {
   namespace etupirka
@@ -11,6 +13,29 @@ namespace arisin
       , height_(conf.camera_capture.height)
       , video_file_top_(conf.video_file_top)
       , video_file_front_(conf.video_file_front)
+      , loop_video_(true)
+      , end_of_video_(false)
+      , video_cache_positions_({{ 0, 0 }})
+      , replay_position_(0)
+      , ring_(size_t(std::max(2, conf.camera_capture.ring_size)))
+      , next_slot_(0)
+      , threaded_(conf.camera_capture.threaded && conf.video_file_top.empty() && conf.video_file_front.empty() && conf.replay_file.empty())
+      , sync_tolerance_(std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::duration<double, std::milli>(conf.camera_capture.sync_tolerance_ms)))
+      , is_running_(false)
+      , frame_count_(0)
+      , allocation_count_(0)
+      , allocation_count_before_(0)
+      , last_frame_allocations_(0)
+      , report_interval_(size_t(std::max(conf.camera_capture.report_interval, 0)))
+      , report_allocation_count_(0)
+      , last_pair_skew_(0)
+      , max_pair_skew_(0)
+      , total_pair_skew_(0)
+      , unmatched_pair_count_(0)
+      , recent_max_pair_skew_(0)
+      , recent_total_pair_skew_(0)
+      , report_frame_count_(0)
+      , report_unmatched_pair_count_(0)
     {
       DLOG(INFO) << "top-cam-id: "       << top_camera_id_;
       DLOG(INFO) << "front-cam-id: "     << front_camera_id_;
@@ -18,6 +43,25 @@ namespace arisin
       DLOG(INFO) << "height: "           << height_;
       DLOG(INFO) << "video-file-top: "   << video_file_top_;
       DLOG(INFO) << "video-file-front: " << video_file_front_;
+      DLOG(INFO) << "ring-size: "        << ring_.size();
+      DLOG(INFO) << "threaded: "         << threaded_;
+      DLOG(INFO) << "sync-tolerance[ns]: " << sync_tolerance_.count();
+      DLOG(INFO) << "report-interval: "  << report_interval_;
+      DLOG(INFO) << "record-file: "      << conf.record_file;
+      DLOG(INFO) << "replay-file: "      << conf.replay_file;
+      
+      if(!conf.record_file.empty())
+        recorder_.reset(new frame_recorder_t(conf.record_file));
+      
+      // 記録ファイルの再生ではフレームリングのスロットに記録ファイルを指すヘッダーを置くだけなので、
+      // カメラも動画ファイルも開かず、スロットのバッファも確保しない
+      if(!conf.replay_file.empty())
+      {
+        player_.reset(new frame_player_t(conf.replay_file));
+        if(player_->width() != width_ || player_->height() != height_)
+          LOG(WARNING) << "replay file frame size " << player_->width() << "x" << player_->height() << " differs from camera_capture " << width_ << "x" << height_;
+        return;
+      }
       
       // 先に設定可能な場合は設定してからopen（動作が軽くなる可能性がある）
       if(conf.video_file_top.empty())
@@ -91,23 +135,259 @@ namespace arisin
         DLOG(INFO) << "test front-cam succeeded";
       }
       
+      // 動画ファイルはデコード済みのフレームをキャッシュしておく（上限を超える場合はキャッシュしない）
+      if(conf.camera_capture.video_cache_mb > 0)
+      {
+        const auto limit_bytes = size_t(conf.camera_capture.video_cache_mb) << 20;
+        if(!video_file_top_.empty())
+          load_video_cache(top, video_file_top_, limit_bytes);
+        if(!video_file_front_.empty())
+          load_video_cache(front, video_file_front_, limit_bytes);
+      }
+      
+      // フレームリングのバッファを先に確保しておく
+      for(auto& slot : ring_)
+      {
+        slot.frames.top.create(height_, width_, CV_8UC3);
+        slot.frames.front.create(height_, width_, CV_8UC3);
+      }
+      DLOG(INFO) << "frame ring allocated: " << ring_.size() << " slots";
+      
+      // カメラ毎のキャプチャースレッドを起動する
+      //   ※動画ファイルには実時間の撮影時刻が無く、スレッドで先読みするとフレームを取りこぼすので
+      //     従来通り呼び出し時に順に読む。
+      if(threaded_)
+      {
+        is_running_ = true;
+        for(const auto camera : { top, front })
+          streams_[camera].thread = std::thread([this, camera](){ capture_loop(camera); });
+        DLOG(INFO) << "capture threads started";
+      }
+    }
+    
+    camera_capture_t::~camera_capture_t()
+    {
+      is_running_ = false;
+      for(auto& stream : streams_)
+        if(stream.thread.joinable())
+          stream.thread.join();
+      DLOG(INFO) << "capture threads joined";
+    }
+    
+    void camera_capture_t::capture_loop(const size_t camera)
+    {
+      DLOG(INFO) << "capture thread start: camera(" << camera << ")";
+      
+      auto& stream = streams_[camera];
+      cv::Mat scratch(height_, width_, CV_8UC3);
+      
+      // 連続して失敗したら（カメラが外れた等）待ち時間を延ばし、ログは 1, 2, 4, ... 回目にだけ出す
+      size_t failures = 0;
+      const auto fail = [&](const char* what)
+      {
+        ++failures;
+        if((failures & (failures - 1)) == 0)
+          LOG(WARNING) << "camera(" << camera << ") " << what << " failed (" << failures << " times in a row)";
+        std::this_thread::sleep_for(std::chrono::milliseconds(std::min<size_t>(failures * 10, 1000)));
+      };
+      
+      while(is_running_)
+      {
+        // grab直後の時刻を撮影時刻とし、retrieve（デコード・変換）の時間を含めない
+        if(!captures[camera].grab())
+        {
+          fail("grab");
+          continue;
+        }
+        const auto timestamp = steady_clock_t::now();
+        
+        const auto data = scratch.data;
+        if(!captures[camera].retrieve(scratch))
+        {
+          fail("retrieve");
+          continue;
+        }
+        if(scratch.data != data)
+          ++allocation_count_;
+        
+        if(failures)
+        {
+          LOG(INFO) << "camera(" << camera << ") recovered after " << failures << " failures";
+          failures = 0;
+        }
+        
+        {
+          // 履歴の最古の要素と中身を入れ替える（ヘッダーの交換だけでコピーは無い）
+          std::lock_guard<std::mutex> lock(streams_mutex_);
+          auto& entry = stream.history[stream.head];
+          cv::swap(entry.frame, scratch);
+          entry.timestamp = timestamp;
+          entry.sequence  = ++stream.sequence;
+          stream.head = (stream.head + 1) % history_size;
+        }
+        streams_condition_.notify_all();
+      }
+      
+      DLOG(INFO) << "capture thread end: camera(" << camera << ")";
     }
     
-    camera_capture_t::captured_frames_t camera_capture_t::operator()()
+    bool camera_capture_t::take_synchronized(captured_frames_t& frames, frame_handle_t& handle)
     {
-      camera_capture_t::captured_frames_t r;
+      std::unique_lock<std::mutex> lock(streams_mutex_);
+      
+      auto& stream_top   = streams_[top];
+      auto& stream_front = streams_[front];
+      
+      const auto is_fresh = [](const stream_t& s, const timed_frame_t& f){ return f.sequence > s.consumed; };
+      
+      for(size_t attempt = 0; ; ++attempt)
+      {
+        if
+        ( !streams_condition_.wait_for
+          ( lock
+          , std::chrono::seconds(1)
+          , [&]{ return stream_top.sequence > stream_top.consumed && stream_front.sequence > stream_front.consumed; }
+          )
+        )
+        {
+          LOG(WARNING) << "capture threads do not deliver frames for 1 second";
+          return false;
+        }
+        
+        // 未使用のフレーム同士で撮影時刻が最も近い組を探す
+        timed_frame_t* best_top   = nullptr;
+        timed_frame_t* best_front = nullptr;
+        auto best_skew = std::chrono::nanoseconds::max();
+        
+        for(auto& t : stream_top.history)
+          if(is_fresh(stream_top, t))
+            for(auto& f : stream_front.history)
+              if(is_fresh(stream_front, f))
+              {
+                const auto skew = std::chrono::duration_cast<std::chrono::nanoseconds>(t.timestamp > f.timestamp ? t.timestamp - f.timestamp : f.timestamp - t.timestamp);
+                if(skew < best_skew)
+                {
+                  best_skew  = skew;
+                  best_top   = &t;
+                  best_front = &f;
+                }
+              }
+        
+        // 許容差を超えていれば古い方を捨てて次のフレームを待つ
+        //   ※カメラ間のずれが恒常的に大きい場合に止まらないよう、履歴を一巡したら諦めて組にする
+        if(best_skew > sync_tolerance_ && attempt < history_size * 2)
+        {
+          auto& older        = best_top->timestamp < best_front->timestamp ? stream_top : stream_front;
+          auto& older_frame  = best_top->timestamp < best_front->timestamp ? *best_top  : *best_front;
+          DLOG(INFO) << "pair skew[ns] " << best_skew.count() << " exceeds tolerance; drop older frame sequence " << older_frame.sequence;
+          older.consumed = older_frame.sequence;
+          continue;
+        }
+        
+        if(best_skew > sync_tolerance_)
+        {
+          ++unmatched_pair_count_;
+          LOG(WARNING) << "no frame pair within sync tolerance; use pair with skew[ms] " << float(best_skew.count()) / 1000000;
+        }
+        
+        // 履歴のバッファとスロットのバッファを入れ替えて受け取る
+        cv::swap(frames.top  , best_top->frame);
+        cv::swap(frames.front, best_front->frame);
+        handle.top_timestamp   = best_top->timestamp;
+        handle.front_timestamp = best_front->timestamp;
+        stream_top.consumed   = best_top->sequence;
+        stream_front.consumed = best_front->sequence;
+        // 入れ替えた履歴の要素はもう使えない
+        best_top->sequence = best_front->sequence = 0;
+        
+        return true;
+      }
+    }
+    
+    camera_capture_t::frame_handle_t camera_capture_t::operator()()
+    {
+      frame_handle_t handle;
+      
+      // 次の位置から借用されていないスロットを探す
+      for(size_t n = 0; n < ring_.size(); ++n)
+      {
+        const auto slot = (next_slot_ + n) % ring_.size();
+        bool expected = false;
+        if(ring_[slot].borrowed.compare_exchange_strong(expected, true))
+        {
+          handle.slot = slot;
+          break;
+        }
+      }
+      
+      if(!handle.valid())
+      {
+        LOG(WARNING) << "all " << ring_.size() << " frame ring slots are borrowed; skip the frame";
+        return handle;
+      }
+      
+      next_slot_ = (handle.slot + 1) % ring_.size();
+      DLOG(INFO) << "frame ring slot: " << handle.slot;
+      
+      auto& frames = ring_[handle.slot].frames;
+      
+      if(player_)
+      {
+        // 記録ファイルを指すヘッダーを受け取る（複写しない）
+        if(!replay(frames, handle))
+        {
+          ring_[handle.slot].borrowed = false;
+          handle.slot = frame_handle_t::invalid_slot;
+          return handle;
+        }
+      }
+      else if(threaded_)
+      {
+        // キャプチャースレッドの履歴から撮影時刻の揃った組を受け取る
+        if(!take_synchronized(frames, handle))
+        {
+          ring_[handle.slot].borrowed = false;
+          handle.slot = frame_handle_t::invalid_slot;
+          return handle;
+        }
+      }
+      else
+      {
+        // スロットのバッファへ直接読み込む（大きさが変わらない限り再確保は起きない）
+        allocation_count_ += read(top, frames.top);
+        handle.top_timestamp = steady_clock_t::now();
+        DLOG(INFO) << "top-cam captured";
+        
+        allocation_count_ += read(front, frames.front);
+        handle.front_timestamp = steady_clock_t::now();
+        DLOG(INFO) << "front-cam captured";
+      }
+      
+      ++frame_count_;
+      const size_t allocation_count = allocation_count_;
+      last_frame_allocations_  = allocation_count - allocation_count_before_;
+      allocation_count_before_ = allocation_count;
+      DLOG(INFO) << "frame allocations: " << last_frame_allocations_ << " (total " << allocation_count << " / " << frame_count_ << " frames)";
       
-      cv::Mat tmp;
+      last_pair_skew_   = handle.skew();
+      max_pair_skew_    = std::max(max_pair_skew_, last_pair_skew_);
+      total_pair_skew_ += last_pair_skew_;
+      recent_max_pair_skew_    = std::max(recent_max_pair_skew_, last_pair_skew_);
+      recent_total_pair_skew_ += last_pair_skew_;
+      DLOG(INFO) << "pair skew[ms]: " << float(last_pair_skew_.count()) / 1000000;
       
-      captures[top] >> tmp;
-      r.top = tmp.clone();
-      DLOG(INFO) << "top-cam captured";
+      if(report_interval_ && frame_count_ % report_interval_ == 0)
+        report_metrics();
       
-      captures[front] >> tmp;
-      r.front = tmp.clone();
-      DLOG(INFO) << "front-cam captured";
+      handle.frames = frames;
       
-      if(!video_file_top_.empty() && captures[top].get(CV_CAP_PROP_POS_FRAMES) == captures[top].get(CV_CAP_PROP_FRAME_COUNT))
+      if(recorder_)
+        (*recorder_)(frames.top, frames.front, handle.top_timestamp.time_since_epoch(), handle.front_timestamp.time_since_epoch());
+      
+      if(!loop_video_ || player_)
+        return handle;
+      
+      if(!video_file_top_.empty() && video_caches_[top].empty() && captures[top].get(CV_CAP_PROP_POS_FRAMES) == captures[top].get(CV_CAP_PROP_FRAME_COUNT))
       {
         DLOG(INFO) << "top-cam to reload video file: " << video_file_top_;
         captures[top].release();
@@ -116,7 +396,7 @@ namespace arisin
           LOG(FATAL) << "top-cam can not opened";
       }
       
-      if(!video_file_front_.empty() && captures[front].get(CV_CAP_PROP_POS_FRAMES) == captures[front].get(CV_CAP_PROP_FRAME_COUNT))
+      if(!video_file_front_.empty() && video_caches_[front].empty() && captures[front].get(CV_CAP_PROP_POS_FRAMES) == captures[front].get(CV_CAP_PROP_FRAME_COUNT))
       {
         DLOG(INFO) << "front-cam to reload video file: " << video_file_front_;
         captures[front].release();
@@ -125,9 +405,152 @@ namespace arisin
           LOG(FATAL) << "front-cam can not opened";
       }
       
-      return std::move(r);
+      return handle;
     }
     
+    size_t camera_capture_t::read(const size_t camera, cv::Mat& frame)
+    {
+      const auto data = frame.data;
+      
+      auto& cache = video_caches_[camera];
+      if(!cache.empty())
+      {
+        // キャッシュの終端では先頭へ戻る（開き直しもデコードも無い）
+        auto& position = video_cache_positions_[camera];
+        if(position == cache.size())
+        {
+          if(!loop_video_)
+          {
+            DLOG(INFO) << "camera(" << camera << ") reached the end of video cache";
+            end_of_video_ = true;
+            return 0;
+          }
+          position = 0;
+        }
+        
+        cache[position++].copyTo(frame);
+        return frame.data != data ? 1 : 0;
+      }
+      
+      if(!captures[camera].read(frame) && !loop_video_ && !(camera == top ? video_file_top_ : video_file_front_).empty())
+      {
+        DLOG(INFO) << "camera(" << camera << ") reached the end of video file";
+        end_of_video_ = true;
+      }
+      return frame.data != nullptr && frame.data != data ? 1 : 0;
+    }
+    
+    bool camera_capture_t::replay(captured_frames_t& frames, frame_handle_t& handle)
+    {
+      if(replay_position_ == player_->frames())
+      {
+        if(!loop_video_)
+        {
+          DLOG(INFO) << "reached the end of replay file";
+          end_of_video_ = true;
+          return false;
+        }
+        replay_position_ = 0;
+      }
+      
+      recorded_frames_t recorded;
+      if(!(*player_)(replay_position_++, recorded))
+        return false;
+      
+      frames.top   = recorded.top;
+      frames.front = recorded.front;
+      // 記録時の撮影時刻をそのまま使う（組のずれは記録時のものになる）
+      handle.top_timestamp   = steady_clock_t::time_point(std::chrono::duration_cast<steady_clock_t::duration>(recorded.top_timestamp));
+      handle.front_timestamp = steady_clock_t::time_point(std::chrono::duration_cast<steady_clock_t::duration>(recorded.front_timestamp));
+      DLOG(INFO) << "replayed sequence: " << recorded.sequence;
+      
+      return true;
+    }
+    
+    bool camera_capture_t::load_video_cache(const size_t camera, const std::string& video_file, const size_t limit_bytes)
+    {
+      auto& cache = video_caches_[camera];
+      size_t bytes = 0;
+      
+      for(cv::Mat frame; captures[camera].read(frame); )
+      {
+        bytes += frame.total() * frame.elemSize();
+        if(bytes > limit_bytes)
+        {
+          LOG(WARNING) << "camera(" << camera << ") video file exceeds video_cache_mb after " << cache.size() << " frames; decode on each loop instead: " << video_file;
+          std::vector<cv::Mat>().swap(cache);
+          
+          captures[camera].release();
+          captures[camera].open(video_file);
+          if(!captures[camera].isOpened())
+            LOG(FATAL) << "camera(" << camera << ") can not opened";
+          return false;
+        }
+        
+        // read はデコーダーの内部バッファを返す場合があるので、各フレームを独立した領域へ複写する
+        cache.emplace_back(frame.clone());
+      }
+      
+      if(cache.empty())
+      {
+        LOG(WARNING) << "camera(" << camera << ") video file has no frames to cache: " << video_file;
+        captures[camera].release();
+        captures[camera].open(video_file);
+        return false;
+      }
+      
+      // 以後はキャッシュから読むのでデコーダーは閉じる
+      captures[camera].release();
+      DLOG(INFO) << "camera(" << camera << ") cached " << cache.size() << " frames (" << (bytes >> 20) << " MiB): " << video_file;
+      return true;
+    }
+    
+    void camera_capture_t::report_metrics()
+    {
+      // 定常状態では確保の recent が 0 のままになる（DLOG の無いリリースビルドでも確かめられるように LOG(INFO) で出す）
+      const size_t allocation_count = allocation_count_;
+      const auto us = [](const std::chrono::nanoseconds& d){ return std::chrono::duration<double, std::micro>(d).count(); };
+      const auto recent_frames = frame_count_ - report_frame_count_;
+      LOG(INFO) << "camera_capture frames(" << frame_count_
+                << ") allocations: recent(" << (allocation_count - report_allocation_count_)
+                << ") total(" << allocation_count
+                << ") pair skew[us]: recent mean(" << (recent_frames ? us(recent_total_pair_skew_) / recent_frames : 0.)
+                << ") max(" << us(recent_max_pair_skew_)
+                << ") total mean(" << us(mean_pair_skew())
+                << ") max(" << us(max_pair_skew_)
+                << ") out of tolerance: recent(" << (unmatched_pair_count_ - report_unmatched_pair_count_)
+                << ") total(" << unmatched_pair_count_ << ")";
+      
+      report_allocation_count_     = allocation_count;
+      report_frame_count_          = frame_count_;
+      report_unmatched_pair_count_ = unmatched_pair_count_;
+      recent_max_pair_skew_        = std::chrono::nanoseconds(0);
+      recent_total_pair_skew_      = std::chrono::nanoseconds(0);
+    }
+    
+    void camera_capture_t::release(frame_handle_t& handle)
+    {
+      if(!handle.valid())
+        return;
+      
+      DLOG(INFO) << "release frame ring slot: " << handle.slot;
+      handle.frames = captured_frames_t();
+      ring_[handle.slot].borrowed = false;
+      handle.slot = frame_handle_t::invalid_slot;
+    }
+    
+    void camera_capture_t::set_video_loop(const bool enabled)
+    {
+      loop_video_ = enabled;
+      DLOG(INFO) << "set_video_loop enabled: " << enabled;
+    }
+    
+    const bool camera_capture_t::end_of_video() const
+    { return end_of_video_; }
+    
+    const size_t camera_capture_t::video_cache_frames(const bool top_camera) const
+    { return video_caches_[top_camera ? top : front].size(); }
+    
     const int camera_capture_t::top_camera_id() const
     { return top_camera_id_; }
     
@@ -139,6 +562,33 @@ namespace arisin
     
     const int camera_capture_t::height() const
     { return height_; }
+    
+    const size_t camera_capture_t::ring_size() const
+    { return ring_.size(); }
+    
+    const size_t camera_capture_t::frame_count() const
+    { return frame_count_; }
+    
+    const size_t camera_capture_t::allocation_count() const
+    { return allocation_count_; }
+    
+    const size_t camera_capture_t::last_frame_allocations() const
+    { return last_frame_allocations_; }
+    
+    const bool camera_capture_t::threaded() const
+    { return threaded_; }
+    
+    const std::chrono::nanoseconds camera_capture_t::last_pair_skew() const
+    { return last_pair_skew_; }
+    
+    const std::chrono::nanoseconds camera_capture_t::max_pair_skew() const
+    { return max_pair_skew_; }
+    
+    const std::chrono::nanoseconds camera_capture_t::mean_pair_skew() const
+    { return frame_count_ ? total_pair_skew_ / std::chrono::nanoseconds::rep(frame_count_) : std::chrono::nanoseconds(0); }
+    
+    const size_t camera_capture_t::unmatched_pair_count() const
+    { return unmatched_pair_count_; }
 
   }
 }
\ No newline at end of file
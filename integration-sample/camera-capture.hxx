@@ -1,9 +1,19 @@
 #pragma once
 
+#include <atomic>
+#include <array>
+#include <chrono>
+#include <condition_variable>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
 #include <opencv2/core/core.hpp>
 #include <opencv2/highgui/highgui.hpp>
 
 #include "configuration.hxx"
+#include "frame-recording.hxx"
 #include "logger.hxx"
 
 namespace arisin
@@ -19,10 +29,53 @@ namespace arisin
         cv::Mat front;
       };
       
+      // フレームリングから借用したフレーム対
+      //   frames はリングのバッファを指すヘッダーなので、release するまでの間だけ有効。
+      using steady_clock_t = std::chrono::steady_clock;
+      
+      struct frame_handle_t
+      {
+        static constexpr size_t invalid_slot = size_t(-1);
+        size_t slot = invalid_slot;
+        captured_frames_t frames;
+        steady_clock_t::time_point top_timestamp;
+        steady_clock_t::time_point front_timestamp;
+        bool valid() const { return slot != invalid_slot; }
+        // top と front の撮影時刻のずれ
+        std::chrono::nanoseconds skew() const
+        { return std::chrono::duration_cast<std::chrono::nanoseconds>(top_timestamp > front_timestamp ? top_timestamp - front_timestamp : front_timestamp - top_timestamp); }
+      };
+      
     private:
       static constexpr size_t top   = 0;
       static constexpr size_t front = 1;
       
+      struct frame_slot_t
+      {
+        captured_frames_t frames;
+        std::atomic<bool> borrowed;
+        frame_slot_t() : borrowed(false) { }
+      };
+      
+      // キャプチャースレッドが書き込む直近フレームの履歴
+      struct timed_frame_t
+      {
+        cv::Mat frame;
+        steady_clock_t::time_point timestamp;
+        uint64_t sequence = 0;
+      };
+      
+      static constexpr size_t history_size = 3;
+      
+      struct stream_t
+      {
+        std::array<timed_frame_t, history_size> history;
+        size_t   head     = 0;
+        uint64_t sequence = 0;
+        uint64_t consumed = 0;
+        std::thread thread;
+      };
+      
       std::array<cv::VideoCapture, 2> captures;
       
       int top_camera_id_;
@@ -31,14 +84,76 @@ namespace arisin
       int height_;
       std::string video_file_top_;
       std::string video_file_front_;
+      bool loop_video_;
+      bool end_of_video_;
+      
+      // デコード済みの動画フレーム（空ならキャッシュしていない）と次に返す位置
+      std::array<std::vector<cv::Mat>, 2> video_caches_;
+      std::array<size_t, 2> video_cache_positions_;
+      
+      // 記録ファイルの再生（有効ならカメラも動画ファイルも開かない）と記録
+      std::unique_ptr<frame_player_t>   player_;
+      size_t                            replay_position_;
+      std::unique_ptr<frame_recorder_t> recorder_;
+      
+      std::vector<frame_slot_t> ring_;
+      size_t next_slot_;
+      
+      bool threaded_;
+      std::chrono::nanoseconds sync_tolerance_;
+      std::array<stream_t, 2> streams_;
+      std::mutex              streams_mutex_;
+      std::condition_variable streams_condition_;
+      std::atomic<bool>       is_running_;
+      
+      size_t frame_count_;
+      std::atomic<size_t> allocation_count_;
+      size_t allocation_count_before_;
+      size_t last_frame_allocations_;
+      size_t report_interval_;
+      size_t report_allocation_count_;
+      
+      std::chrono::nanoseconds last_pair_skew_;
+      std::chrono::nanoseconds max_pair_skew_;
+      std::chrono::nanoseconds total_pair_skew_;
+      size_t unmatched_pair_count_;
+      
+      // 前回の報告からの撮影時刻のずれ
+      std::chrono::nanoseconds recent_max_pair_skew_;
+      std::chrono::nanoseconds recent_total_pair_skew_;
+      size_t report_frame_count_;
+      size_t report_unmatched_pair_count_;
+      
+      size_t read(const size_t camera, cv::Mat& frame);
+      bool load_video_cache(const size_t camera, const std::string& video_file, const size_t limit_bytes);
+      bool replay(captured_frames_t& frames, frame_handle_t& handle);
+      void capture_loop(const size_t camera);
+      bool take_synchronized(captured_frames_t& frames, frame_handle_t& handle);
+      void report_metrics();
       
     public:
       camera_capture_t(const configuration_t& conf);
-      captured_frames_t operator()();
+      ~camera_capture_t();
+      frame_handle_t operator()();
+      void release(frame_handle_t& handle);
+      // 動画ファイルの終端で先頭へ戻るか（既定は戻る）
+      void set_video_loop(const bool enabled);
+      // 先頭へ戻さない設定で動画ファイルを読み終えた（以後のフレームは無効）
+      const bool end_of_video() const;
+      const size_t video_cache_frames(const bool top_camera) const;
       const int top_camera_id() const;
       const int front_camera_id() const;
       const int width() const;
       const int height() const;
+      const size_t ring_size() const;
+      const size_t frame_count() const;
+      const size_t allocation_count() const;
+      const size_t last_frame_allocations() const;
+      const bool threaded() const;
+      const std::chrono::nanoseconds last_pair_skew() const;
+      const std::chrono::nanoseconds max_pair_skew() const;
+      const std::chrono::nanoseconds mean_pair_skew() const;
+      const size_t unmatched_pair_count() const;
     };
   }
 }
\ No newline at end of file
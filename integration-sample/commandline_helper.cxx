@@ -16,6 +16,7 @@ namespace
       case arisin::etupirka::mode_t::reciever_p1:    return "reciever+";
       case arisin::etupirka::mode_t::dummy_main:     return "dummy-main";
       case arisin::etupirka::mode_t::dummy_reciever: return "dummy-reciever";
+      case arisin::etupirka::mode_t::bench:          return "bench";
     }
     LOG(FATAL) << "unkown mode: " << int(m);
     throw std::runtime_error(std::string("unkown mode: ") + std::to_string(int(m)));
@@ -32,6 +33,7 @@ namespace
       case h("reciever+"):      return arisin::etupirka::mode_t::reciever_p1;
       case h("dummy-main"):     return arisin::etupirka::mode_t::dummy_main;
       case h("dummy-reciever"): return arisin::etupirka::mode_t::dummy_reciever;
+      case h("bench"):          return arisin::etupirka::mode_t::bench;
     }
     LOG(FATAL) << "can not convert to mode_t from: " << s;
     throw std::runtime_error(std::string("can not convert to mode_t from: ") + s);
@@ -127,6 +129,7 @@ namespace arisin
               {
                 case h("main"    ): conf.mode = mode_t::main;     break;
                 case h("reciever"): conf.mode = mode_t::reciever; break;
+                case h("bench"   ): conf.mode = mode_t::bench;    break;
                 default: conf.mode = mode_t::none;
               }
             }
@@ -167,6 +170,31 @@ namespace arisin
             catch(const std::exception& e) { LOG(ERROR) << "catch exception: " << e.what(); }
             continue;
             
+          case h("--record-file"):
+            try { conf.record_file = *++i; }
+            catch(const std::exception& e) { LOG(ERROR) << "catch exception: " << e.what(); }
+            continue;
+            
+          case h("--replay-file"):
+            try { conf.replay_file = *++i; }
+            catch(const std::exception& e) { LOG(ERROR) << "catch exception: " << e.what(); }
+            continue;
+            
+          case h("--video-cache-mb"):
+            try { conf.camera_capture.video_cache_mb = std::stoi(*++i); }
+            catch(const std::exception& e) { LOG(ERROR) << "catch exception: " << e.what(); }
+            continue;
+            
+          case h("--bench/max-frames"):
+            try { conf.bench.max_frames = std::stoi(*++i); }
+            catch(const std::exception& e) { LOG(ERROR) << "catch exception: " << e.what(); }
+            continue;
+            
+          case h("--bench/warmup-frames"):
+            try { conf.bench.warmup_frames = std::stoi(*++i); }
+            catch(const std::exception& e) { LOG(ERROR) << "catch exception: " << e.what(); }
+            continue;
+            
           case h("-p"):
           case h("--port"):
             try { conf.udp_reciever.port = conf.udp_sender.port = std::stoi(*++i); }
@@ -179,6 +207,11 @@ namespace arisin
             catch(const std::exception& e) { LOG(ERROR) << "catch exception: " << e.what(); }
             continue;
             
+          case h("--transport"):
+            try { conf.udp_sender.transport = *++i; }
+            catch(const std::exception& e) { LOG(ERROR) << "catch exception: " << e.what(); }
+            continue;
+            
           case h("-F"):
           case h("--fps"):
             try { conf.fps = std::stoi(*++i); }
@@ -238,6 +271,10 @@ namespace arisin
         "    [-a|--address] (address:string)\n"
         "      set send-to address to (address:string).\n"
         "\n"
+        "    [--transport] (udp|shm)\n"
+        "      send over UDP (default) or over a shared memory ring to a reciever\n"
+        "      on the same host (udp_sender.shm_name; --port and --address are not used).\n"
+        "\n"
         "    [-F|--fps] (fps:int)\n"
         "      set main-loop fps[frames/sec] to (fps:int).\n"
         "\n"
@@ -247,6 +284,17 @@ namespace arisin
         "    [--video-file-front] (filename:string)"
         "      set front-cam source to video file (filename:string)."
         "\n"
+        "    [--record-file] (filename:string)\n"
+        "      record captured top/front frame pairs with timestamps to (filename:string)\n"
+        "      as uncompressed raw frames.\n"
+        "\n"
+        "    [--replay-file] (filename:string)\n"
+        "      replay a recording made by --record-file instead of cameras and video files.\n"
+        "\n"
+        "    [--video-cache-mb] (size:int)\n"
+        "      decode video files at start up into a memory cache up to (size:int) MiB\n"
+        "      and replay from it instead of re-opening the files on loop (0: disabled).\n"
+        "\n"
         "<Usage 3> ./etupirka (-m|--mode) reciever [options]"
         "  run the 'main' mode.\n"
         "    * recieve-keysignal --> invoke-keysignal\n"
@@ -255,13 +303,30 @@ namespace arisin
         "    [-p|--port] (port:int)\n"
         "      set send/recieve port number to (port:int).\n"
         "\n"
+        "    [--transport] (udp|shm)\n"
+        "      recieve over UDP (default) or over a shared memory ring from a main\n"
+        "      on the same host.\n"
+        "\n"
         "    [-F|--fps] (fps:int)\n"
         "      set main-loop fps[frames/sec] to (fps:int).\n"
         "\n"
         "    [-G|--gui]\n"
         "      set enable GUI.\n"
         "\n"
-        "<Usage 4> ./etupirka (-d|--default-conf)\n"
+        "<Usage 4> ./etupirka (-m|--mode) bench (--video-file-top (filename:string) --video-file-front (filename:string)|--replay-file (filename:string)) [options]\n"
+        "  run the 'bench' mode.\n"
+        "    * replay video files (or a raw recording) --> finger-detection --> space-convert\n"
+        "      --> virtual-keyboard --> report (JSON Lines to stdout)\n"
+        "    no wait for fps, no GUI, no UDP; stop at the end of the video files (or the recording).\n"
+        "\n"
+        "  options:\n"
+        "    [--bench/max-frames] (frames:int)\n"
+        "      stop after (frames:int) frames (0: until the end of the video files).\n"
+        "\n"
+        "    [--bench/warmup-frames] (frames:int)\n"
+        "      exclude first (frames:int) frames from the latency report.\n"
+        "\n"
+        "<Usage 5> ./etupirka (-d|--default-conf)\n"
         "  show etupirka default configuration and exit.\n"
         "  if you want save to file: `./etupirka -d > etupirka.conf`"
         "\n"
@@ -303,6 +368,8 @@ namespace arisin
       p.put("fps", conf.fps);
       p.put("video_file_top", conf.video_file_top);
       p.put("video_file_front", conf.video_file_front);
+      p.put("record_file", conf.record_file);
+      p.put("replay_file", conf.replay_file);
       p.put("circle_x_distance_threshold", conf.circle_x_distance_threshold);
       p.put("send_repeat_key_down_signal", conf.send_repeat_key_down_signal);
       p.put("recieve_repeat_key_down_signal", conf.recieve_repeat_key_down_signal);
@@ -310,6 +377,11 @@ namespace arisin
       p.put("camera_capture.front_camera_id", conf.camera_capture.front_camera_id);
       p.put("camera_capture.width", conf.camera_capture.width);
       p.put("camera_capture.height", conf.camera_capture.height);
+      p.put("camera_capture.ring_size", conf.camera_capture.ring_size);
+      p.put("camera_capture.threaded", conf.camera_capture.threaded);
+      p.put("camera_capture.sync_tolerance_ms", conf.camera_capture.sync_tolerance_ms);
+      p.put("camera_capture.video_cache_mb", conf.camera_capture.video_cache_mb);
+      p.put("camera_capture.report_interval", conf.camera_capture.report_interval);
       p.put("finger_detector_top.pre_bilateral_d", conf.finger_detector_top.pre_bilateral_d);
       p.put("finger_detector_top.pre_bilateral_sc", conf.finger_detector_top.pre_bilateral_sc);
       p.put("finger_detector_top.pre_bilateral_ss", conf.finger_detector_top.pre_bilateral_ss);
@@ -320,6 +392,7 @@ namespace arisin
       p.put("finger_detector_top.hsv_s_max", conf.finger_detector_top.hsv_s_max);
       p.put("finger_detector_top.hsv_v_min", conf.finger_detector_top.hsv_v_min);
       p.put("finger_detector_top.hsv_v_max", conf.finger_detector_top.hsv_v_max);
+      p.put("finger_detector_top.hsv_lookup_table", conf.finger_detector_top.hsv_lookup_table);
       p.put("finger_detector_top.nail_morphology_n", conf.finger_detector_top.nail_morphology_n);
       p.put("finger_detector_top.nail_median_blur_ksize", conf.finger_detector_top.nail_median_blur_ksize);
       p.put("finger_detector_top.circles_dp", conf.finger_detector_top.circles_dp);
@@ -328,6 +401,18 @@ namespace arisin
       p.put("finger_detector_top.circles_param_2", conf.finger_detector_top.circles_param_2);
       p.put("finger_detector_top.circles_min_radius", conf.finger_detector_top.circles_min_radius);
       p.put("finger_detector_top.circles_max_radius", conf.finger_detector_top.circles_max_radius);
+      p.put("finger_detector_top.roi_tracking", conf.finger_detector_top.roi_tracking);
+      p.put("finger_detector_top.roi_margin", conf.finger_detector_top.roi_margin);
+      p.put("finger_detector_top.roi_full_scan_interval", conf.finger_detector_top.roi_full_scan_interval);
+      p.put("finger_detector_top.pyramid_scale", conf.finger_detector_top.pyramid_scale);
+      p.put("finger_detector_top.count_allocations", conf.finger_detector_top.count_allocations);
+      p.put("finger_detector_top.pre_bilateral_enabled", conf.finger_detector_top.pre_bilateral_enabled);
+      p.put("finger_detector_top.pre_morphology_enabled", conf.finger_detector_top.pre_morphology_enabled);
+      p.put("finger_detector_top.hsv_enabled", conf.finger_detector_top.hsv_enabled);
+      p.put("finger_detector_top.nail_morphology_enabled", conf.finger_detector_top.nail_morphology_enabled);
+      p.put("finger_detector_top.nail_median_blur_enabled", conf.finger_detector_top.nail_median_blur_enabled);
+      p.put("finger_detector_top.circles_enabled", conf.finger_detector_top.circles_enabled);
+      p.put("finger_detector_top.stage_timing_report_interval", conf.finger_detector_top.stage_timing_report_interval);
       p.put("finger_detector_front.pre_bilateral_d", conf.finger_detector_front.pre_bilateral_d);
       p.put("finger_detector_front.pre_bilateral_sc", conf.finger_detector_front.pre_bilateral_sc);
       p.put("finger_detector_front.pre_bilateral_ss", conf.finger_detector_front.pre_bilateral_ss);
@@ -338,6 +423,7 @@ namespace arisin
       p.put("finger_detector_front.hsv_s_max", conf.finger_detector_front.hsv_s_max);
       p.put("finger_detector_front.hsv_v_min", conf.finger_detector_front.hsv_v_min);
       p.put("finger_detector_front.hsv_v_max", conf.finger_detector_front.hsv_v_max);
+      p.put("finger_detector_front.hsv_lookup_table", conf.finger_detector_front.hsv_lookup_table);
       p.put("finger_detector_front.nail_morphology_n", conf.finger_detector_front.nail_morphology_n);
       p.put("finger_detector_front.nail_median_blur_ksize", conf.finger_detector_front.nail_median_blur_ksize);
       p.put("finger_detector_front.circles_dp", conf.finger_detector_front.circles_dp);
@@ -346,17 +432,52 @@ namespace arisin
       p.put("finger_detector_front.circles_param_2", conf.finger_detector_front.circles_param_2);
       p.put("finger_detector_front.circles_min_radius", conf.finger_detector_front.circles_min_radius);
       p.put("finger_detector_front.circles_max_radius", conf.finger_detector_front.circles_max_radius);
+      p.put("finger_detector_front.roi_tracking", conf.finger_detector_front.roi_tracking);
+      p.put("finger_detector_front.roi_margin", conf.finger_detector_front.roi_margin);
+      p.put("finger_detector_front.roi_full_scan_interval", conf.finger_detector_front.roi_full_scan_interval);
+      p.put("finger_detector_front.pyramid_scale", conf.finger_detector_front.pyramid_scale);
+      p.put("finger_detector_front.count_allocations", conf.finger_detector_front.count_allocations);
+      p.put("finger_detector_front.pre_bilateral_enabled", conf.finger_detector_front.pre_bilateral_enabled);
+      p.put("finger_detector_front.pre_morphology_enabled", conf.finger_detector_front.pre_morphology_enabled);
+      p.put("finger_detector_front.hsv_enabled", conf.finger_detector_front.hsv_enabled);
+      p.put("finger_detector_front.nail_morphology_enabled", conf.finger_detector_front.nail_morphology_enabled);
+      p.put("finger_detector_front.nail_median_blur_enabled", conf.finger_detector_front.nail_median_blur_enabled);
+      p.put("finger_detector_front.circles_enabled", conf.finger_detector_front.circles_enabled);
+      p.put("finger_detector_front.stage_timing_report_interval", conf.finger_detector_front.stage_timing_report_interval);
       p.put("space_converter.top_camera_position", to_string(conf.space_converter.top_camera_position));
       p.put("space_converter.front_camera_position", to_string(conf.space_converter.front_camera_position));
       p.put("space_converter.top_camera_angle_x", conf.space_converter.top_camera_angle_x);
       p.put("space_converter.camera_fov_diagonal", conf.space_converter.camera_fov_diagonal);
       p.put("space_converter.camera_sensor_size", to_string(conf.space_converter.camera_sensor_size));
       p.put("space_converter.image_size", to_string(conf.space_converter.image_size));
+      p.put("space_converter.calibrated", conf.space_converter.calibrated);
+      for(const auto& c : { std::make_pair("top", &conf.space_converter.top_camera_calibration), std::make_pair("front", &conf.space_converter.front_camera_calibration) })
+      {
+        const auto prefix = std::string("space_converter.") + c.first + "_camera_calibration.";
+        p.put(prefix + "focal_length", to_string(c.second->focal_length));
+        p.put(prefix + "principal_point", to_string(c.second->principal_point));
+        p.put(prefix + "distortion", to_string(c.second->distortion));
+        p.put(prefix + "rotation", to_string(c.second->rotation));
+      }
       p.put("virtual_keyboard.database", conf.virtual_keyboard.database);
       p.put("virtual_keyboard.table", conf.virtual_keyboard.table);
+      p.put("virtual_keyboard.use_sqlite_query", conf.virtual_keyboard.use_sqlite_query);
       p.put("udp_sender.address", conf.udp_sender.address);
       p.put("udp_sender.port", conf.udp_sender.port);
+      p.put("udp_sender.max_datagram_size", conf.udp_sender.max_datagram_size);
+      p.put("udp_sender.transport", conf.udp_sender.transport);
+      p.put("udp_sender.shm_name", conf.udp_sender.shm_name);
+      p.put("udp_sender.shm_size_mb", conf.udp_sender.shm_size_mb);
       p.put("udp_reciever.port", conf.udp_reciever.port);
+      p.put("udp_reciever.max_inflight_frames", conf.udp_reciever.max_inflight_frames);
+      p.put("udp_reciever.frame_timeout_ms", conf.udp_reciever.frame_timeout_ms);
+      p.put("udp_reciever.latency_report_interval_s", conf.udp_reciever.latency_report_interval_s);
+      p.put("pipeline.enabled", conf.pipeline.enabled);
+      p.put("pipeline.depth", conf.pipeline.depth);
+      p.put("worker_pool.threads", conf.worker_pool.threads);
+      p.put("worker_pool.first_cpu", conf.worker_pool.first_cpu);
+      p.put("bench.max_frames", conf.bench.max_frames);
+      p.put("bench.warmup_frames", conf.bench.warmup_frames);
       
       return p;
     }
@@ -382,6 +503,8 @@ namespace arisin
       ARISIN_ETUPIRKA_TMP(bool, gui)
       ARISIN_ETUPIRKA_TMP(std::string, video_file_top)
       ARISIN_ETUPIRKA_TMP(std::string, video_file_front)
+      ARISIN_ETUPIRKA_TMP(std::string, record_file)
+      ARISIN_ETUPIRKA_TMP(std::string, replay_file)
       ARISIN_ETUPIRKA_TMP(float, circle_x_distance_threshold)
       ARISIN_ETUPIRKA_TMP(bool, send_repeat_key_down_signal)
       ARISIN_ETUPIRKA_TMP(bool, recieve_repeat_key_down_signal)
@@ -390,6 +513,11 @@ namespace arisin
       ARISIN_ETUPIRKA_TMP(double, camera_capture.front_camera_id)
       ARISIN_ETUPIRKA_TMP(double, camera_capture.width)
       ARISIN_ETUPIRKA_TMP(double, camera_capture.height)
+      ARISIN_ETUPIRKA_TMP(int, camera_capture.ring_size)
+      ARISIN_ETUPIRKA_TMP(bool, camera_capture.threaded)
+      ARISIN_ETUPIRKA_TMP(double, camera_capture.sync_tolerance_ms)
+      ARISIN_ETUPIRKA_TMP(int, camera_capture.video_cache_mb)
+      ARISIN_ETUPIRKA_TMP(int, camera_capture.report_interval)
       
       ARISIN_ETUPIRKA_TMP(double, finger_detector_top.pre_bilateral_d)
       ARISIN_ETUPIRKA_TMP(double, finger_detector_top.pre_bilateral_sc)
@@ -401,6 +529,7 @@ namespace arisin
       ARISIN_ETUPIRKA_TMP(double, finger_detector_top.hsv_s_max)
       ARISIN_ETUPIRKA_TMP(double, finger_detector_top.hsv_v_min)
       ARISIN_ETUPIRKA_TMP(double, finger_detector_top.hsv_v_max)
+      ARISIN_ETUPIRKA_TMP(bool, finger_detector_top.hsv_lookup_table)
       ARISIN_ETUPIRKA_TMP(int, finger_detector_top.nail_morphology_n)
       ARISIN_ETUPIRKA_TMP(int, finger_detector_top.nail_median_blur_ksize)
       ARISIN_ETUPIRKA_TMP(double, finger_detector_top.circles_dp)
@@ -409,7 +538,19 @@ namespace arisin
       ARISIN_ETUPIRKA_TMP(double, finger_detector_top.circles_param_2)
       ARISIN_ETUPIRKA_TMP(int, finger_detector_top.circles_min_radius)
       ARISIN_ETUPIRKA_TMP(int, finger_detector_top.circles_max_radius)
-
+      ARISIN_ETUPIRKA_TMP(bool, finger_detector_top.roi_tracking)
+      ARISIN_ETUPIRKA_TMP(int, finger_detector_top.roi_margin)
+      ARISIN_ETUPIRKA_TMP(int, finger_detector_top.roi_full_scan_interval)
+      ARISIN_ETUPIRKA_TMP(double, finger_detector_top.pyramid_scale)
+      ARISIN_ETUPIRKA_TMP(bool, finger_detector_top.count_allocations)
+      ARISIN_ETUPIRKA_TMP(bool, finger_detector_top.pre_bilateral_enabled)
+      ARISIN_ETUPIRKA_TMP(bool, finger_detector_top.pre_morphology_enabled)
+      ARISIN_ETUPIRKA_TMP(bool, finger_detector_top.hsv_enabled)
+      ARISIN_ETUPIRKA_TMP(bool, finger_detector_top.nail_morphology_enabled)
+      ARISIN_ETUPIRKA_TMP(bool, finger_detector_top.nail_median_blur_enabled)
+      ARISIN_ETUPIRKA_TMP(bool, finger_detector_top.circles_enabled)
+      ARISIN_ETUPIRKA_TMP(int, finger_detector_top.stage_timing_report_interval)
+      
       ARISIN_ETUPIRKA_TMP(double, finger_detector_front.pre_bilateral_d)
       ARISIN_ETUPIRKA_TMP(double, finger_detector_front.pre_bilateral_sc)
       ARISIN_ETUPIRKA_TMP(double, finger_detector_front.pre_bilateral_ss)
@@ -420,6 +561,7 @@ namespace arisin
       ARISIN_ETUPIRKA_TMP(double, finger_detector_front.hsv_s_max)
       ARISIN_ETUPIRKA_TMP(double, finger_detector_front.hsv_v_min)
       ARISIN_ETUPIRKA_TMP(double, finger_detector_front.hsv_v_max)
+      ARISIN_ETUPIRKA_TMP(bool, finger_detector_front.hsv_lookup_table)
       ARISIN_ETUPIRKA_TMP(int, finger_detector_front.nail_morphology_n)
       ARISIN_ETUPIRKA_TMP(int, finger_detector_front.nail_median_blur_ksize)
       ARISIN_ETUPIRKA_TMP(double, finger_detector_front.circles_dp)
@@ -428,20 +570,58 @@ namespace arisin
       ARISIN_ETUPIRKA_TMP(double, finger_detector_front.circles_param_2)
       ARISIN_ETUPIRKA_TMP(int, finger_detector_front.circles_min_radius)
       ARISIN_ETUPIRKA_TMP(int, finger_detector_front.circles_max_radius)
-
+      ARISIN_ETUPIRKA_TMP(bool, finger_detector_front.roi_tracking)
+      ARISIN_ETUPIRKA_TMP(int, finger_detector_front.roi_margin)
+      ARISIN_ETUPIRKA_TMP(int, finger_detector_front.roi_full_scan_interval)
+      ARISIN_ETUPIRKA_TMP(double, finger_detector_front.pyramid_scale)
+      ARISIN_ETUPIRKA_TMP(bool, finger_detector_front.count_allocations)
+      ARISIN_ETUPIRKA_TMP(bool, finger_detector_front.pre_bilateral_enabled)
+      ARISIN_ETUPIRKA_TMP(bool, finger_detector_front.pre_morphology_enabled)
+      ARISIN_ETUPIRKA_TMP(bool, finger_detector_front.hsv_enabled)
+      ARISIN_ETUPIRKA_TMP(bool, finger_detector_front.nail_morphology_enabled)
+      ARISIN_ETUPIRKA_TMP(bool, finger_detector_front.nail_median_blur_enabled)
+      ARISIN_ETUPIRKA_TMP(bool, finger_detector_front.circles_enabled)
+      ARISIN_ETUPIRKA_TMP(int, finger_detector_front.stage_timing_report_interval)
+      
       if(const auto v = p.get_optional<std::string>("space_converter.top_camera_position")) conf.space_converter.top_camera_position = to_aNd_t<3>(v.get());
       if(const auto v = p.get_optional<std::string>("space_converter.front_camera_position")) conf.space_converter.front_camera_position = to_aNd_t<3>(v.get());
       ARISIN_ETUPIRKA_TMP(float, space_converter.top_camera_angle_x)
       ARISIN_ETUPIRKA_TMP(float, space_converter.camera_fov_diagonal)
       if(const auto v = p.get_optional<std::string>("space_converter.camera_sensor_size")) conf.space_converter.camera_sensor_size = to_aNd_t<2>(v.get());
       if(const auto v = p.get_optional<std::string>("space_converter.image_size")) conf.space_converter.image_size = to_aNd_t<2>(v.get());
+      ARISIN_ETUPIRKA_TMP(bool, space_converter.calibrated)
+      for(const auto& c : { std::make_pair("top", &conf.space_converter.top_camera_calibration), std::make_pair("front", &conf.space_converter.front_camera_calibration) })
+      {
+        const auto prefix = std::string("space_converter.") + c.first + "_camera_calibration.";
+        if(const auto v = p.get_optional<std::string>(prefix + "focal_length")) c.second->focal_length = to_aNd_t<2>(v.get());
+        if(const auto v = p.get_optional<std::string>(prefix + "principal_point")) c.second->principal_point = to_aNd_t<2>(v.get());
+        if(const auto v = p.get_optional<std::string>(prefix + "distortion")) c.second->distortion = to_aNd_t<5>(v.get());
+        if(const auto v = p.get_optional<std::string>(prefix + "rotation")) c.second->rotation = to_aNd_t<3>(v.get());
+      }
       
       ARISIN_ETUPIRKA_TMP(std::string, virtual_keyboard.database)
       ARISIN_ETUPIRKA_TMP(std::string, virtual_keyboard.table)
+      ARISIN_ETUPIRKA_TMP(bool, virtual_keyboard.use_sqlite_query)
       
       ARISIN_ETUPIRKA_TMP(std::string, udp_sender.address)
       ARISIN_ETUPIRKA_TMP(int, udp_sender.port)
+      ARISIN_ETUPIRKA_TMP(int, udp_sender.max_datagram_size)
+      ARISIN_ETUPIRKA_TMP(std::string, udp_sender.transport)
+      ARISIN_ETUPIRKA_TMP(std::string, udp_sender.shm_name)
+      ARISIN_ETUPIRKA_TMP(int, udp_sender.shm_size_mb)
       ARISIN_ETUPIRKA_TMP(int, udp_reciever.port)
+      ARISIN_ETUPIRKA_TMP(int, udp_reciever.max_inflight_frames)
+      ARISIN_ETUPIRKA_TMP(int, udp_reciever.frame_timeout_ms)
+      ARISIN_ETUPIRKA_TMP(int, udp_reciever.latency_report_interval_s)
+      
+      ARISIN_ETUPIRKA_TMP(bool, pipeline.enabled)
+      ARISIN_ETUPIRKA_TMP(int, pipeline.depth)
+      
+      ARISIN_ETUPIRKA_TMP(int, worker_pool.threads)
+      ARISIN_ETUPIRKA_TMP(int, worker_pool.first_cpu)
+      
+      ARISIN_ETUPIRKA_TMP(int, bench.max_frames)
+      ARISIN_ETUPIRKA_TMP(int, bench.warmup_frames)
 #undef ARISIN_ETUPIRKA_TMP
     }
     
@@ -459,10 +639,18 @@ namespace arisin
         , ""
         , ""
         
+        , ""
+        , ""
+        
         , {   0
           ,   1
           , 640
           , 480
+          ,   4
+          , true
+          ,  10.
+          ,   0
+          ,   0
           }
         
         , {  16
@@ -477,6 +665,7 @@ namespace arisin
           ,   0.7049
           , 120
           , 255
+          , false
           
           ,   5
           ,  13
@@ -487,6 +676,22 @@ namespace arisin
           ,   8
           ,   4
           ,  12
+          
+          , false
+          ,  16
+          ,  10
+          
+          ,   1.
+          
+          , false
+          
+          , false
+          , true
+          , true
+          , true
+          , true
+          , true
+          ,   0
           }
         
         , {  16
@@ -501,6 +706,7 @@ namespace arisin
           ,   0.3118
           , 199
           , 255
+          , false
           
           ,   5
           ,  13
@@ -511,6 +717,22 @@ namespace arisin
           ,   8
           ,   4
           ,  12
+          
+          , false
+          ,  16
+          ,  10
+          
+          ,   1.
+          
+          , false
+          
+          , false
+          , true
+          , true
+          , true
+          , true
+          , true
+          ,   0
           }
         
         , 6.0
@@ -521,23 +743,56 @@ namespace arisin
           , 64.
           , {{3.60, 2.70}}
           , {{640, 480}}
+          
+          , false
+          // 上の近似と同じ配置（焦点距離は対角視野角とセンサーの大きさから、回転は X 軸周りのみ）
+          , { {{640.1, 640.1}}
+            , {{320., 240.}}
+            , {{0., 0., 0., 0., 0.}}
+            , {{3.68439, 0., 0.}}
+            }
+          , { {{640.1, 640.1}}
+            , {{320., 240.}}
+            , {{0., 0., 0., 0., 0.}}
+            , {{3.14159, 0., 0.}}
+            }
           }
         
         , { "virtual-keyboard.sqlite3"
           , "test"
+          , false
           }
         
         , { "127.0.0.1"
           , 30000
+          , 1472
+          , "udp"
+          , "/etupirka"
+          , 8
           }
         
         , { 30000
+          , 4
+          , 100
+          , 10
           }
         
         , false
         , false
         
         , { }
+        
+        , { false
+          , 2
+          }
+        
+        , { 2
+          , -1
+          }
+        
+        , { 0
+          , 5
+          }
         };
     }
   }
@@ -19,6 +19,7 @@ namespace arisin
     , reciever_p1    // ｛UDP受信（画像）→画像処理→キーシグナル生成→キーストローク発行｝モード
     , dummy_main     // ｛ランダムにキーシグナルを生成→UDP送信（キーシグナル）｝モード
     , dummy_reciever // ｛ランダムにキーシグナルを生成→キーストローク発行｝モード
+    , bench          // ｛動画ファイル再生→画像処理→キーシグナル生成→計測結果出力｝モード
     };
     
     struct configuration_t
@@ -32,12 +33,25 @@ namespace arisin
       std::string video_file_top;
       std::string video_file_front;
       
+      // 撮影したフレーム対を無圧縮で記録するファイル（空なら記録しない）
+      std::string record_file;
+      // カメラと動画ファイルの代わりに再生する記録ファイル（空なら再生しない）
+      std::string replay_file;
+      
       struct camera_capture_configuration_t
       {
         int top_camera_id;
         int front_camera_id;
         int width;
         int height;
+        int ring_size;
+        bool threaded;
+        double sync_tolerance_ms;
+        // 動画ファイルを開始時に全てデコードしてメモリーに置く上限 [MiB]（0 で無効）
+        //   ループ再生の度に開き直してデコードし直す代わりに、キャッシュからフレームを複写する。
+        int video_cache_mb;
+        // フレームバッファの確保回数と top/front の撮影時刻のずれを LOG(INFO) で報告する間隔（フレーム数; 0 で報告しない）
+        int report_interval;
       } camera_capture;
       
       struct finger_detector_configuration_t
@@ -49,6 +63,8 @@ namespace arisin
         int pre_morphology_n;
         
         float hsv_h_min, hsv_h_max, hsv_s_min, hsv_s_max, hsv_v_min, hsv_v_max;
+        // HSV の判定を量子化した BGR のビット表で行う（近似）
+        bool hsv_lookup_table;
         
         int nail_morphology_n;
         int nail_median_blur_ksize;
@@ -59,6 +75,29 @@ namespace arisin
         double circles_param_2;
         int circles_min_radius;
         int circles_max_radius;
+        
+        // 前フレームの円の周辺（最大半径＋roi_margin）だけを処理し、roi_full_scan_interval フレーム毎に全面を処理する
+        bool roi_tracking;
+        int roi_margin;
+        int roi_full_scan_interval;
+        
+        // 全面走査を pyramid_scale 倍に縮小した段で行い、見つかった候補の周辺だけを原寸で精査する（1 で無効）
+        double pyramid_scale;
+        
+        // 検出器の作業領域の確保回数を数え、定常状態で確保し直した場合に警告する（デバッグ用、OpenCV 内部の確保は数えない）
+        bool count_allocations;
+        
+        // 段毎の有効・無効（無効な段は前段の出力をそのまま次段へ渡す）
+        //   HSV 段を無効にした場合は、単チャンネル化のためにグレースケール変換だけを行う。
+        bool pre_bilateral_enabled;
+        bool pre_morphology_enabled;
+        bool hsv_enabled;
+        bool nail_morphology_enabled;
+        bool nail_median_blur_enabled;
+        bool circles_enabled;
+        
+        // 段毎の処理時間を LOG(INFO) で報告する間隔（フレーム数; 0 で報告しない）
+        int stage_timing_report_interval;
       } finger_detector_top
       , finger_detector_front;
       
@@ -76,23 +115,52 @@ namespace arisin
         float_t camera_fov_diagonal;
         a2d_t camera_sensor_size;
         a2d_t image_size;
+        
+        // 透視投影（ピンホール）とレンズ歪みによるカメラ毎の校正値
+        //   calibrated が false なら上の対角視野角と top-cam の X 軸回転だけによる近似を使う。
+        //   focal_length, principal_point [px] と distortion (k1, k2, p1, p2, k3) は OpenCV の内部パラメーターと同じ。
+        //   rotation は世界座標からカメラ座標への回転ベクトル（cv::Rodrigues 形式; cv::solvePnP の rvec）で、
+        //   カメラの位置は上の *_camera_position を使う。カメラ座標は x 右, y 下, z 視線方向。
+        bool calibrated;
+        struct camera_calibration_t
+        {
+          a2d_t focal_length;
+          a2d_t principal_point;
+          std::array<float_t, 5> distortion;
+          a3d_t rotation;
+        } top_camera_calibration
+        , front_camera_calibration;
       } space_converter;
       
       struct virtual_keyboard_configuration_t
       {
         std::string database;
         std::string table;
+        bool use_sqlite_query;
       } virtual_keyboard;
       
       struct udp_sender_configuration_t
       {
         std::string address;
         int port;
+        // main- でフレームを分割して送る1データグラムの大きさ [bytes]（断片ヘッダーを含む）
+        int max_datagram_size;
+        // "udp" か "shm"（同じ計算機の main/main- と reciever/reciever+ を共有メモリーのリングで繋ぐ）
+        //   shm では address と port を使わず、shm_name の POSIX 共有メモリーを使う。
+        //   リングは受信側が shm_size_mb [MiB] で作り、送信側はその容量に合わせる。
+        std::string transport;
+        std::string shm_name;
+        int shm_size_mb;
       } udp_sender;
       
       struct udp_reciever_configuration_t
       {
         int port;
+        // reciever+ で組み立て中にしておくフレーム対の数と、揃うのを待つ時間
+        int max_inflight_frames;
+        int frame_timeout_ms;
+        // reciever で撮影からキー入力までの遅延をログへ出す間隔（0 なら終了時だけ）
+        int latency_report_interval_s;
       } udp_reciever;
       
       bool send_repeat_key_down_signal;
@@ -102,6 +170,28 @@ namespace arisin
       {
         
       } key_invoker;
+      
+      // main モードの段間パイプライン（撮影→検出→統合→出力）
+      struct pipeline_configuration_t
+      {
+        bool enabled;
+        int depth;
+      } pipeline;
+      
+      // 検出用の常駐ワーカー（first_cpu が負ならCPU割り当てをしない）
+      struct worker_pool_configuration_t
+      {
+        int threads;
+        int first_cpu;
+      } worker_pool;
+      
+      // bench モード（録画の再生を待ち無しで回して計測する）
+      //   先頭の warmup_frames は計測から除き、max_frames で打ち切る（0 なら動画の終端まで）。
+      struct bench_configuration_t
+      {
+        int max_frames;
+        int warmup_frames;
+      } bench;
     };
     
     union key_signal_t
@@ -1,5 +1,7 @@
 #include <thread>
-#include <future>
+#include <mutex>
+#include <iomanip>
+#include <iostream>
 #include <boost/version.hpp>
 #include <boost/chrono.hpp>
 #include "etupirka.hxx"
@@ -31,6 +33,39 @@ namespace
 #endif
     }
   }
+  
+  // bench モードで記録するキーシグナル1件分
+  struct bench_key_event_t
+  {
+    size_t   frame;
+    uint32_t code;
+    uint8_t  state;
+  };
+  
+  // 遅延のヒストグラムを1行分の JSON として出す
+  void report_latency(const std::string& name, const arisin::etupirka::latency_histogram_t& histogram)
+  {
+    std::cout
+      << "{\"benchmark\":\"replay/" << name << "\""
+      << ",\"count\":"   << histogram.count()
+      << ",\"mean_ns\":" << histogram.mean().count()
+      << ",\"min_ns\":"  << histogram.min().count()
+      << ",\"p50_ns\":"  << histogram.percentile(50).count()
+      << ",\"p90_ns\":"  << histogram.percentile(90).count()
+      << ",\"p99_ns\":"  << histogram.percentile(99).count()
+      << ",\"max_ns\":"  << histogram.max().count()
+      << ",\"histogram\":[";
+    
+    // [下端, 上端, 件数] の並び
+    const char* separator = "";
+    histogram.for_each_bucket([&](const std::chrono::nanoseconds lower, const std::chrono::nanoseconds upper, const uint64_t count)
+    {
+      std::cout << separator << "[" << lower.count() << "," << upper.count() << "," << count << "]";
+      separator = ",";
+    });
+    
+    std::cout << "]}" << std::endl;
+  }
 }
 
 namespace arisin
@@ -40,6 +75,8 @@ namespace arisin
     etupirka_t::etupirka_t(const configuration_t& conf)
       : conf_(conf)
       , main_loop_wait_( std::chrono::duration_cast<std::chrono::nanoseconds>( std::chrono::seconds(1) / static_cast<long double>(conf.fps) ) )
+      , detection_top_task_  ([this]{ (*finger_detector_top  )(*detection_top_.frame  , *detection_top_.circles  ); })
+      , detection_front_task_([this]{ (*finger_detector_front)(*detection_front_.frame, *detection_front_.circles); })
     {
       DLOG(INFO) << "etupirka ctor";
       
@@ -60,18 +97,29 @@ namespace arisin
         return;
       }
       
-      auto t = std::thread([&]()
-      {
-        std::string buffer;
-        std::getline(std::cin, buffer);
-        is_running_ = false;
-      });
+      // bench モードは動画の終端で自ら止まるので標準入力を待たない
+      std::thread t;
+      if(conf_.mode != mode_t::bench)
+        t = std::thread([&]()
+        {
+          std::string buffer;
+          std::getline(std::cin, buffer);
+          is_running_ = false;
+        });
       
       switch(conf_.mode)
       {
         case mode_t::main:
-          DLOG(INFO) << "mode is main, to run_main";
-          run_main();
+          if(conf_.pipeline.enabled)
+          {
+            DLOG(INFO) << "mode is main with pipeline, to run_main_pipelined";
+            run_main_pipelined();
+          }
+          else
+          {
+            DLOG(INFO) << "mode is main, to run_main";
+            run_main();
+          }
           break;
           
         case mode_t::reciever:
@@ -99,12 +147,18 @@ namespace arisin
           run_dummy_reciever();
           break;
           
+        case mode_t::bench:
+          DLOG(INFO) << "mode is bench, to run_bench";
+          run_bench();
+          break;
+          
         case mode_t::none:
         default:
           DLOG(INFO) << "mode is none, return";
       }
       
-      t.join();
+      if(t.joinable())
+        t.join();
       
       DLOG(INFO) << "exit main loop";
     }
@@ -119,116 +173,58 @@ namespace arisin
       DLOG(INFO) << "run main mode main loop";
       
       virtual_keyboard_t::pressing_keys_t pressing_keys_before;
+      std::vector<virtual_keyboard_t::point_t> real_positions;
+      finger_detector_t::circles_t circles_top;
+      finger_detector_t::circles_t circles_front;
       
       while(is_running_)
       {
         adjust_fps([&]()
         {
           DLOG(INFO) << "to camera_capture()";
-          // topとfrontのカメラキャプチャー像を手に入れる。
-          const auto captured_frames = (*camera_capture)();
+          // topとfrontのカメラキャプチャー像をフレームリングから借用する。
+          auto frame_handle = (*camera_capture)();
+          const auto& captured_frames = frame_handle.frames;
           
           if(captured_frames.top.rows != conf_.camera_capture.height || captured_frames.top.cols != conf_.camera_capture.width)
           {
             LOG(WARNING) << "top-cam captured frame is invalid data; skip the frame and continue";
+            camera_capture->release(frame_handle);
             return;
           }
           
           if(captured_frames.front.rows != conf_.camera_capture.height || captured_frames.front.cols != conf_.camera_capture.width)
           {
             LOG(WARNING) << "front-cam captured frame is invalid data; skip the frame and continue";
+            camera_capture->release(frame_handle);
             return;
           }
           
-          DLOG(INFO) << "to finger_detector_top()";
-          // topから指先群を検出する。
-          auto finger_detector_future_top = std::async([&](){ return (*finger_detector_top)(captured_frames.top); });
-          
-          DLOG(INFO) << "to finger_detector_front()";
-          // frontから指先群を検出する。
-          auto finger_detector_future_front = std::async([&](){ return (*finger_detector_front)(captured_frames.front); });
-          
-          const auto circles_top   = finger_detector_future_top.get();
-          const auto circles_front = finger_detector_future_front.get();
+          DLOG(INFO) << "to detect_fingers()";
+          // topとfrontから指先群を検出する。
+          detect_fingers(captured_frames, circles_top, circles_front);
           DLOG(INFO) << "circles_top.size(): "   << circles_top.size();
           DLOG(INFO) << "circles_front.size(): " << circles_front.size();
           
+          DLOG(INFO) << "to estimate_real_positions()";
+          // topとfrontの検出円群から3次元空間における指先群の座標を求める
+          estimate_real_positions(circles_top, circles_front, real_positions);
+          
           DLOG(INFO) << "to virtual_keyboard->reset()";
           // 仮想キーボードの状態をリセット
           virtual_keyboard->reset();
-              
-          DLOG(INFO) << "to for(circles_top)";
-          // topの検出円群をforで回す
-          for(const auto& ct : circles_top)
-          {
-            // ここでだけ何度も使うので2実数点の距離を算出するλ式にdと名づけて定義しておく。
-            auto d = [](float a, float b){ return std::abs(a - b); };
-            
-            // 着目しているtopのある検出円のX座標に最も近いX座標のfrontの検出円を探索する。
-            auto x_distance_min_element = std::min_element
-            ( std::begin(circles_front), std::end(circles_front)
-            , [&](const finger_detector_t::circles_t::value_type& cf1, const finger_detector_t::circles_t::value_type& cf2)
-              { return d(ct[0], cf1[0]) < d(ct[0], cf2[0]); }
-            );
-            
-            if(x_distance_min_element == std::end(circles_front))
-              continue;
-            
-            // 一番近い子をとりあえずcfとして迎え入れる。
-            const auto& cf = *x_distance_min_element;
-            DLOG(INFO) << "x-distance(ct, cf): " << d(ct[0], cf[0]);
-            
-            // X座標距離に判定のしきい値を適用する
-            if(d(ct[0], cf[0]) <= conf_.circle_x_distance_threshold)
-            {
-              // 3次元空間における座標が求まる
-              const auto real_position = (*space_converter)({{ct[0], ct[1] + ct[2]}}, {{cf[0], cf[1] + cf[2]}});
-              DLOG(INFO) << "estimated real_position: (" << real_position[0] << "," << real_position[1] << "," << real_position[2] << ")";
-              DLOG(INFO) << "to virtual_keyboard->add_test()";
-              // 仮想キーボードの押下テスト＆もしかしたらシグナル追加
-              virtual_keyboard->add_test(real_position[0], real_position[1], real_position[2]);
-            }
-          }
+          
+          DLOG(INFO) << "to virtual_keyboard->add_tests()";
+          // 仮想キーボードの押下テスト＆もしかしたらシグナル追加（1フレーム分をまとめて）
+          virtual_keyboard->add_tests(real_positions);
           
           DLOG(INFO) << "to virtual_keyboard->pressing_keys()";
           // 仮想キーボードの状態を取得
           const auto pressing_keys = virtual_keyboard->pressing_keys();
           
-          if(conf_.send_repeat_key_down_signal)
-          {
-            DLOG(INFO) << "to send key-down all";
-            // 押されているキーを全て
-            for(const auto pressing_key : pressing_keys)
-            {
-              DLOG(INFO) << "to udp_sender(); key-down signal: " << pressing_key;
-              // UDP送出する
-              (*udp_sender)(key_signal_t(uint32_t(pressing_key), uint8_t(WonderRabbitProject::key::writer_t::state_t::down)));
-            }
-          }
-          else
-          {
-            DLOG(INFO) << "to send key-down without before downed";
-            // 押されているキーのうち、
-            for(const auto pressing_key : pressing_keys)
-              // 前回押されていなかったキーのみ
-              if(std::find(std::begin(pressing_keys_before), std::end(pressing_keys_before), pressing_key) == std::end(pressing_keys_before))
-              {
-                DLOG(INFO) << "to udp_sender(); key-down signal: " << pressing_key;
-                // UDP送出する
-                (*udp_sender)(key_signal_t(uint32_t(pressing_key), uint8_t(WonderRabbitProject::key::writer_t::state_t::down)));
-              }
-          }
-          
-          DLOG(INFO) << "to send key-up";
-          // 前回のキー押下状態を全てforで回し
-          for(const auto pressing_key_before : pressing_keys_before)
-            // 離されたキーを検出して
-            if(std::find(std::begin(pressing_keys), std::end(pressing_keys), pressing_key_before) == std::end(pressing_keys))
-            {
-              DLOG(INFO) << "to udp_sender(); key-up signal: " << pressing_key_before;
-              // UDP送出する
-              (*udp_sender)(key_signal_t(uint32_t(pressing_key_before), uint8_t(WonderRabbitProject::key::writer_t::state_t::up)));
-            }
+          DLOG(INFO) << "to send_key_signals()";
+          // 前回からのキー押下状態の変化をUDP送出する
+          send_key_signals(pressing_keys, pressing_keys_before, std::max(frame_handle.top_timestamp, frame_handle.front_timestamp));
           
           // 現在押されていたキー群を次のループでの前のキー押下状態として使えるように保存
           pressing_keys_before = pressing_keys;
@@ -250,32 +246,298 @@ namespace arisin
               finger_detector_front->set(gui->current_finger_detector_conf());
             }
           }
+          
+          // フレームリングへ返却
+          camera_capture->release(frame_handle);
         }
         , main_loop_wait_
         );
       }
     }
     
-    void etupirka_t::run_reciever()
+    void etupirka_t::run_main_pipelined()
     {
+      // フレームリングは各キューの容量分に加え、撮影・検出・統合・出力の各段が処理中の1枚ずつを同時に借用し得る
+      const auto depth = size_t(std::max(1, conf_.pipeline.depth));
+      const auto required_ring_size = int(depth * 3 + 4);
+      if(conf_.camera_capture.ring_size < required_ring_size)
+      {
+        LOG(WARNING) << "camera_capture.ring_size(" << conf_.camera_capture.ring_size << ") is too small for pipeline.depth(" << depth << "); use " << required_ring_size;
+        conf_.camera_capture.ring_size = required_ring_size;
+      }
+      
+      DLOG(INFO) << "to initialize";
       initialize();
       
       is_running_ = true;
       
-      DLOG(INFO) << "run reciever mode main loop";
+      DLOG(INFO) << "run main mode pipelined main loop; depth: " << depth;
       
-      while(is_running_)
+      // キューから押し出されたフレームはフレームリングへ返却する
+      const auto release = [&](pipeline_frame_t& frame){ camera_capture->release(frame.frame_handle); };
+      bounded_queue_t<pipeline_frame_t> detection_queue(depth, release);
+      bounded_queue_t<pipeline_frame_t> fusion_queue(depth, release);
+      bounded_queue_t<pipeline_frame_t> output_queue(depth, release);
+      
+      // GUIで変更された検出器の設定は検出段が次のフレームの前に反映する
+      std::mutex detector_conf_mutex;
+      bool detector_conf_pending = false;
+      bool detector_conf_is_top  = true;
+      configuration_t::finger_detector_configuration_t detector_conf;
+      
+      // 撮影段
+      auto capture_stage = std::thread([&]()
       {
-        adjust_fps([&]()
+        while(is_running_)
         {
-          const auto key_signal = (*udp_reciever)();
-          (*key_invoker)(key_signal.code_state.code, WonderRabbitProject::key::writer_t::state_t(key_signal.code_state.state));
+          adjust_fps([&]()
+          {
+            DLOG(INFO) << "to camera_capture()";
+            pipeline_frame_t frame;
+            frame.frame_handle = (*camera_capture)();
+            const auto& captured_frames = frame.frame_handle.frames;
+            
+            if(captured_frames.top.rows != conf_.camera_capture.height || captured_frames.top.cols != conf_.camera_capture.width)
+            {
+              LOG(WARNING) << "top-cam captured frame is invalid data; skip the frame and continue";
+              camera_capture->release(frame.frame_handle);
+              return;
+            }
+            
+            if(captured_frames.front.rows != conf_.camera_capture.height || captured_frames.front.cols != conf_.camera_capture.width)
+            {
+              LOG(WARNING) << "front-cam captured frame is invalid data; skip the frame and continue";
+              camera_capture->release(frame.frame_handle);
+              return;
+            }
+            
+            if(detection_queue.push(std::move(frame)))
+              DLOG(INFO) << "detection_queue is full; dropped the oldest frame";
+          }
+          , main_loop_wait_
+          );
         }
-        , main_loop_wait_
+        
+        detection_queue.close();
+      });
+      
+      // 検出段
+      auto detection_stage = std::thread([&]()
+      {
+        pipeline_frame_t frame;
+        while(detection_queue.pop(frame))
+        {
+          {
+            std::lock_guard<std::mutex> lock(detector_conf_mutex);
+            if(detector_conf_pending)
+            {
+              DLOG(INFO) << "set to " << (detector_conf_is_top ? "top" : "front");
+              (detector_conf_is_top ? finger_detector_top : finger_detector_front)->set(detector_conf);
+              detector_conf_pending = false;
+            }
+          }
+          
+          DLOG(INFO) << "to detect_fingers()";
+          detect_fingers(frame.frame_handle.frames, frame.circles_top, frame.circles_front);
+          DLOG(INFO) << "circles_top.size(): "   << frame.circles_top.size();
+          DLOG(INFO) << "circles_front.size(): " << frame.circles_front.size();
+          
+          // 検出器の作業領域は次のフレームで上書きされるので、GUIへ渡す分は複製しておく
+          if(conf_.gui)
+          {
+            frame.effected_top   = finger_detector_top->effected_frame().clone();
+            frame.effected_front = finger_detector_front->effected_frame().clone();
+          }
+          
+          if(fusion_queue.push(std::move(frame)))
+            DLOG(INFO) << "fusion_queue is full; dropped the oldest frame";
+        }
+        
+        fusion_queue.close();
+      });
+      
+      // 統合段
+      auto fusion_stage = std::thread([&]()
+      {
+        std::vector<virtual_keyboard_t::point_t> real_positions;
+        pipeline_frame_t frame;
+        while(fusion_queue.pop(frame))
+        {
+          DLOG(INFO) << "to estimate_real_positions()";
+          estimate_real_positions(frame.circles_top, frame.circles_front, real_positions);
+          
+          DLOG(INFO) << "to virtual_keyboard->add_tests()";
+          virtual_keyboard->reset();
+          virtual_keyboard->add_tests(real_positions);
+          frame.pressing_keys = virtual_keyboard->pressing_keys();
+          
+          if(output_queue.push(std::move(frame)))
+            DLOG(INFO) << "output_queue is full; dropped the oldest frame";
+        }
+        
+        output_queue.close();
+      });
+      
+      // 出力段（GUIを扱うためこのスレッドで回す）
+      {
+        virtual_keyboard_t::pressing_keys_t pressing_keys_before;
+        pipeline_frame_t frame;
+        while(output_queue.pop(frame))
+        {
+          DLOG(INFO) << "to send_key_signals()";
+          send_key_signals(frame.pressing_keys, pressing_keys_before, std::max(frame.frame_handle.top_timestamp, frame.frame_handle.front_timestamp));
+          pressing_keys_before = frame.pressing_keys;
+          
+          if(conf_.gui)
+          {
+            DLOG(INFO) << "gui()";
+            (*gui)({frame.frame_handle.frames.top, frame.frame_handle.frames.front, frame.effected_top, frame.effected_front, frame.circles_top, frame.circles_front});
+            
+            DLOG(INFO) << "propagate conf to finger_detector_top/front";
+            std::lock_guard<std::mutex> lock(detector_conf_mutex);
+            detector_conf_pending = true;
+            detector_conf_is_top  = gui->current_is_top();
+            detector_conf         = gui->current_finger_detector_conf();
+          }
+          
+          // フレームリングへ返却
+          camera_capture->release(frame.frame_handle);
+        }
+      }
+      
+      capture_stage.join();
+      detection_stage.join();
+      fusion_stage.join();
+      
+      DLOG(INFO) << "dropped frames; detection: " << detection_queue.dropped_count() << ", fusion: " << fusion_queue.dropped_count() << ", output: " << output_queue.dropped_count();
+    }
+    
+    void etupirka_t::detect_fingers(const camera_capture_t::captured_frames_t& captured_frames, finger_detector_t::circles_t& circles_top, finger_detector_t::circles_t& circles_front)
+    {
+      // 検出タスクの入出力を差し替えて、常駐ワーカーで top と front を並列に回す
+      detection_top_   = { &captured_frames.top  , &circles_top   };
+      detection_front_ = { &captured_frames.front, &circles_front };
+      
+      worker_pool->submit(detection_top_task_  , 0);
+      worker_pool->submit(detection_front_task_, 1);
+      
+      detection_top_task_.wait();
+      detection_front_task_.wait();
+    }
+    
+    void etupirka_t::estimate_real_positions(const finger_detector_t::circles_t& circles_top, const finger_detector_t::circles_t& circles_front, std::vector<virtual_keyboard_t::point_t>& real_positions)
+    {
+      real_positions.clear();
+      fusion_top_targets_.clear();
+      fusion_front_targets_.clear();
+      
+      DLOG(INFO) << "to for(circles_top)";
+      // topの検出円群をforで回す
+      for(const auto& ct : circles_top)
+      {
+        // ここでだけ何度も使うので2実数点の距離を算出するλ式にdと名づけて定義しておく。
+        auto d = [](float a, float b){ return std::abs(a - b); };
+        
+        // 着目しているtopのある検出円のX座標に最も近いX座標のfrontの検出円を探索する。
+        auto x_distance_min_element = std::min_element
+        ( std::begin(circles_front), std::end(circles_front)
+        , [&](const finger_detector_t::circles_t::value_type& cf1, const finger_detector_t::circles_t::value_type& cf2)
+          { return d(ct[0], cf1[0]) < d(ct[0], cf2[0]); }
         );
+        
+        if(x_distance_min_element == std::end(circles_front))
+          continue;
+        
+        // 一番近い子をとりあえずcfとして迎え入れる。
+        const auto& cf = *x_distance_min_element;
+        DLOG(INFO) << "x-distance(ct, cf): " << d(ct[0], cf[0]);
+        
+        // X座標距離に判定のしきい値を適用する
+        if(d(ct[0], cf[0]) <= conf_.circle_x_distance_threshold)
+        {
+          // 組を溜めておき、後でまとめて変換する
+          fusion_top_targets_.push_back({{ct[0], ct[1] + ct[2]}});
+          fusion_front_targets_.push_back({{cf[0], cf[1] + cf[2]}});
+        }
+      }
+      
+      // 3次元空間における座標が求まる（1フレーム分の組を1回で変換する）
+      (*space_converter)(fusion_top_targets_, fusion_front_targets_, fusion_points_);
+      
+      for(size_t n = 0; n < fusion_points_.size(); ++n)
+      {
+        const auto real_position = fusion_points_[n];
+        DLOG(INFO) << "estimated real_position: (" << real_position[0] << "," << real_position[1] << "," << real_position[2] << ")";
+        real_positions.emplace_back(real_position);
       }
     }
     
+    void etupirka_t::send_key_signals(const virtual_keyboard_t::pressing_keys_t& pressing_keys, const virtual_keyboard_t::pressing_keys_t& pressing_keys_before, const camera_capture_t::steady_clock_t::time_point capture_time)
+    {
+      key_signals_.clear();
+      diff_key_signals(pressing_keys, pressing_keys_before, [this](const key_signal_t& key_signal){ key_signals_.push_back(key_signal); });
+      
+      // 変化があればフレーム分をまとめて1つのデータグラムでUDP送出する
+      if(!key_signals_.empty())
+        (*udp_sender)(key_signals_, capture_time);
+    }
+    
+    void etupirka_t::diff_key_signals(const virtual_keyboard_t::pressing_keys_t& pressing_keys, const virtual_keyboard_t::pressing_keys_t& pressing_keys_before, const std::function<void(const key_signal_t&)>& emit)
+    {
+      if(conf_.send_repeat_key_down_signal)
+      {
+        DLOG(INFO) << "to emit key-down all";
+        // 押されているキーを全て
+        for(const auto pressing_key : pressing_keys)
+        {
+          DLOG(INFO) << "to emit(); key-down signal: " << pressing_key;
+          emit(key_signal_t(uint32_t(pressing_key), uint8_t(WonderRabbitProject::key::writer_t::state_t::down)));
+        }
+      }
+      else
+      {
+        DLOG(INFO) << "to emit key-down without before downed";
+        // 押されているキーのうち、
+        for(const auto pressing_key : pressing_keys)
+          // 前回押されていなかったキーのみ
+          if(std::find(std::begin(pressing_keys_before), std::end(pressing_keys_before), pressing_key) == std::end(pressing_keys_before))
+          {
+            DLOG(INFO) << "to emit(); key-down signal: " << pressing_key;
+            emit(key_signal_t(uint32_t(pressing_key), uint8_t(WonderRabbitProject::key::writer_t::state_t::down)));
+          }
+      }
+      
+      DLOG(INFO) << "to emit key-up";
+      // 前回のキー押下状態を全てforで回し
+      for(const auto pressing_key_before : pressing_keys_before)
+        // 離されたキーを検出して
+        if(std::find(std::begin(pressing_keys), std::end(pressing_keys), pressing_key_before) == std::end(pressing_keys))
+        {
+          DLOG(INFO) << "to emit(); key-up signal: " << pressing_key_before;
+          emit(key_signal_t(uint32_t(pressing_key_before), uint8_t(WonderRabbitProject::key::writer_t::state_t::up)));
+        }
+    }
+    
+    void etupirka_t::run_reciever()
+    {
+      initialize();
+      
+      is_running_ = true;
+      
+      DLOG(INFO) << "run reciever mode main loop";
+      
+      // fps に合わせて待つと待ちの間に届いたキーシグナルが遅れるので、届き次第適用する
+      udp_reciever->run_key_batches
+      ( [&](const key_batch_t& key_batch)
+        {
+          // 1フレーム分のキーシグナルを続けて全て適用する
+          for(const auto& key_signal : key_batch.key_signals)
+            (*key_invoker)(key_signal.code_state.code, WonderRabbitProject::key::writer_t::state_t(key_signal.code_state.state));
+        }
+      , [&](){ return is_running_.load(); }
+      );
+    }
+    
     void etupirka_t::run_main_m1()
     {
       DLOG(INFO) << "to initialize";
@@ -290,22 +552,27 @@ namespace arisin
         adjust_fps([&]()
         {
           DLOG(INFO) << "to camera_capture()";
-          // topとfrontのカメラキャプチャー像を手に入れる。
-          const auto captured_frames = (*camera_capture)();
+          // topとfrontのカメラキャプチャー像をフレームリングから借用する。
+          auto frame_handle = (*camera_capture)();
+          const auto& captured_frames = frame_handle.frames;
           
           if(captured_frames.top.rows != conf_.camera_capture.height || captured_frames.top.cols != conf_.camera_capture.width)
           {
             LOG(WARNING) << "top-cam captured frame is invalid data; skip the frame and continue";
+            camera_capture->release(frame_handle);
             return;
           }
           
           if(captured_frames.front.rows != conf_.camera_capture.height || captured_frames.front.cols != conf_.camera_capture.width)
           {
             LOG(WARNING) << "front-cam captured frame is invalid data; skip the frame and continue";
+            camera_capture->release(frame_handle);
             return;
           }
           
           (*udp_sender)(captured_frames);
+          
+          camera_capture->release(frame_handle);
         }
         , main_loop_wait_
         );
@@ -317,6 +584,9 @@ namespace arisin
       initialize();
       
       virtual_keyboard_t::pressing_keys_t pressing_keys_before;
+      std::vector<virtual_keyboard_t::point_t> real_positions;
+      finger_detector_t::circles_t circles_top;
+      finger_detector_t::circles_t circles_front;
       
       is_running_ = true;
       
@@ -328,55 +598,29 @@ namespace arisin
         {
           const auto captured_frames = udp_reciever->recieve_captured_frames();
           
-          DLOG(INFO) << "to finger_detector_top()";
-          // topから指先群を検出する。
-          auto finger_detector_future_top = std::async([&](){ return (*finger_detector_top)(captured_frames.top); });
-          
-          DLOG(INFO) << "to finger_detector_front()";
-          // frontから指先群を検出する。
-          auto finger_detector_future_front = std::async([&](){ return (*finger_detector_front)(captured_frames.front); });
+          if(captured_frames.top.empty() || captured_frames.front.empty())
+          {
+            LOG(WARNING) << "recieved frame can not be decoded; skip the frame and continue";
+            return;
+          }
           
-          const auto circles_top   = finger_detector_future_top.get();
-          const auto circles_front = finger_detector_future_front.get();
+          DLOG(INFO) << "to detect_fingers()";
+          // topとfrontから指先群を検出する。
+          detect_fingers(captured_frames, circles_top, circles_front);
           DLOG(INFO) << "circles_top.size(): "   << circles_top.size();
           DLOG(INFO) << "circles_front.size(): " << circles_front.size();
           
+          DLOG(INFO) << "to estimate_real_positions()";
+          // topとfrontの検出円群から3次元空間における指先群の座標を求める
+          estimate_real_positions(circles_top, circles_front, real_positions);
+          
           DLOG(INFO) << "to virtual_keyboard->reset()";
           // 仮想キーボードの状態をリセット
           virtual_keyboard->reset();
-              
-          DLOG(INFO) << "to for(circles_top)";
-          // topの検出円群をforで回す
-          for(const auto& ct : circles_top)
-          {
-            // ここでだけ何度も使うので2実数点の距離を算出するλ式にdと名づけて定義しておく。
-            auto d = [](float a, float b){ return std::abs(a - b); };
-            
-            // 着目しているtopのある検出円のX座標に最も近いX座標のfrontの検出円を探索する。
-            auto x_distance_min_element = std::min_element
-            ( std::begin(circles_front), std::end(circles_front)
-            , [&](const finger_detector_t::circles_t::value_type& cf1, const finger_detector_t::circles_t::value_type& cf2)
-              { return d(ct[0], cf1[0]) < d(ct[0], cf2[0]); }
-            );
-            
-            if(x_distance_min_element == std::end(circles_front))
-              continue;
-            
-            // 一番近い子をとりあえずcfとして迎え入れる。
-            const auto& cf = *x_distance_min_element;
-            DLOG(INFO) << "x-distance(ct, cf): " << d(ct[0], cf[0]);
-            
-            // X座標距離に判定のしきい値を適用する
-            if(d(ct[0], cf[0]) <= conf_.circle_x_distance_threshold)
-            {
-              // 3次元空間における座標が求まる
-              const auto real_position = (*space_converter)({{ct[0], ct[1] + ct[2]}}, {{cf[0], cf[1] + cf[2]}});
-              DLOG(INFO) << "estimated real_position: (" << real_position[0] << "," << real_position[1] << "," << real_position[2] << ")";
-              DLOG(INFO) << "to virtual_keyboard->add_test()";
-              // 仮想キーボードの押下テスト＆もしかしたらシグナル追加
-              virtual_keyboard->add_test(real_position[0], real_position[1], real_position[2]);
-            }
-          }
+          
+          DLOG(INFO) << "to virtual_keyboard->add_tests()";
+          // 仮想キーボードの押下テスト＆もしかしたらシグナル追加（1フレーム分をまとめて）
+          virtual_keyboard->add_tests(real_positions);
           
           DLOG(INFO) << "to virtual_keyboard->pressing_keys()";
           // 仮想キーボードの状態を取得
@@ -461,7 +705,7 @@ namespace arisin
       {
         adjust_fps([&]()
         {
-          (*udp_sender)(key_signal_t(distribution(rng), uint8_t(WonderRabbitProject::key::writer_t::state_t::press)));
+          (*udp_sender)({ key_signal_t(distribution(rng), uint8_t(WonderRabbitProject::key::writer_t::state_t::press)) }, camera_capture_t::steady_clock_t::now());
         }
         , main_loop_wait_
         );
@@ -491,6 +735,164 @@ namespace arisin
       }
     }
     
+    void etupirka_t::run_bench()
+    {
+      DLOG(INFO) << "to initialize";
+      initialize();
+      
+      is_running_ = true;
+      
+      DLOG(INFO) << "run bench mode main loop";
+      
+      using bench_clock_t = std::chrono::steady_clock;
+      const auto elapsed = [](const bench_clock_t::time_point& from, const bench_clock_t::time_point& to){ return std::chrono::duration_cast<std::chrono::nanoseconds>(to - from); };
+      
+      const auto max_frames    = size_t(std::max(0, conf_.bench.max_frames));
+      const auto warmup_frames = size_t(std::max(0, conf_.bench.warmup_frames));
+      
+      // 段毎の遅延（撮影, 検出, 統合, 仮想キーボード, 1フレーム全体）
+      latency_histogram_t capture_latency, detection_latency, fusion_latency, keyboard_latency, frame_latency;
+      // top と front の撮影時刻のずれ
+      latency_histogram_t pair_skew;
+      // 検出器の段毎の遅延（top, front）
+      std::array<std::array<latency_histogram_t, finger_detector_t::stages>, 2> detector_latencies;
+      const std::array<finger_detector_t*, 2> detectors = {{ finger_detector_top.get(), finger_detector_front.get() }};
+      
+      std::vector<bench_key_event_t> key_events;
+      virtual_keyboard_t::pressing_keys_t pressing_keys_before;
+      std::vector<virtual_keyboard_t::point_t> real_positions;
+      finger_detector_t::circles_t circles_top;
+      finger_detector_t::circles_t circles_front;
+      
+      size_t frames = 0;
+      size_t skipped_frames = 0;
+      auto measure_start = bench_clock_t::now();
+      size_t warmup_allocations = 0;
+      
+      // 待ち無しで動画の終端（または max_frames）まで回す
+      while(is_running_ && (!max_frames || frames < max_frames))
+      {
+        if(frames == warmup_frames)
+        {
+          measure_start      = bench_clock_t::now();
+          warmup_allocations = camera_capture->allocation_count();
+        }
+        
+        const auto time_capture = bench_clock_t::now();
+        auto frame_handle = (*camera_capture)();
+        const auto& captured_frames = frame_handle.frames;
+        
+        if(camera_capture->end_of_video())
+        {
+          DLOG(INFO) << "reached the end of video files";
+          camera_capture->release(frame_handle);
+          break;
+        }
+        
+        if
+        (  captured_frames.top.rows   != conf_.camera_capture.height || captured_frames.top.cols   != conf_.camera_capture.width
+        || captured_frames.front.rows != conf_.camera_capture.height || captured_frames.front.cols != conf_.camera_capture.width
+        )
+        {
+          LOG(WARNING) << "captured frame is invalid data; skip the frame and continue";
+          ++skipped_frames;
+          camera_capture->release(frame_handle);
+          continue;
+        }
+        
+        const auto time_detection = bench_clock_t::now();
+        detect_fingers(captured_frames, circles_top, circles_front);
+        
+        const auto time_fusion = bench_clock_t::now();
+        estimate_real_positions(circles_top, circles_front, real_positions);
+        
+        const auto time_keyboard = bench_clock_t::now();
+        virtual_keyboard->reset();
+        virtual_keyboard->add_tests(real_positions);
+        const auto pressing_keys = virtual_keyboard->pressing_keys();
+        
+        // UDP送出の代わりにフレーム番号と共に記録する
+        diff_key_signals(pressing_keys, pressing_keys_before, [&](const key_signal_t& key_signal)
+        { key_events.push_back({ frames, key_signal.code_state.code, key_signal.code_state.state }); });
+        pressing_keys_before = pressing_keys;
+        
+        const auto time_end = bench_clock_t::now();
+        camera_capture->release(frame_handle);
+        
+        if(frames >= warmup_frames)
+        {
+          capture_latency  .record(elapsed(time_capture  , time_detection));
+          detection_latency.record(elapsed(time_detection, time_fusion   ));
+          fusion_latency   .record(elapsed(time_fusion   , time_keyboard ));
+          keyboard_latency .record(elapsed(time_keyboard , time_end      ));
+          frame_latency    .record(elapsed(time_capture  , time_end      ));
+          pair_skew        .record(frame_handle.skew());
+          
+          for(size_t n = 0; n < detectors.size(); ++n)
+          {
+            // 段毎の時間の累計は定期報告で 0 に戻るので、直前のフレームの分を直接使う
+            const auto& timings = detectors[n]->last_frame_stage_timings();
+            for(size_t stage = 0; stage < finger_detector_t::stages; ++stage)
+              if(timings[stage].calls)
+                detector_latencies[n][stage].record(timings[stage].total);
+          }
+        }
+        
+        ++frames;
+      }
+      
+      is_running_ = false;
+      
+      const auto measured_frames  = frames > warmup_frames ? frames - warmup_frames : 0;
+      const auto measured_seconds = std::chrono::duration<double>(bench_clock_t::now() - measure_start).count();
+      
+      // キーシグナル列の要約（FNV-1a; 処理の変更で検出結果が変わったかを1値で比べる）
+      uint64_t digest = 14695981039346656037ull;
+      const auto digest_add = [&](const uint64_t v){ digest = (digest ^ v) * 1099511628211ull; };
+      for(const auto& e : key_events)
+      {
+        digest_add(e.frame);
+        digest_add(e.code);
+        digest_add(e.state);
+      }
+      
+      std::cout
+        << "{\"benchmark\":\"replay\""
+        << ",\"frames\":"         << frames
+        << ",\"warmup_frames\":"  << std::min(frames, warmup_frames)
+        << ",\"skipped_frames\":" << skipped_frames
+        << ",\"seconds\":"        << measured_seconds
+        << ",\"fps\":"            << (measured_seconds > 0 ? measured_frames / measured_seconds : 0.)
+        << ",\"key_events\":"     << key_events.size()
+        << ",\"key_event_digest\":\"" << std::hex << std::setw(16) << std::setfill('0') << digest << std::dec << std::setfill(' ') << "\""
+        // 撮影のフレームバッファの確保回数（measured は warmup 後の分で、定常状態では 0）
+        << ",\"allocations\":"          << camera_capture->allocation_count()
+        << ",\"measured_allocations\":" << (frames > warmup_frames ? camera_capture->allocation_count() - warmup_allocations : 0)
+        // 撮影時刻のずれが sync_tolerance_ms に収まる組を得られなかった回数
+        << ",\"unmatched_pairs\":"      << camera_capture->unmatched_pair_count()
+        << "}" << std::endl;
+      
+      report_latency("capture"         , capture_latency);
+      report_latency("detection"       , detection_latency);
+      report_latency("fusion"          , fusion_latency);
+      report_latency("virtual_keyboard", keyboard_latency);
+      report_latency("frame"           , frame_latency);
+      report_latency("pair_skew"       , pair_skew);
+      
+      for(size_t n = 0; n < detectors.size(); ++n)
+        for(size_t stage = 0; stage < finger_detector_t::stages; ++stage)
+          if(detector_latencies[n][stage].count())
+            report_latency(std::string(n ? "front/" : "top/") + finger_detector_t::stage_name(finger_detector_t::stage_t(stage)), detector_latencies[n][stage]);
+      
+      for(const auto& e : key_events)
+        std::cout
+          << "{\"benchmark\":\"replay/key_event\""
+          << ",\"frame\":" << e.frame
+          << ",\"code\":"  << e.code
+          << ",\"state\":\"" << (e.state == uint8_t(WonderRabbitProject::key::writer_t::state_t::up) ? "up" : "down") << "\""
+          << "}" << std::endl;
+    }
+    
     void etupirka_t::initialize()
     {
       DLOG(INFO) << "initialize";
@@ -503,6 +905,8 @@ namespace arisin
           finger_detector_top.reset(new finger_detector_t(conf_, true));
           DLOG(INFO) << "to initialize finger_detector_front";
           finger_detector_front.reset(new finger_detector_t(conf_, false));
+          DLOG(INFO) << "to initialize worker_pool";
+          worker_pool.reset(new worker_pool_t(conf_));
           DLOG(INFO) << "to initialize space_converter";
           space_converter.reset(new space_converter_t(conf_));
           DLOG(INFO) << "to initialize virtual_keyboard";
@@ -524,6 +928,8 @@ namespace arisin
           finger_detector_top.reset(nullptr);
           DLOG(INFO) << "to nullptr finger_detector_front";
           finger_detector_front.reset(nullptr);
+          DLOG(INFO) << "to nullptr worker_pool";
+          worker_pool.reset(nullptr);
           DLOG(INFO) << "to nullptr space_converter";
           space_converter.reset(nullptr);
           DLOG(INFO) << "to nullptr virtual_keyboard";
@@ -545,6 +951,8 @@ namespace arisin
           finger_detector_top.reset(nullptr);
           DLOG(INFO) << "to nullptr finger_detector_front";
           finger_detector_front.reset(nullptr);
+          DLOG(INFO) << "to nullptr worker_pool";
+          worker_pool.reset(nullptr);
           DLOG(INFO) << "to nullptr space_converter";
           space_converter.reset(nullptr);
           DLOG(INFO) << "to nullptr virtual_keyboard";
@@ -568,6 +976,8 @@ namespace arisin
           finger_detector_top.reset(new finger_detector_t(conf_, true));
           DLOG(INFO) << "to initialize finger_detector_front";
           finger_detector_front.reset(new finger_detector_t(conf_, false));
+          DLOG(INFO) << "to initialize worker_pool";
+          worker_pool.reset(new worker_pool_t(conf_));
           DLOG(INFO) << "to initialize space_converter";
           space_converter.reset(new space_converter_t(conf_));
           DLOG(INFO) << "to initialize virtual_keyboard";
@@ -587,6 +997,8 @@ namespace arisin
           finger_detector_top.reset(nullptr);
           DLOG(INFO) << "to nullptr finger_detector_front";
           finger_detector_front.reset(nullptr);
+          DLOG(INFO) << "to nullptr worker_pool";
+          worker_pool.reset(nullptr);
           DLOG(INFO) << "to nullptr space_converter";
           space_converter.reset(nullptr);
           DLOG(INFO) << "to nullptr virtual_keyboard";
@@ -608,6 +1020,8 @@ namespace arisin
           finger_detector_top.reset(nullptr);
           DLOG(INFO) << "to nullptr finger_detector_front";
           finger_detector_front.reset(nullptr);
+          DLOG(INFO) << "to nullptr worker_pool";
+          worker_pool.reset(nullptr);
           DLOG(INFO) << "to nullptr space_converter";
           space_converter.reset(nullptr);
           DLOG(INFO) << "to nullptr virtual_keyboard";
@@ -622,6 +1036,32 @@ namespace arisin
           gui.reset(nullptr);
           break;
           
+        case mode_t::bench:
+          if(conf_.replay_file.empty() && (conf_.video_file_top.empty() || conf_.video_file_front.empty()))
+            LOG(FATAL) << "bench mode requires --video-file-top and --video-file-front, or --replay-file";
+          DLOG(INFO) << "to initialize camera_capture";
+          camera_capture.reset(new camera_capture_t(conf_));
+          camera_capture->set_video_loop(false);
+          DLOG(INFO) << "to initialize finger_detector_top";
+          finger_detector_top.reset(new finger_detector_t(conf_, true));
+          DLOG(INFO) << "to initialize finger_detector_front";
+          finger_detector_front.reset(new finger_detector_t(conf_, false));
+          DLOG(INFO) << "to initialize worker_pool";
+          worker_pool.reset(new worker_pool_t(conf_));
+          DLOG(INFO) << "to initialize space_converter";
+          space_converter.reset(new space_converter_t(conf_));
+          DLOG(INFO) << "to initialize virtual_keyboard";
+          virtual_keyboard.reset(new virtual_keyboard_t(conf_));
+          DLOG(INFO) << "to nullptr udp_sender";
+          udp_sender.reset(nullptr);
+          DLOG(INFO) << "to nullptr udp_reciever";
+          udp_reciever.reset(nullptr);
+          DLOG(INFO) << "to nullptr key_invoker";
+          key_invoker.reset(nullptr);
+          DLOG(INFO) << "to nullptr gui";
+          gui.reset(nullptr);
+          break;
+          
         default:
           DLOG(INFO) << "to nullptr camera_capture";
           camera_capture.reset(nullptr);
@@ -629,6 +1069,8 @@ namespace arisin
           finger_detector_top.reset(nullptr);
           DLOG(INFO) << "to nullptr finger_detector_front";
           finger_detector_front.reset(nullptr);
+          DLOG(INFO) << "to nullptr worker_pool";
+          worker_pool.reset(nullptr);
           DLOG(INFO) << "to nullptr space_converter";
           space_converter.reset(nullptr);
           DLOG(INFO) << "to nullptr virtual_keyboard";
@@ -648,6 +1090,7 @@ namespace arisin
       DLOG(INFO) << "camera-capture address       : " << camera_capture.get();
       DLOG(INFO) << "finger-detector-top address  : " << finger_detector_top.get();
       DLOG(INFO) << "finger-detector-front address: " << finger_detector_front.get();
+      DLOG(INFO) << "worker-pool address          : " << worker_pool.get();
       DLOG(INFO) << "space-converter address      : " << space_converter.get();
       DLOG(INFO) << "virtual-keyboard address     : " << virtual_keyboard.get();
       DLOG(INFO) << "udp-sender address           : " << udp_sender.get();
@@ -1,5 +1,6 @@
 #pragma once
 
+#include <atomic>
 #include <random>
 #include <thread>
 #include <chrono>
@@ -22,6 +23,9 @@
 #include "udp-reciever.hxx"
 #include "key-invoker.hxx"
 #include "gui.hxx"
+#include "worker-pool.hxx"
+#include "bounded-queue.hxx"
+#include "latency-histogram.hxx"
 #include "logger.hxx"
 
 // created by arisin: https://github.com/arisin
@@ -41,21 +45,60 @@ namespace arisin
       { return std::to_string(version_major) + "." + std::to_string(version_minor) + "." + std::to_string(version_revision); }
       
     private:
+      // パイプライン実行時に段間を受け渡す1フレーム分の作業状態
+      struct pipeline_frame_t
+      {
+        camera_capture_t::frame_handle_t frame_handle;
+        finger_detector_t::circles_t circles_top;
+        finger_detector_t::circles_t circles_front;
+        cv::Mat effected_top;
+        cv::Mat effected_front;
+        virtual_keyboard_t::pressing_keys_t pressing_keys;
+      };
+      
       void initialize(const mode_t);
       void run_main();
+      void run_main_pipelined();
       void run_reciever();
       void run_main_m1();
       void run_reciever_p1();
       void run_dummy_main();
       void run_dummy_reciever();
+      void run_bench();
+      
+      void detect_fingers(const camera_capture_t::captured_frames_t& captured_frames, finger_detector_t::circles_t& circles_top, finger_detector_t::circles_t& circles_front);
+      void estimate_real_positions(const finger_detector_t::circles_t& circles_top, const finger_detector_t::circles_t& circles_front, std::vector<virtual_keyboard_t::point_t>& real_positions);
+      void send_key_signals(const virtual_keyboard_t::pressing_keys_t& pressing_keys, const virtual_keyboard_t::pressing_keys_t& pressing_keys_before, const camera_capture_t::steady_clock_t::time_point capture_time);
+      // 前回からのキー押下状態の変化をキーシグナルとして emit に渡す
+      void diff_key_signals(const virtual_keyboard_t::pressing_keys_t& pressing_keys, const virtual_keyboard_t::pressing_keys_t& pressing_keys_before, const std::function<void(const key_signal_t&)>& emit);
       
       configuration_t conf_;
-      bool is_running_ = false;
+      std::atomic<bool> is_running_ { false };
       std::chrono::nanoseconds main_loop_wait_;
       
+      // 常駐ワーカーで回す検出タスクとその入出力（detect_fingers がフレーム毎に差し替える）
+      struct detection_t
+      {
+        const cv::Mat* frame;
+        finger_detector_t::circles_t* circles;
+      };
+      detection_t detection_top_;
+      detection_t detection_front_;
+      worker_pool_t::task_t detection_top_task_;
+      worker_pool_t::task_t detection_front_task_;
+      
+      // estimate_real_positions が1フレーム分の組をまとめて変換するための作業領域
+      space_converter_t::targets_t fusion_top_targets_;
+      space_converter_t::targets_t fusion_front_targets_;
+      space_converter_t::points_t  fusion_points_;
+      
+      // send_key_signals が1フレーム分のキーシグナルを溜める作業領域
+      std::vector<key_signal_t> key_signals_;
+      
       std::unique_ptr<camera_capture_t>   camera_capture;
       std::unique_ptr<finger_detector_t>  finger_detector_top;
       std::unique_ptr<finger_detector_t>  finger_detector_front;
+      std::unique_ptr<worker_pool_t>      worker_pool;
       std::unique_ptr<space_converter_t>  space_converter;
       std::unique_ptr<virtual_keyboard_t> virtual_keyboard;
       std::unique_ptr<udp_sender_t>       udp_sender;
@@ -4,6 +4,7 @@
 #include <memory>
 #include <limits>
 #include <cassert>
+#include <cmath>
 
 #include "image_processor.hxx"
 
@@ -11,9 +12,27 @@ namespace arisin
 {
   namespace etupirka
   {
+    namespace
+    {
+      // 段の出力を置く作業領域（最後の段は作業領域ではなく効果画像へ書く）
+      constexpr frame_arena_t::slot_t stage_slots[] =
+      { frame_arena_t::slot_bilateral
+      , frame_arena_t::slot_morphology
+      , frame_arena_t::slot_hsv
+      , frame_arena_t::slot_nail_morphology
+      };
+    }
+    
     finger_detector_t::finger_detector_t(const configuration_t& conf, bool is_top)
+      : timing_frames_(0)
+      , roi_tracking_(false)
+      , frames_since_full_scan_(0)
+      , pyramid_scale_(1)
     {
+      stage_timings_.fill({ std::chrono::nanoseconds::zero(), 0 });
+      last_frame_stage_timings_.fill({ std::chrono::nanoseconds::zero(), 0 });
       DLOG(INFO) << "ctor";
+      DLOG(INFO) << "image_processor kernels: " << simd_name();
       set(conf, is_top);
     }
     
@@ -32,9 +51,15 @@ namespace arisin
       set_pre_bilateral(c.pre_bilateral_d, c.pre_bilateral_sc, c.pre_bilateral_ss);
       set_pre_morphology(c.pre_morphology_n);
       set_hsv(c.hsv_h_min, c.hsv_h_max, c.hsv_s_min, c.hsv_s_max, c.hsv_v_min, c.hsv_v_max);
+      set_hsv_lookup_table(c.hsv_lookup_table);
       set_nail_morphology(c.nail_morphology_n);
       set_nail_median_blur(c.nail_median_blur_ksize);
       set_circles(c.circles_dp, c.circles_min_dist, c.circles_param_1, c.circles_param_2, c.circles_min_radius, c.circles_max_radius);
+      set_roi_tracking(c.roi_tracking, c.roi_margin, c.roi_full_scan_interval);
+      set_pyramid(c.pyramid_scale);
+      set_allocation_counting(c.count_allocations);
+      set_stages(c.pre_bilateral_enabled, c.pre_morphology_enabled, c.hsv_enabled, c.nail_morphology_enabled, c.nail_median_blur_enabled, c.circles_enabled);
+      set_stage_timing_report(c.stage_timing_report_interval);
     }
     
     void finger_detector_t::set_pre_bilateral(double d, double sc, double ss)
@@ -53,15 +78,16 @@ namespace arisin
     
     void finger_detector_t::set_hsv(float hsv_h_min, float hsv_h_max, float hsv_s_min, float hsv_s_max, float hsv_v_min, float hsv_v_max)
     {
-      hsv_h_min_ = hsv_h_min;
-      hsv_h_max_ = hsv_h_max;
-      hsv_s_min_ = hsv_s_min;
-      hsv_s_max_ = hsv_s_max;
-      hsv_v_min_ = hsv_v_min;
-      hsv_v_max_ = hsv_v_max;
+      hsv_filter_.set(hsv_h_min, hsv_h_max, hsv_s_min, hsv_s_max, hsv_v_min, hsv_v_max);
       DLOG(INFO) << "set_hsv h-min, h-max, s-min, s-max, v-min, v-max: " << hsv_h_min << ", " << hsv_h_max << ", " << hsv_s_min << ", " << hsv_s_max << ", " << hsv_v_min << ", " << hsv_v_max << ", ";
     }
     
+    void finger_detector_t::set_hsv_lookup_table(bool enabled)
+    {
+      hsv_filter_.set_lookup_table(enabled);
+      DLOG(INFO) << "set_hsv_lookup_table enabled: " << enabled;
+    }
+    
     void finger_detector_t::set_nail_morphology(int n)
     {
       nail_morphology_n_ = n;
@@ -103,78 +129,353 @@ namespace arisin
       DLOG(INFO) << "set_circles dp, min_dist, param_1, param_2, min_radius, max_radius: " << dp << ", " << min_dist << ", " << param_1 << ", " << param_2 << ", " << min_radius << ", " << max_radius;
     }
     
+    void finger_detector_t::set_roi_tracking(bool enabled, int margin, int full_scan_interval)
+    {
+      if(margin < 0)
+      {
+        LOG(WARNING) << "margin(" << margin << ") cannot set less than 0, fix to 0";
+        margin = 0;
+      }
+      
+      if(enabled != roi_tracking_)
+        previous_circles_.clear();
+      
+      roi_tracking_ = enabled;
+      roi_margin_ = margin;
+      roi_full_scan_interval_ = full_scan_interval;
+      DLOG(INFO) << "set_roi_tracking enabled, margin, full_scan_interval: " << enabled << ", " << margin << ", " << full_scan_interval;
+    }
+    
+    void finger_detector_t::set_pyramid(double scale)
+    {
+      if(!(scale > 0 && scale <= 1))
+      {
+        LOG(WARNING) << "pyramid scale(" << scale << ") must be in (0, 1], fix to 1";
+        scale = 1;
+      }
+      
+      pyramid_scale_ = scale;
+      DLOG(INFO) << "set_pyramid scale: " << scale;
+    }
+    
+    void finger_detector_t::set_allocation_counting(bool enabled)
+    {
+      arena_.set_allocation_counting(enabled);
+      DLOG(INFO) << "set_allocation_counting enabled: " << enabled;
+    }
+    
+    void finger_detector_t::set_stages(bool bilateral, bool pre_morphology, bool hsv, bool nail_morphology, bool median_blur, bool circles)
+    {
+      stage_enabled_ = {{ bilateral, pre_morphology, hsv, nail_morphology, median_blur, circles }};
+      DLOG(INFO) << "set_stages bilateral, pre_morphology, hsv, nail_morphology, median_blur, circles: " << bilateral << ", " << pre_morphology << ", " << hsv << ", " << nail_morphology << ", " << median_blur << ", " << circles;
+    }
+    
+    void finger_detector_t::set_stage_timing_report(int interval)
+    {
+      if(interval < 0)
+      {
+        LOG(WARNING) << "interval(" << interval << ") cannot set less than 0, fix to 0";
+        interval = 0;
+      }
+      
+      stage_timing_report_interval_ = interval;
+      DLOG(INFO) << "set_stage_timing_report interval: " << interval;
+    }
+    
+    const frame_arena_t& finger_detector_t::arena() const
+    { return arena_; }
+    
     const cv::Mat& finger_detector_t::effected_frame() const
     { return pre_nail_frame; }
     
-    finger_detector_t::circles_t finger_detector_t::operator()(const cv::Mat& frame)
+    const char* finger_detector_t::stage_name(const stage_t stage)
     {
-      cv::Mat bilateral_frame;
-      //bilateral_frame = frame;
-      //cv::bilateralFilter(frame, bilateral_frame, pre_bilateral_d_, pre_bilateral_sc_, pre_bilateral_ss_);
-      ::bilateralFilter_8u(frame, bilateral_frame, pre_bilateral_d_, pre_bilateral_sc_, pre_bilateral_ss_);
-      
-      cv::Mat morphology_frame;
-      //morphology_frame = bilateral_frame;
-      cv::morphologyEx(frame, morphology_frame, cv::MORPH_OPEN, cv::Mat(), cv::Point(-1, -1), pre_morphology_n_);
-      
-      //cv::Mat hsv_filtered_single_channel_frame(frame.rows, frame.cols, CV_8UC1);
-      //*
-      const auto hsv_filtered_single_channel_frame = filter_hsv_from_BGR24_to_single_channel
-      ( morphology_frame
-      , hsv_h_min_, hsv_h_max_
-      , hsv_s_min_, hsv_s_max_
-      , hsv_v_min_, hsv_v_max_
+      switch(stage)
+      {
+        case stage_bilateral:       return "bilateral";
+        case stage_pre_morphology:  return "pre-morphology";
+        case stage_hsv:             return "hsv";
+        case stage_nail_morphology: return "nail-morphology";
+        case stage_median_blur:     return "median-blur";
+        case stage_circles:         return "circles";
+        default:                    return "unknown";
+      }
+    }
+    
+    const std::array<finger_detector_t::stage_timing_t, finger_detector_t::stages>& finger_detector_t::stage_timings() const
+    { return stage_timings_; }
+    
+    const std::array<finger_detector_t::stage_timing_t, finger_detector_t::stages>& finger_detector_t::last_frame_stage_timings() const
+    { return last_frame_stage_timings_; }
+    
+    void finger_detector_t::detect(const cv::Mat& frame, cv::Mat& nail_frame, circles_t& circles, const double scale)
+    {
+      // 縮小した段では長さの設定値も同じ比率で縮める（0 は HoughCircles で「指定無し」なのでそのまま）
+      const auto scaled = [scale](const int length){ return int(std::lround(length * scale)); };
+      const auto median_blur_ksize = scale < 1 ? std::max(1, scaled(nail_median_blur_ksize_)) | 1 : nail_median_blur_ksize_;
+      const auto min_dist = scale < 1 ? std::max(1., circles_min_dist_ * scale) : circles_min_dist_;
+      const auto min_radius = scale < 1 ? scaled(circles_min_radius_) : circles_min_radius_;
+      const auto max_radius = scale < 1 && circles_max_radius_ > 0 ? std::max(1, scaled(circles_max_radius_)) : circles_max_radius_;
+      
+      const auto size = frame.size();
+      auto& scratch = arena_.filter_scratch();
+      
+      // 画像を出す最後の段は nail_frame へ直接書く（HSV 段は無効でも単チャンネル化のため必ず通る）
+      auto last_image_stage = stage_hsv;
+      for(const auto stage : { stage_median_blur, stage_nail_morphology })
+        if(stage_enabled_[stage])
+        {
+          last_image_stage = stage;
+          break;
+        }
+      
+      // 有効な段だけを順に通し、各段は直前の有効な段の出力を読む。無効な段は何もしない。
+      //   段の出力は作業領域の view（独立したヘッダー）なので、次の段の境界処理が view の外の古い画素を読むことは無い。
+      cv::Mat current = frame;
+      for(size_t n = 0; n <= size_t(last_image_stage); ++n)
+      {
+        const auto stage = stage_t(n);
+        if(!stage_enabled_[stage] && stage != stage_hsv)
+          continue;
+        
+        const auto start = stage_clock_t::now();
+        
+        cv::Mat stage_frame;
+        auto& out = stage == last_image_stage
+          ? nail_frame
+          : (stage_frame = arena_.view(stage_slots[stage], size, stage < stage_hsv ? CV_8UC3 : CV_8UC1));
+        
+        switch(stage)
+        {
+          case stage_bilateral:
+            //cv::bilateralFilter(current, out, pre_bilateral_d_, pre_bilateral_sc_, pre_bilateral_ss_);
+            ::bilateralFilter_8u(current, out, pre_bilateral_d_, pre_bilateral_sc_, pre_bilateral_ss_, scratch);
+            break;
+            
+          case stage_pre_morphology:
+            cv::morphologyEx(current, out, cv::MORPH_OPEN, cv::Mat(), cv::Point(-1, -1), pre_morphology_n_);
+            break;
+            
+          // hsv-filter: BGR24 -> single-channel
+          case stage_hsv:
+            if(stage_enabled_[stage])
+              hsv_filter_(current, out);
+            else
+              cv::cvtColor(current, out, CV_BGR2GRAY);
+            break;
+            
+          // morphology: single-channel
+          case stage_nail_morphology:
+            cv::morphologyEx(current, out, cv::MORPH_OPEN, cv::Mat(), cv::Point(-1, -1), nail_morphology_n_);
+            break;
+            
+          // median-blur: single-channel
+          case stage_median_blur:
+            //cv::medianBlur(current, out, median_blur_ksize);
+            ::medianBlur(current, out, median_blur_ksize, scratch);
+            break;
+            
+          default:
+            break;
+        }
+        
+        current = out;
+        add_stage_timing(stage, stage_clock_t::now() - start);
+      }
+      
+      // circles detector
+      if(!stage_enabled_[stage_circles])
+      {
+        circles.clear();
+        return;
+      }
+      
+      const auto start = stage_clock_t::now();
+      cv::HoughCircles
+      ( nail_frame, circles, CV_HOUGH_GRADIENT
+      , circles_dp_, min_dist
+      , circles_param_1_, circles_param_2_
+      , min_radius, max_radius
       );
-      //*/
+      add_stage_timing(stage_circles, stage_clock_t::now() - start);
+    }
+    
+    void finger_detector_t::add_stage_timing(const stage_t stage, const stage_clock_t::duration elapsed)
+    {
+      const auto ns = std::chrono::duration_cast<std::chrono::nanoseconds>(elapsed);
+      stage_timings_[stage].total += ns;
+      ++stage_timings_[stage].calls;
+      last_frame_stage_timings_[stage].total += ns;
+      ++last_frame_stage_timings_[stage].calls;
+    }
+    
+    void finger_detector_t::report_stage_timings()
+    {
+      for(size_t n = 0; n < stages; ++n)
+      {
+        const auto& t = stage_timings_[n];
+        LOG(INFO)
+          << "stage(" << stage_name(stage_t(n)) << ") "
+          << (stage_enabled_[n] ? "enabled " : "disabled")
+          << " calls: " << t.calls
+          << " total: " << std::chrono::duration_cast<std::chrono::microseconds>(t.total).count() << "[us]"
+          << " per-frame: " << (t.total.count() / 1000. / timing_frames_) << "[us]"
+          ;
+      }
+      
+      stage_timings_.fill({ std::chrono::nanoseconds::zero(), 0 });
+      timing_frames_ = 0;
+    }
+    
+    void finger_detector_t::filter_circles(circles_t& circles)
+    {
+      if(circles.empty())
+        return;
+      
+      boost::sort(circles, [](const cv::Vec3f& a, const cv::Vec3f& b){ return a[0] < b[0]; });
+      const auto e = std::end(circles);
+      auto t = std::begin(circles);
+      for(auto i = std::begin(circles) + 1; i < e; ++i)
+      {
+        // i.x - i.r が t.x + t.r 以下にあるかチェック
+        //   true : それは既存 t と比べて y 値が大きければ（より下にあれば） t と置換える
+        //   false: それは次の t になる
+        const auto i_left = (*i)[0] - (*i)[2];
+        const auto t_right = (*t)[0] + (*t)[2];
+        if( i_left <= t_right )
+        {
+          if( (*i)[1] > (*t)[1] )
+            *t = *i;
+        }
+        else
+          *++t = *i;
+      }
+      circles.resize(std::distance(std::begin(circles), t + 1));
+    }
+    
+    void finger_detector_t::make_rois(const circles_t& seeds, const cv::Size& frame_size)
+    {
+      const cv::Rect frame_rect(0, 0, frame_size.width, frame_size.height);
+      
+      // 種の円（前フレームの円、または縮小段の候補）を、検出し得る最大の半径と余白の分だけ広げた矩形で囲む
+      rois_.clear();
+      for(const auto& c : seeds)
+      {
+        const auto half = int(std::ceil(std::max(c[2], float(circles_max_radius_)))) + roi_margin_;
+        const auto roi = cv::Rect(int(c[0]) - half, int(c[1]) - half, half * 2 + 1, half * 2 + 1) & frame_rect;
+        if(roi.area() > 0)
+          rois_.push_back(roi);
+      }
+      
+      // 重なる矩形は外接矩形にまとめる（同じ画素を二度処理せず、境界で円が切れないように）
+      for(bool merged = true; merged; )
+      {
+        merged = false;
+        for(size_t i = 0; i < rois_.size() && !merged; ++i)
+          for(size_t j = i + 1; j < rois_.size() && !merged; ++j)
+            if((rois_[i] & rois_[j]).area() > 0)
+            {
+              rois_[i] = rois_[i] | rois_[j];
+              rois_.erase(rois_.begin() + j);
+              merged = true;
+            }
+      }
+    }
+    
+    void finger_detector_t::detect_in_rois(const cv::Mat& frame, const circles_t& seeds, circles_t& circles)
+    {
+      make_rois(seeds, frame.size());
+      
+      pre_nail_frame.create(frame.rows, frame.cols, CV_8UC1);
+      pre_nail_frame.setTo(cv::Scalar(0));
       
-      // morphology: single-channel
-      cv::Mat single_channel_morphology_frame;
-      //single_channel_morphology_frame = hsv_filtered_single_channel_frame;
-      cv::morphologyEx(hsv_filtered_single_channel_frame, single_channel_morphology_frame, cv::MORPH_OPEN, cv::Mat(), cv::Point(-1, -1), nail_morphology_n_);
+      circles.clear();
+      
+      for(const auto& roi : rois_)
+      {
+        // 効果画像の該当部分へ直接書く
+        cv::Mat effected_roi = pre_nail_frame(roi);
+        detect(frame(roi), effected_roi, roi_circles_);
         
-      // median-blur: single-channel
-      //pre_nail_frame = single_channel_morphology_frame;
-      //cv::medianBlur(single_channel_morphology_frame, pre_nail_frame, nail_median_blur_ksize_);
-      ::medianBlur(single_channel_morphology_frame, pre_nail_frame, nail_median_blur_ksize_);
-
+        for(auto c : roi_circles_)
+        {
+          c[0] += roi.x;
+          c[1] += roi.y;
+          circles.push_back(c);
+        }
+      }
+    }
+    
+    finger_detector_t::circles_t finger_detector_t::operator()(const cv::Mat& frame)
+    {
       circles_t circles;
-      //*
-      {
-        // circles detector
-        cv::HoughCircles
-        ( pre_nail_frame, circles, CV_HOUGH_GRADIENT
-        , circles_dp_, circles_min_dist_
-        , circles_param_1_, circles_param_2_
-        , circles_min_radius_, circles_max_radius_
-        );
+      (*this)(frame, circles);
+      return circles;
+    }
+    
+    void finger_detector_t::operator()(const cv::Mat& frame, circles_t& circles)
+    {
+      arena_.begin_frame();
+      last_frame_stage_timings_.fill({ std::chrono::nanoseconds::zero(), 0 });
+      
+      // ROI追跡: 指先は小さくゆっくり動くので、前フレームの円の周辺だけを処理する
+      //   追跡を止めている・前フレームで見つかっていない・全面走査の周期に達した場合は全面を処理する
+      const bool full_scan = !roi_tracking_ || previous_circles_.empty() || frames_since_full_scan_ >= roi_full_scan_interval_;
+      
+      if(!full_scan)
+      {
+        detect_in_rois(frame, previous_circles_, circles);
+        DLOG(INFO) << "roi tracking; rois: " << rois_.size();
+        
+        ++frames_since_full_scan_;
         
-        // circle filter
-        boost::sort(circles, [](const cv::Vec3f& a, const cv::Vec3f& b){ return a[0] < b[0]; });
-        const auto e = std::end(circles);
-        auto t = std::begin(circles);
-        for(auto i = std::begin(circles) + 1; i < e; ++i)
+        if(circles.empty())
+          DLOG(INFO) << "roi tracking lost circles, fallback to full scan";
+      }
+      
+      if(full_scan || circles.empty())
+      {
+        if(pyramid_scale_ < 1)
         {
-          // i.x - i.r が t.x + t.r 以下にあるかチェック
-          //   true : それは既存 t と比べて y 値が大きければ（より下にあれば） t と置換える
-          //   false: それは次の t になる
-          const auto i_left = (*i)[0] - (*i)[2];
-          const auto t_right = (*t)[0] + (*t)[2];
-          if( i_left <= t_right )
+          // 縮小した段で候補を探し、候補の周辺だけを原寸で精査する
+          // dsize の丸めは cv::resize が fx, fy から求める場合と同じ
+          const cv::Size coarse_size(cv::saturate_cast<int>(frame.cols * pyramid_scale_), cv::saturate_cast<int>(frame.rows * pyramid_scale_));
+          auto coarse_frame = arena_.view(frame_arena_t::slot_coarse_frame, coarse_size, CV_8UC3);
+          auto coarse_nail_frame = arena_.view(frame_arena_t::slot_coarse_nail, coarse_size, CV_8UC1);
+          cv::resize(frame, coarse_frame, coarse_size, 0, 0, cv::INTER_AREA);
+          detect(coarse_frame, coarse_nail_frame, coarse_circles_, pyramid_scale_);
+          DLOG(INFO) << "pyramid coarse candidates: " << coarse_circles_.size();
+          
+          for(auto& c : coarse_circles_)
           {
-            if( (*i)[1] > (*t)[1] )
-              *t = *i;
+            c[0] /= pyramid_scale_;
+            c[1] /= pyramid_scale_;
+            c[2] /= pyramid_scale_;
           }
-          else
-            *++t = *i;
+          
+          detect_in_rois(frame, coarse_circles_, circles);
         }
-        circles.resize(std::distance(std::begin(circles), t + 1));
+        else
+          detect(frame, pre_nail_frame, circles);
+        
+        frames_since_full_scan_ = 0;
       }
-      //*/
+      
+      // circle filter
+      filter_circles(circles);
+      
+      previous_circles_ = circles;
+      
+      arena_.end_frame();
+      
+      ++timing_frames_;
+      if(stage_timing_report_interval_ > 0 && timing_frames_ >= size_t(stage_timing_report_interval_))
+        report_stage_timings();
+      
 #ifndef NDEBUG
       for(const auto& circle: circles)
         DLOG(INFO) << "circle x, y, r: " << circle[0] << ", " << circle[1] << ", " << circle[2];
 #endif
-      return circles;
     }
   }
 }
\ No newline at end of file
@@ -28,6 +28,8 @@
 //#include "cv_video_helper.hxx"
 
 #include "configuration.hxx"
+#include "frame-arena.hxx"
+#include "hsv-filter.hxx"
 #include "logger.hxx"
 
 namespace arisin
@@ -42,7 +44,10 @@ namespace arisin
       
       int pre_morphology_n_;
       
-      float hsv_h_min_, hsv_h_max_, hsv_s_min_, hsv_s_max_, hsv_v_min_, hsv_v_max_;
+      hsv_filter_t hsv_filter_;
+      
+      // 中間画像とフィルターの作業領域（最初のフレームで確保し、以後は使い回す）
+      frame_arena_t arena_;
       
       int nail_morphology_n_;
       int nail_median_blur_ksize_;
@@ -58,6 +63,52 @@ namespace arisin
       
     public:
       using circles_t = std::vector<cv::Vec3f>;
+      using stage_clock_t = std::chrono::steady_clock;
+      
+      // 検出の段（この順に処理する）
+      enum stage_t : uint8_t
+      { stage_bilateral
+      , stage_pre_morphology
+      , stage_hsv
+      , stage_nail_morphology
+      , stage_median_blur
+      , stage_circles
+      , stages
+      };
+      
+      struct stage_timing_t
+      {
+        std::chrono::nanoseconds total;
+        size_t calls;
+      };
+      
+    private:
+      std::array<bool, stages> stage_enabled_;
+      std::array<stage_timing_t, stages> stage_timings_;
+      std::array<stage_timing_t, stages> last_frame_stage_timings_;
+      int stage_timing_report_interval_;
+      size_t timing_frames_;
+      
+      void add_stage_timing(const stage_t stage, const stage_clock_t::duration elapsed);
+      void report_stage_timings();
+      
+      bool roi_tracking_;
+      int roi_margin_;
+      int roi_full_scan_interval_;
+      int frames_since_full_scan_;
+      circles_t previous_circles_;
+      std::vector<cv::Rect> rois_;
+      circles_t roi_circles_;
+      
+      double pyramid_scale_;
+      circles_t coarse_circles_;
+      
+      void detect(const cv::Mat& frame, cv::Mat& nail_frame, circles_t& circles, const double scale = 1);
+      void detect_in_rois(const cv::Mat& frame, const circles_t& seeds, circles_t& circles);
+      void make_rois(const circles_t& seeds, const cv::Size& frame_size);
+      static void filter_circles(circles_t& circles);
+      
+    public:
       
       finger_detector_t(const configuration_t& conf, bool is_top);
       
@@ -67,13 +118,30 @@ namespace arisin
       void set_pre_bilateral(double d, double sc, double ss);
       void set_pre_morphology(int n);
       void set_hsv(float hsv_h_min, float hsv_h_max, float hsv_s_min, float hsv_s_max, float hsv_v_min, float hsv_v_max);
+      void set_hsv_lookup_table(bool enabled);
       void set_nail_morphology(int n);
       void set_nail_median_blur(int ksize);
       void set_circles(double dp, double min_dist, double param_1, double param_2, int min_radius, int max_radius);
+      void set_roi_tracking(bool enabled, int margin, int full_scan_interval);
+      void set_pyramid(double scale);
+      void set_allocation_counting(bool enabled);
+      void set_stages(bool bilateral, bool pre_morphology, bool hsv, bool nail_morphology, bool median_blur, bool circles);
+      void set_stage_timing_report(int interval);
       
+      static const char* stage_name(const stage_t stage);
+      
+      // 前回の報告（または生成）からの段毎の累積時間
+      const std::array<stage_timing_t, stages>& stage_timings() const;
+      // 直前の1フレーム（operator() の1回）の段毎の時間（ROI 毎に通った段はその合計、定期報告で消えない）
+      const std::array<stage_timing_t, stages>& last_frame_stage_timings() const;
+      
+      const frame_arena_t& arena() const;
       const cv::Mat& effected_frame() const;
       
       circles_t operator()(const cv::Mat& frame);
+      
+      // circles の容量を使い回す版（定常状態で circles を確保し直さない）
+      void operator()(const cv::Mat& frame, circles_t& circles);
     };
   }
 }
\ No newline at end of file
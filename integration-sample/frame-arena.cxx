@@ -0,0 +1,91 @@
+#include "frame-arena.hxx"
+
+namespace arisin
+{
+  namespace etupirka
+  {
+    constexpr size_t frame_arena_t::footprint_size;
+    
+    frame_arena_t::frame_arena_t()
+      : counting_(false)
+      , frames_(0)
+      , allocations_(0)
+      , steady_state_allocations_(0)
+    { }
+    
+    cv::Mat frame_arena_t::view(const slot_t slot, const cv::Size& size, const int type)
+    {
+      auto& mat = mats_[slot];
+      
+      if(mat.type() != type || mat.rows < size.height || mat.cols < size.width)
+        DLOG(INFO) << "slot(" << int(slot) << ") allocate " << size.width << "x" << size.height << " type(" << type << ")";
+      
+      return reserve_view(mat, size, type);
+    }
+    
+    filter_scratch_t& frame_arena_t::filter_scratch()
+    { return filter_scratch_; }
+    
+    void frame_arena_t::set_allocation_counting(const bool enabled)
+    {
+      counting_ = enabled;
+      DLOG(INFO) << "set_allocation_counting enabled: " << enabled;
+    }
+    
+    void frame_arena_t::take_footprint(footprint_t& footprint) const
+    {
+      auto i = std::begin(footprint);
+      
+      for(const auto& mat : mats_)
+        *i++ = { mat.datastart, size_t(mat.dataend - mat.datastart) };
+      
+      const auto& s = filter_scratch_;
+      *i++ = { s.bilateral_border.datastart, size_t(s.bilateral_border.dataend - s.bilateral_border.datastart) };
+      *i++ = { s.median_border.datastart   , size_t(s.median_border.dataend    - s.median_border.datastart   ) };
+      *i++ = { s.color_weight.data(), s.color_weight.capacity() };
+      *i++ = { s.space_weight.data(), s.space_weight.capacity() };
+      *i++ = { s.space_ofs.data()   , s.space_ofs.capacity()    };
+      *i++ = { s.h_coarse.data()    , s.h_coarse.capacity()     };
+      *i++ = { s.h_fine.data()      , s.h_fine.capacity()       };
+    }
+    
+    void frame_arena_t::begin_frame()
+    {
+      if(counting_)
+        take_footprint(footprint_);
+    }
+    
+    void frame_arena_t::end_frame()
+    {
+      if(!counting_)
+        return;
+      
+      footprint_t footprint;
+      take_footprint(footprint);
+      
+      size_t n = 0;
+      for(size_t i = 0; i < footprint_size; ++i)
+        if(footprint[i] != footprint_[i])
+          ++n;
+      
+      allocations_ += n;
+      
+      if(frames_ && n)
+      {
+        steady_state_allocations_ += n;
+        LOG(WARNING) << "frame(" << frames_ << ") reallocated " << n << " arena scratch buffers in steady state (OpenCV internal allocations are not counted)";
+      }
+      
+      ++frames_;
+    }
+    
+    const size_t frame_arena_t::frames() const
+    { return frames_; }
+    
+    const size_t frame_arena_t::allocations() const
+    { return allocations_; }
+    
+    const size_t frame_arena_t::steady_state_allocations() const
+    { return steady_state_allocations_; }
+  }
+}
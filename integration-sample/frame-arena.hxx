@@ -0,0 +1,96 @@
+#pragma once
+
+#include <algorithm>
+#include <array>
+#include <cstdint>
+#include <vector>
+
+#include <opencv2/core/core.hpp>
+
+#include "logger.hxx"
+
+namespace arisin
+{
+  namespace etupirka
+  {
+    // image_processor のフィルターが内部で使う作業領域
+    //   フィルターを呼ぶたびに確保していた境界付きの複製や係数表を、呼び出し側が持ち回る。
+    struct filter_scratch_t
+    {
+      cv::Mat bilateral_border;
+      cv::Mat median_border;
+      std::vector<float> color_weight;
+      std::vector<float> space_weight;
+      std::vector<int>   space_ofs;
+      std::vector<uint16_t> h_coarse;
+      std::vector<uint16_t> h_fine;
+    };
+    
+    // storage を size 以上に（足りない場合だけ）確保し、その左上 size 分を指す view を返す
+    //   cv::Mat::create は大きさが変わるだけで確保し直すため、大きさの変わる作業画像はこの view に書く。
+    //   view は storage の部分行列ではなく、同じ画素を指す独立したヘッダーにする。部分行列のままだと
+    //   morphologyEx や copyMakeBorder が locateROI で storage 全体を辿り、view の右と下の外側に残った
+    //   前のフレームの画素を境界として読んでしまう。view は storage を参照カウントしないので storage より長く持たない。
+    inline cv::Mat reserve_view(cv::Mat& storage, const cv::Size& size, const int type)
+    {
+      if(storage.type() != type || storage.rows < size.height || storage.cols < size.width)
+        storage.create(std::max(storage.rows, size.height), std::max(storage.cols, size.width), type);
+      
+      return cv::Mat(size, type, storage.data, storage.step);
+    }
+    
+    // 検出器1つ分のフレーム作業領域
+    //   中間画像は slot 毎に1枚だけ持ち、最初のフレーム（より大きな要求が来た場合はその時）に確保する。
+    //   以後は確保済みの画像の左上を指す view（reserve_view）を返すので、ROI や縮小段の小さな画像でも再確保しない。
+    //   allocation counting を有効にすると、begin_frame から end_frame の間に作業領域が
+    //   確保し直された回数を数え、定常状態（2フレーム目以降）で確保が起きた場合に警告する。
+    //   数えるのはこの作業領域だけで、OpenCV が内部で確保するもの（morphologyEx の一時画像とフィルターエンジン、
+    //   HoughCircles の累積表など）は含まない。検出のヒープ確保はそれらの分だけ定常状態でも残る。
+    class frame_arena_t final
+    {
+    public:
+      enum slot_t : uint8_t
+      { slot_bilateral
+      , slot_morphology
+      , slot_hsv
+      , slot_nail_morphology
+      , slot_coarse_frame
+      , slot_coarse_nail
+      , slots
+      };
+      
+    private:
+      std::array<cv::Mat, slots> mats_;
+      filter_scratch_t filter_scratch_;
+      
+      // 作業領域の先頭アドレスと容量の記録（変わっていれば確保し直されている）
+      static constexpr size_t footprint_size = slots + 7;
+      using footprint_t = std::array<std::pair<const void*, size_t>, footprint_size>;
+      footprint_t footprint_;
+      
+      bool counting_;
+      size_t frames_;
+      size_t allocations_;
+      size_t steady_state_allocations_;
+      
+      void take_footprint(footprint_t& footprint) const;
+      
+    public:
+      frame_arena_t();
+      
+      // slot の左上 size 分を指す type の view を返す（足りなければ確保し直す）
+      cv::Mat view(const slot_t slot, const cv::Size& size, const int type);
+      
+      filter_scratch_t& filter_scratch();
+      
+      void set_allocation_counting(const bool enabled);
+      
+      void begin_frame();
+      void end_frame();
+      
+      const size_t frames() const;
+      const size_t allocations() const;
+      const size_t steady_state_allocations() const;
+    };
+  }
+}
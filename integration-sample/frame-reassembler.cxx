@@ -0,0 +1,194 @@
+#include "frame-reassembler.hxx"
+
+#include <algorithm>
+#include <cstring>
+
+namespace arisin
+{
+  namespace etupirka
+  {
+    frame_reassembler_t::frame_reassembler_t(const size_t max_inflight_frames, const std::chrono::nanoseconds timeout)
+      : slots_(std::max(max_inflight_frames, size_t(1)))
+      , timeout_(timeout)
+      , has_session_(false)
+      , session_(0)
+      , has_delivered_(false)
+      , last_delivered_frame_id_(0)
+      , completed_count_(0)
+      , expired_count_(0)
+      , evicted_count_(0)
+      , late_count_(0)
+      , invalid_count_(0)
+    {
+      DLOG(INFO) << "max_inflight_frames: " << slots_.size();
+      DLOG(INFO) << "timeout[ns]: "         << timeout_.count();
+    }
+    
+    void frame_reassembler_t::release(slot_t& slot)
+    {
+      // data と received の容量は次の組み立てに残しておく
+      slot.used = false;
+      for(auto& part : slot.parts)
+      {
+        part.size           = 0;
+        part.chunk_count    = 0;
+        part.received_count = 0;
+      }
+    }
+    
+    void frame_reassembler_t::expire(const steady_clock_t::time_point now)
+    {
+      for(auto& slot : slots_)
+        if(slot.used && now - slot.first_arrival > timeout_)
+        {
+          DLOG(INFO) << "frame(" << slot.frame_id << ") expired";
+          release(slot);
+          ++expired_count_;
+        }
+    }
+    
+    frame_reassembler_t::slot_t* frame_reassembler_t::acquire(const uint32_t frame_id, const steady_clock_t::time_point now)
+    {
+      for(auto& slot : slots_)
+        if(slot.used && slot.frame_id == frame_id)
+          return &slot;
+      
+      auto target = std::find_if(std::begin(slots_), std::end(slots_), [](const slot_t& slot){ return !slot.used; });
+      
+      if(target == std::end(slots_))
+      {
+        // 空きが無ければ最も古いフレーム対を諦める（届いた断片の方が古ければそれを諦める）
+        target = std::min_element(std::begin(slots_), std::end(slots_), [](const slot_t& a, const slot_t& b){ return older(a.frame_id, b.frame_id); });
+        if(older(frame_id, target->frame_id))
+          return nullptr;
+        
+        DLOG(INFO) << "frame(" << target->frame_id << ") evicted";
+        release(*target);
+        ++evicted_count_;
+      }
+      
+      target->used          = true;
+      target->frame_id      = frame_id;
+      target->first_arrival = now;
+      return &*target;
+    }
+    
+    bool frame_reassembler_t::operator()(const uint8_t* datagram, const size_t size, const steady_clock_t::time_point now, encoded_frames_t& frames)
+    {
+      frame_transport::fragment_header_t header;
+      
+      if(size < sizeof(header))
+      {
+        ++invalid_count_;
+        return false;
+      }
+      
+      std::memcpy(&header, datagram, sizeof(header));
+      const auto payload_size = size - sizeof(header);
+      
+      if ( header.magic != frame_transport::magic
+        || header.camera_id > frame_transport::front_camera_id
+        || header.frame_size > frame_transport::max_frame_size
+        || header.chunk_index >= header.chunk_count
+        || size_t(header.chunk_offset) + payload_size > header.frame_size
+         )
+      {
+        ++invalid_count_;
+        return false;
+      }
+      
+      if(!has_session_ || header.session != session_)
+      {
+        // 送信側が（再）起動した
+        DLOG(INFO) << "new session: " << header.session;
+        for(auto& slot : slots_)
+          release(slot);
+        has_session_   = true;
+        session_       = header.session;
+        has_delivered_ = false;
+      }
+      
+      expire(now);
+      
+      if(has_delivered_ && !older(last_delivered_frame_id_, header.frame_id))
+      {
+        ++late_count_;
+        return false;
+      }
+      
+      const auto acquired = acquire(header.frame_id, now);
+      if(!acquired)
+      {
+        ++late_count_;
+        return false;
+      }
+      
+      auto& slot = *acquired;
+      auto& part = slot.parts[header.camera_id];
+      
+      if(!part.chunk_count)
+      {
+        part.size           = header.frame_size;
+        part.chunk_count    = header.chunk_count;
+        part.received_count = 0;
+        part.data.resize(part.size);
+        part.received.assign(part.chunk_count, false);
+      }
+      else if(part.size != header.frame_size || part.chunk_count != header.chunk_count)
+      {
+        ++invalid_count_;
+        return false;
+      }
+      
+      // 重複した断片は無視する
+      if(part.received[header.chunk_index])
+        return false;
+      
+      std::memcpy(part.data.data() + header.chunk_offset, datagram + sizeof(header), payload_size);
+      part.received[header.chunk_index] = true;
+      ++part.received_count;
+      
+      if(!slot.parts[frame_transport::top_camera_id].complete() || !slot.parts[frame_transport::front_camera_id].complete())
+        return false;
+      
+      for(size_t camera = 0; camera < frames.size(); ++camera)
+        std::swap(frames[camera], slot.parts[camera].data);
+      
+      has_delivered_           = true;
+      last_delivered_frame_id_ = slot.frame_id;
+      ++completed_count_;
+      release(slot);
+      
+      // 揃ったものより古い組み立て中のフレーム対はもう要らない
+      for(auto& other : slots_)
+        if(other.used && older(other.frame_id, last_delivered_frame_id_))
+        {
+          release(other);
+          ++evicted_count_;
+        }
+      
+      return true;
+    }
+    
+    const size_t frame_reassembler_t::max_inflight_frames() const
+    { return slots_.size(); }
+    
+    const size_t frame_reassembler_t::inflight_frames() const
+    { return size_t(std::count_if(std::begin(slots_), std::end(slots_), [](const slot_t& slot){ return slot.used; })); }
+    
+    const size_t frame_reassembler_t::completed_count() const
+    { return completed_count_; }
+    
+    const size_t frame_reassembler_t::expired_count() const
+    { return expired_count_; }
+    
+    const size_t frame_reassembler_t::evicted_count() const
+    { return evicted_count_; }
+    
+    const size_t frame_reassembler_t::late_count() const
+    { return late_count_; }
+    
+    const size_t frame_reassembler_t::invalid_count() const
+    { return invalid_count_; }
+  }
+}
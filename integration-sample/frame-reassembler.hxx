@@ -0,0 +1,83 @@
+#pragma once
+
+#include <array>
+#include <chrono>
+#include <cstdint>
+#include <vector>
+
+#include "network-common.hxx"
+#include "logger.hxx"
+
+namespace arisin
+{
+  namespace etupirka
+  {
+    // frame_transport の断片からフレーム対の JPEG を組み立てる
+    //   組み立て中のフレーム対は max_inflight_frames 個まで持ち、溢れたら最も古いものを捨てる。
+    //   最初の断片の到着から timeout を過ぎても揃わないものは捨てる。
+    //   揃ったフレーム対を返したら、それより古い組み立て中のもの、後から届いたものは捨てる
+    //   （古いフレームを遅れて処理しても意味が無いため）。
+    //   バッファは使い回すので、定常状態ではヒープ確保は起きない。
+    class frame_reassembler_t final
+    {
+    public:
+      using steady_clock_t   = std::chrono::steady_clock;
+      using encoded_frames_t = std::array<std::vector<uint8_t>, 2>;
+      
+    private:
+      struct part_t
+      {
+        std::vector<uint8_t> data;
+        std::vector<bool>    received;
+        uint32_t size           = 0;
+        uint16_t chunk_count    = 0;
+        uint16_t received_count = 0;
+        bool complete() const { return chunk_count && received_count == chunk_count; }
+      };
+      
+      struct slot_t
+      {
+        bool     used     = false;
+        uint32_t frame_id = 0;
+        steady_clock_t::time_point first_arrival;
+        std::array<part_t, 2> parts;
+      };
+      
+      std::vector<slot_t> slots_;
+      std::chrono::nanoseconds timeout_;
+      
+      bool     has_session_;
+      uint32_t session_;
+      bool     has_delivered_;
+      uint32_t last_delivered_frame_id_;
+      
+      size_t completed_count_;
+      size_t expired_count_;
+      size_t evicted_count_;
+      size_t late_count_;
+      size_t invalid_count_;
+      
+      // 通し番号の一周を考慮した比較
+      static bool older(const uint32_t a, const uint32_t b)
+      { return int32_t(a - b) < 0; }
+      
+      static void release(slot_t& slot);
+      void expire(const steady_clock_t::time_point now);
+      // frame_id の組み立て先（満杯でそれが最も古ければ nullptr）
+      slot_t* acquire(const uint32_t frame_id, const steady_clock_t::time_point now);
+      
+    public:
+      frame_reassembler_t(const size_t max_inflight_frames, const std::chrono::nanoseconds timeout);
+      // 断片を1つ渡す。フレーム対が揃ったら frames と入れ替えて true を返す
+      //   （frames に元々あったバッファは以後の組み立てに使い回す）
+      bool operator()(const uint8_t* datagram, const size_t size, const steady_clock_t::time_point now, encoded_frames_t& frames);
+      const size_t max_inflight_frames() const;
+      const size_t inflight_frames() const;
+      const size_t completed_count() const;
+      const size_t expired_count() const;
+      const size_t evicted_count() const;
+      const size_t late_count() const;
+      const size_t invalid_count() const;
+    };
+  }
+}
@@ -0,0 +1,192 @@
+#include "frame-recording.hxx"
+
+#include <algorithm>
+#include <cstring>
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+namespace arisin
+{
+  namespace etupirka
+  {
+    frame_recorder_t::frame_recorder_t(const std::string& filename)
+      : filename_(filename)
+      , stream_(filename, std::ios::binary | std::ios::trunc)
+      , header_()
+      , padding_(frame_recording::alignment, 0)
+      , sequence_(0)
+    {
+      if(!stream_)
+        LOG(FATAL) << "can not open record file: " << filename_;
+      
+      DLOG(INFO) << "record file opened: " << filename_;
+    }
+    
+    void frame_recorder_t::write_frame(const cv::Mat& frame)
+    {
+      // 行の詰め物を除いて書く
+      const auto row_bytes = size_t(frame.cols) * frame.elemSize();
+      if(frame.isContinuous())
+        stream_.write(reinterpret_cast<const char*>(frame.data), row_bytes * frame.rows);
+      else
+        for(int y = 0; y < frame.rows; ++y)
+          stream_.write(reinterpret_cast<const char*>(frame.ptr(y)), row_bytes);
+      
+      stream_.write(padding_.data(), frame_recording::aligned(header_.frame_bytes) - header_.frame_bytes);
+    }
+    
+    bool frame_recorder_t::operator()(const cv::Mat& top, const cv::Mat& front, const std::chrono::nanoseconds top_timestamp, const std::chrono::nanoseconds front_timestamp)
+    {
+      if(top.empty() || front.empty() || top.rows != front.rows || top.cols != front.cols || top.type() != front.type())
+      {
+        LOG(WARNING) << "top and front frames differ in size or type; skip recording";
+        return false;
+      }
+      
+      if(!header_.chunk_stride)
+      {
+        // 先頭のフレーム対からファイルヘッダーを決めて書く
+        header_.magic        = frame_recording::file_magic;
+        header_.version      = frame_recording::version;
+        header_.width        = top.cols;
+        header_.height       = top.rows;
+        header_.type         = top.type();
+        header_.frame_bytes  = uint64_t(top.total() * top.elemSize());
+        header_.chunk_stride = sizeof(frame_recording::chunk_header_t) + 2 * frame_recording::aligned(header_.frame_bytes);
+        stream_.write(reinterpret_cast<const char*>(&header_), sizeof(header_));
+        DLOG(INFO) << "record " << header_.width << "x" << header_.height << " type(" << header_.type << ") chunk stride: " << header_.chunk_stride;
+      }
+      else if(top.cols != header_.width || top.rows != header_.height || top.type() != header_.type)
+      {
+        LOG(WARNING) << "frame size or type changed while recording; skip recording";
+        return false;
+      }
+      
+      frame_recording::chunk_header_t chunk = {};
+      chunk.magic           = frame_recording::chunk_magic;
+      chunk.sequence        = sequence_;
+      chunk.top_timestamp   = top_timestamp.count();
+      chunk.front_timestamp = front_timestamp.count();
+      stream_.write(reinterpret_cast<const char*>(&chunk), sizeof(chunk));
+      
+      write_frame(top);
+      write_frame(front);
+      
+      if(!stream_)
+      {
+        LOG(WARNING) << "write to record file failed: " << filename_;
+        return false;
+      }
+      
+      ++sequence_;
+      return true;
+    }
+    
+    const uint64_t frame_recorder_t::frames() const
+    { return sequence_; }
+    
+    const std::string& frame_recorder_t::filename() const
+    { return filename_; }
+    
+    frame_player_t::frame_player_t(const std::string& filename)
+      : filename_(filename)
+      , mapping_(MAP_FAILED)
+      , mapping_size_(0)
+      , header_()
+      , frames_(0)
+    {
+      const auto fd = ::open(filename_.data(), O_RDONLY);
+      if(fd < 0)
+        LOG(FATAL) << "can not open replay file: " << filename_;
+      
+      struct stat s;
+      if(::fstat(fd, &s) != 0 || size_t(s.st_size) < sizeof(header_))
+      {
+        ::close(fd);
+        LOG(FATAL) << "replay file is too small: " << filename_;
+      }
+      
+      mapping_size_ = size_t(s.st_size);
+      mapping_ = ::mmap(nullptr, mapping_size_, PROT_READ | PROT_WRITE, MAP_PRIVATE, fd, 0);
+      // 写した後はファイル記述子は要らない
+      ::close(fd);
+      
+      if(mapping_ == MAP_FAILED)
+        LOG(FATAL) << "can not mmap replay file: " << filename_;
+      
+      // 先頭から順に読むので先読みを促す
+      ::madvise(mapping_, mapping_size_, MADV_SEQUENTIAL);
+      
+      std::memcpy(&header_, mapping_, sizeof(header_));
+      
+      if(header_.magic != frame_recording::file_magic || header_.version != frame_recording::version)
+        LOG(FATAL) << "replay file is not an etupirka raw frame recording (or unsupported version): " << filename_;
+      
+      // 壊れた（または食い違った）ヘッダーで operator() が chunk や写像の外まで届く cv::Mat を作らないよう、
+      // 1フレームの大きさが画像の大きさと型から求めたものと一致することを確かめる
+      constexpr int32_t max_side = 1 << 16;
+      if
+      (  header_.width  <= 0 || header_.width  > max_side
+      || header_.height <= 0 || header_.height > max_side
+      || header_.type < 0 || header_.type != CV_MAT_TYPE(header_.type) || CV_MAT_DEPTH(header_.type) > CV_64F
+      )
+        LOG(FATAL) << "replay file has invalid frame geometry " << header_.width << "x" << header_.height << " type(" << header_.type << "): " << filename_;
+      
+      if(header_.frame_bytes != uint64_t(header_.width) * uint64_t(header_.height) * uint64_t(CV_ELEM_SIZE(header_.type)))
+        LOG(FATAL) << "replay file frame size(" << header_.frame_bytes << ") does not match " << header_.width << "x" << header_.height << " type(" << header_.type << "): " << filename_;
+      
+      if(header_.chunk_stride != sizeof(frame_recording::chunk_header_t) + 2 * frame_recording::aligned(header_.frame_bytes))
+        LOG(FATAL) << "replay file has inconsistent chunk stride: " << filename_;
+      
+      frames_ = (mapping_size_ - sizeof(header_)) / header_.chunk_stride;
+      
+      DLOG(INFO) << "replay file mapped: " << filename_ << " " << header_.width << "x" << header_.height << " type(" << header_.type << ") " << frames_ << " frames";
+    }
+    
+    frame_player_t::~frame_player_t()
+    {
+      if(mapping_ != MAP_FAILED)
+        ::munmap(mapping_, mapping_size_);
+    }
+    
+    bool frame_player_t::operator()(const size_t index, recorded_frames_t& frames) const
+    {
+      if(index >= frames_)
+        return false;
+      
+      const auto chunk_data = static_cast<uint8_t*>(mapping_) + sizeof(header_) + index * header_.chunk_stride;
+      const auto& chunk = *reinterpret_cast<const frame_recording::chunk_header_t*>(chunk_data);
+      
+      if(chunk.magic != frame_recording::chunk_magic)
+      {
+        LOG(WARNING) << "replay file chunk(" << index << ") is broken: " << filename_;
+        return false;
+      }
+      
+      const auto top_data = chunk_data + sizeof(chunk);
+      // ヘッダーを作るだけで画像は複写しない
+      frames.top             = cv::Mat(header_.height, header_.width, header_.type, top_data);
+      frames.front           = cv::Mat(header_.height, header_.width, header_.type, top_data + frame_recording::aligned(header_.frame_bytes));
+      frames.top_timestamp   = std::chrono::nanoseconds(chunk.top_timestamp);
+      frames.front_timestamp = std::chrono::nanoseconds(chunk.front_timestamp);
+      frames.sequence        = chunk.sequence;
+      
+      return true;
+    }
+    
+    const size_t frame_player_t::frames() const
+    { return frames_; }
+    
+    const int frame_player_t::width() const
+    { return header_.width; }
+    
+    const int frame_player_t::height() const
+    { return header_.height; }
+    
+    const std::string& frame_player_t::filename() const
+    { return filename_; }
+  }
+}
@@ -0,0 +1,115 @@
+#pragma once
+
+#include <array>
+#include <chrono>
+#include <cstdint>
+#include <fstream>
+#include <string>
+#include <vector>
+
+#include <opencv2/core/core.hpp>
+
+#include "logger.hxx"
+
+namespace arisin
+{
+  namespace etupirka
+  {
+    // top と front のフレーム対を無圧縮で記録するファイル形式
+    //   [file_header_t][chunk_header_t][top][front][chunk_header_t][top][front]...
+    //   画像は行の詰め物無しで置き、ヘッダーと画像の先頭は alignment 境界に揃える。
+    //   全チャンクが同じ大きさなので n 番目の位置は計算で求まり、再生時は mmap した領域を
+    //   指す cv::Mat のヘッダーを返すだけで複写しない。
+    //   数値はホストのバイト順で書く（記録した計算機と同じ種類の計算機で再生する前提）。
+    namespace frame_recording
+    {
+      constexpr size_t alignment = 64;
+      constexpr uint32_t version = 1;
+      
+      struct file_header_t
+      {
+        std::array<char, 8> magic;
+        uint32_t version;
+        int32_t  width;
+        int32_t  height;
+        int32_t  type;
+        uint64_t frame_bytes;
+        uint64_t chunk_stride;
+        uint8_t  reserved[alignment - 40];
+      };
+      
+      struct chunk_header_t
+      {
+        std::array<char, 8> magic;
+        uint64_t sequence;
+        // steady_clock の撮影時刻 [ns]
+        int64_t  top_timestamp;
+        int64_t  front_timestamp;
+        uint8_t  reserved[alignment - 32];
+      };
+      
+      static_assert(sizeof(file_header_t)  == alignment, "file_header_t must be one alignment unit");
+      static_assert(sizeof(chunk_header_t) == alignment, "chunk_header_t must be one alignment unit");
+      
+      constexpr std::array<char, 8> file_magic  = {{ 'E', 'T', 'P', 'K', 'R', 'A', 'W', '\0' }};
+      constexpr std::array<char, 8> chunk_magic = {{ 'E', 'T', 'P', 'K', 'C', 'H', 'N', 'K' }};
+      
+      inline constexpr size_t aligned(const size_t bytes)
+      { return (bytes + alignment - 1) / alignment * alignment; }
+    }
+    
+    // 記録されたフレーム対の1件分（top と front は記録ファイルを指すヘッダー）
+    struct recorded_frames_t
+    {
+      cv::Mat top;
+      cv::Mat front;
+      std::chrono::nanoseconds top_timestamp;
+      std::chrono::nanoseconds front_timestamp;
+      uint64_t sequence;
+    };
+    
+    // フレーム対をチャンク単位でファイルへ追記する
+    class frame_recorder_t final
+    {
+      std::string filename_;
+      std::ofstream stream_;
+      frame_recording::file_header_t header_;
+      std::vector<char> padding_;
+      uint64_t sequence_;
+      
+      void write_frame(const cv::Mat& frame);
+      
+    public:
+      explicit frame_recorder_t(const std::string& filename);
+      // 先頭のフレーム対で画像の大きさと型が決まり、以後異なるものは記録しない
+      bool operator()(const cv::Mat& top, const cv::Mat& front, const std::chrono::nanoseconds top_timestamp, const std::chrono::nanoseconds front_timestamp);
+      const uint64_t frames() const;
+      const std::string& filename() const;
+    };
+    
+    // 記録ファイルを mmap してフレーム対のヘッダーを返す
+    //   ファイルは MAP_PRIVATE で写すので、返した画像への書き込みはファイルに反映されない。
+    //   末尾の書きかけのチャンク（記録中の異常終了など）は数えない。
+    class frame_player_t final
+    {
+      std::string filename_;
+      void*  mapping_;
+      size_t mapping_size_;
+      frame_recording::file_header_t header_;
+      size_t frames_;
+      
+    public:
+      explicit frame_player_t(const std::string& filename);
+      ~frame_player_t();
+      frame_player_t(const frame_player_t&) = delete;
+      frame_player_t& operator=(const frame_player_t&) = delete;
+      
+      // index 番目のフレーム対を返す（チャンクが壊れていれば false）
+      bool operator()(const size_t index, recorded_frames_t& frames) const;
+      const size_t frames() const;
+      const int width() const;
+      const int height() const;
+      const std::string& filename() const;
+    };
+  }
+}
@@ -0,0 +1,408 @@
+#include "hsv-filter.hxx"
+
+#include <algorithm>
+#include <cfloat>
+
+#if defined(__SSE2__)
+  #include <emmintrin.h>
+  #define ARISIN_ETUPIRKA_HSV_FILTER_SSE2
+#elif defined(__ARM_NEON__) || defined(__ARM_NEON)
+  #include <arm_neon.h>
+  #define ARISIN_ETUPIRKA_HSV_FILTER_NEON
+#endif
+
+namespace
+{
+  using arisin::etupirka::hsv_filter_t;
+  
+  // (R + 4G + 2B) / 7 の除算を乗算と16bitシフトで行う（分子は最大 7 * 255 = 1785 で、その範囲では切り捨て除算と一致する）
+  constexpr uint32_t div7_multiplier = 9363;
+  
+  inline uint8_t luma(const uint32_t b, const uint32_t g, const uint32_t r)
+  { return uint8_t((r + g * 4 + b * 2) * div7_multiplier >> 16); }
+  
+  inline bool passes
+  ( const uint8_t v, const uint8_t diff, const int n, const uint8_t branch
+  , const uint8_t* diff_lo, const uint8_t* diff_hi, const hsv_filter_t::hue_range_t* hue_ranges
+  )
+  {
+    // 乱れた入力で分岐予測を外さないよう、論理演算子ではなくビット演算で組む
+    const auto& h = hue_ranges[branch * 256 + diff];
+    return (diff >= diff_lo[v]) & (diff <= diff_hi[v]) & ( ((n >= h.lo) & (n <= h.hi)) ^ bool(h.invert) );
+  }
+
+#if defined(ARISIN_ETUPIRKA_HSV_FILTER_SSE2) || defined(ARISIN_ETUPIRKA_HSV_FILTER_NEON)
+  // SIMD で求めた1ブロック分の v, diff, n, branch, 輝度から、表を引いて出力を書く
+  inline void select_block
+  ( const uint8_t* v, const uint8_t* diff, const int16_t* n, const uint8_t* branch, const uint8_t* y
+  , uint8_t* dst, const size_t size
+  , const uint8_t* diff_lo, const uint8_t* diff_hi, const hsv_filter_t::hue_range_t* hue_ranges
+  )
+  {
+    for(size_t i = 0; i < size; ++i)
+      dst[i] = y[i] & -uint8_t(passes(v[i], diff[i], n[i], branch[i], diff_lo, diff_hi, hue_ranges));
+  }
+#endif
+
+#if defined(ARISIN_ETUPIRKA_HSV_FILTER_SSE2)
+  // 連続する6本（32画素分のBGR24）を、B, G, R それぞれ16画素ずつの2本へ並べ替える
+  //   unpacklo/hi の1段は96要素の完全シャッフル（i -> 2i mod 95）なので、5段で i = 3p + c が 32c + p へ移る
+  inline void deinterleave_bgr24(__m128i* c)
+  {
+    for(int layer = 0; layer < 5; ++layer)
+    {
+      const auto t0 = _mm_unpacklo_epi8(c[0], c[3]);
+      const auto t1 = _mm_unpackhi_epi8(c[0], c[3]);
+      const auto t2 = _mm_unpacklo_epi8(c[1], c[4]);
+      const auto t3 = _mm_unpackhi_epi8(c[1], c[4]);
+      const auto t4 = _mm_unpacklo_epi8(c[2], c[5]);
+      const auto t5 = _mm_unpackhi_epi8(c[2], c[5]);
+      c[0] = t0; c[1] = t1; c[2] = t2; c[3] = t3; c[4] = t4; c[5] = t5;
+    }
+  }
+  
+  // 16画素分
+  inline void evaluate_sse2
+  ( const __m128i b, const __m128i g, const __m128i r
+  , uint8_t* v_out, uint8_t* diff_out, int16_t* n_out, uint8_t* branch_out, uint8_t* y_out
+  )
+  {
+    const auto zero = _mm_setzero_si128();
+    
+    const auto v    = _mm_max_epu8(_mm_max_epu8(b, g), r);
+    const auto vmin = _mm_min_epu8(_mm_min_epu8(b, g), r);
+    const auto diff = _mm_sub_epi8(v, vmin);
+    
+    const auto is_r = _mm_cmpeq_epi8(v, r);
+    const auto is_g = _mm_andnot_si128(is_r, _mm_cmpeq_epi8(v, g));
+    
+    const auto b_lo = _mm_unpacklo_epi8(b, zero), b_hi = _mm_unpackhi_epi8(b, zero);
+    const auto g_lo = _mm_unpacklo_epi8(g, zero), g_hi = _mm_unpackhi_epi8(g, zero);
+    const auto r_lo = _mm_unpacklo_epi8(r, zero), r_hi = _mm_unpackhi_epi8(r, zero);
+    
+    // 輝度
+    const auto multiplier = _mm_set1_epi16(short(div7_multiplier));
+    const auto y_lo = _mm_mulhi_epu16(_mm_add_epi16(r_lo, _mm_add_epi16(_mm_slli_epi16(g_lo, 2), _mm_slli_epi16(b_lo, 1))), multiplier);
+    const auto y_hi = _mm_mulhi_epu16(_mm_add_epi16(r_hi, _mm_add_epi16(_mm_slli_epi16(g_hi, 2), _mm_slli_epi16(b_hi, 1))), multiplier);
+    
+    // n: v == r なら g - b、v == g なら b - r、それ以外は r - g
+    const auto select = [](const __m128i mask, const __m128i a, const __m128i b)
+    { return _mm_or_si128(_mm_and_si128(mask, a), _mm_andnot_si128(mask, b)); };
+    const auto is_r_lo = _mm_unpacklo_epi8(is_r, is_r), is_r_hi = _mm_unpackhi_epi8(is_r, is_r);
+    const auto is_g_lo = _mm_unpacklo_epi8(is_g, is_g), is_g_hi = _mm_unpackhi_epi8(is_g, is_g);
+    const auto n_lo = select(is_r_lo, _mm_sub_epi16(g_lo, b_lo), select(is_g_lo, _mm_sub_epi16(b_lo, r_lo), _mm_sub_epi16(r_lo, g_lo)));
+    const auto n_hi = select(is_r_hi, _mm_sub_epi16(g_hi, b_hi), select(is_g_hi, _mm_sub_epi16(b_hi, r_hi), _mm_sub_epi16(r_hi, g_hi)));
+    
+    // branch
+    const auto is_negative = _mm_packs_epi16(_mm_cmplt_epi16(n_lo, _mm_setzero_si128()), _mm_cmplt_epi16(n_hi, _mm_setzero_si128()));
+    const auto branch = select
+    ( is_r, _mm_and_si128(is_negative, _mm_set1_epi8(hsv_filter_t::branch_r_negative))
+    , select(is_g, _mm_set1_epi8(hsv_filter_t::branch_g), _mm_set1_epi8(hsv_filter_t::branch_b))
+    );
+    
+    _mm_storeu_si128(reinterpret_cast<__m128i*>(v_out), v);
+    _mm_storeu_si128(reinterpret_cast<__m128i*>(diff_out), diff);
+    _mm_storeu_si128(reinterpret_cast<__m128i*>(n_out), n_lo);
+    _mm_storeu_si128(reinterpret_cast<__m128i*>(n_out + 8), n_hi);
+    _mm_storeu_si128(reinterpret_cast<__m128i*>(branch_out), branch);
+    _mm_storeu_si128(reinterpret_cast<__m128i*>(y_out), _mm_packus_epi16(y_lo, y_hi));
+  }
+#endif
+
+#if defined(ARISIN_ETUPIRKA_HSV_FILTER_NEON)
+  // 16画素分
+  inline void evaluate_neon
+  ( const uint8x16_t b, const uint8x16_t g, const uint8x16_t r
+  , uint8_t* v_out, uint8_t* diff_out, int16_t* n_out, uint8_t* branch_out, uint8_t* y_out
+  )
+  {
+    const auto v    = vmaxq_u8(vmaxq_u8(b, g), r);
+    const auto vmin = vminq_u8(vminq_u8(b, g), r);
+    const auto diff = vsubq_u8(v, vmin);
+    
+    const auto is_r = vceqq_u8(v, r);
+    const auto is_g = vbicq_u8(vceqq_u8(v, g), is_r);
+    
+    const auto b_lo = vmovl_u8(vget_low_u8(b)), b_hi = vmovl_u8(vget_high_u8(b));
+    const auto g_lo = vmovl_u8(vget_low_u8(g)), g_hi = vmovl_u8(vget_high_u8(g));
+    const auto r_lo = vmovl_u8(vget_low_u8(r)), r_hi = vmovl_u8(vget_high_u8(r));
+    
+    // 輝度
+    const auto multiplier = vdup_n_u16(uint16_t(div7_multiplier));
+    const auto x_lo = vaddq_u16(r_lo, vaddq_u16(vshlq_n_u16(g_lo, 2), vshlq_n_u16(b_lo, 1)));
+    const auto x_hi = vaddq_u16(r_hi, vaddq_u16(vshlq_n_u16(g_hi, 2), vshlq_n_u16(b_hi, 1)));
+    const auto y_lo = vcombine_u16(vshrn_n_u32(vmull_u16(vget_low_u16(x_lo), multiplier), 16), vshrn_n_u32(vmull_u16(vget_high_u16(x_lo), multiplier), 16));
+    const auto y_hi = vcombine_u16(vshrn_n_u32(vmull_u16(vget_low_u16(x_hi), multiplier), 16), vshrn_n_u32(vmull_u16(vget_high_u16(x_hi), multiplier), 16));
+    
+    // n: v == r なら g - b、v == g なら b - r、それ以外は r - g
+    const auto widen_mask_lo = [](const uint8x16_t m){ return vreinterpretq_u16_s16(vmovl_s8(vreinterpret_s8_u8(vget_low_u8(m)))); };
+    const auto widen_mask_hi = [](const uint8x16_t m){ return vreinterpretq_u16_s16(vmovl_s8(vreinterpret_s8_u8(vget_high_u8(m)))); };
+    const auto s16 = [](const uint16x8_t a){ return vreinterpretq_s16_u16(a); };
+    const auto n_lo = vbslq_s16(widen_mask_lo(is_r), vsubq_s16(s16(g_lo), s16(b_lo)), vbslq_s16(widen_mask_lo(is_g), vsubq_s16(s16(b_lo), s16(r_lo)), vsubq_s16(s16(r_lo), s16(g_lo))));
+    const auto n_hi = vbslq_s16(widen_mask_hi(is_r), vsubq_s16(s16(g_hi), s16(b_hi)), vbslq_s16(widen_mask_hi(is_g), vsubq_s16(s16(b_hi), s16(r_hi)), vsubq_s16(s16(r_hi), s16(g_hi))));
+    
+    // branch
+    const auto is_negative = vcombine_u8(vmovn_u16(vcltq_s16(n_lo, vdupq_n_s16(0))), vmovn_u16(vcltq_s16(n_hi, vdupq_n_s16(0))));
+    const auto branch = vbslq_u8
+    ( is_r, vandq_u8(is_negative, vdupq_n_u8(hsv_filter_t::branch_r_negative))
+    , vbslq_u8(is_g, vdupq_n_u8(hsv_filter_t::branch_g), vdupq_n_u8(hsv_filter_t::branch_b))
+    );
+    
+    vst1q_u8(v_out, v);
+    vst1q_u8(diff_out, diff);
+    vst1q_s16(n_out, n_lo);
+    vst1q_s16(n_out + 8, n_hi);
+    vst1q_u8(branch_out, branch);
+    vst1q_u8(y_out, vcombine_u8(vmovn_u16(y_lo), vmovn_u16(y_hi)));
+  }
+#endif
+}
+
+namespace arisin
+{
+  namespace etupirka
+  {
+    constexpr int hsv_filter_t::lookup_table_bits;
+    
+    hsv_filter_t::hsv_filter_t()
+      : built_(false)
+      , use_lookup_table_(false)
+      , lookup_table_stale_(true)
+    { }
+    
+    void hsv_filter_t::set(float h_min, float h_max, float s_min, float s_max, float v_min, float v_max)
+    {
+      if( built_
+       && h_min == h_min_ && h_max == h_max_
+       && s_min == s_min_ && s_max == s_max_
+       && v_min == v_min_ && v_max == v_max_
+        )
+        return;
+      
+      h_min_ = h_min;
+      h_max_ = h_max;
+      s_min_ = s_min;
+      s_max_ = s_max;
+      v_min_ = v_min;
+      v_max_ = v_max;
+      
+      build();
+      built_ = true;
+      lookup_table_stale_ = true;
+    }
+    
+    void hsv_filter_t::set_lookup_table(const bool enabled)
+    {
+      if(enabled == use_lookup_table_)
+        return;
+      
+      DLOG(INFO) << "set_lookup_table: " << enabled;
+      use_lookup_table_ = enabled;
+      
+      if(!enabled)
+      {
+        std::vector<uint8_t>().swap(lookup_table_);
+        lookup_table_stale_ = true;
+      }
+    }
+    
+    void hsv_filter_t::build_lookup_table()
+    {
+      DLOG(INFO) << "build_lookup_table bits: " << lookup_table_bits;
+      
+      constexpr int levels = 1 << lookup_table_bits;
+      constexpr int shift  = 8 - lookup_table_bits;
+      // 各セルはその中央の色で代表させる
+      constexpr int center = shift ? 1 << (shift - 1) : 0;
+      
+      lookup_table_.assign(size_t(levels) * levels * levels / 8, 0);
+      
+      size_t index = 0;
+      for(int r = 0; r < levels; ++r)
+        for(int g = 0; g < levels; ++g)
+          for(int b = 0; b < levels; ++b, ++index)
+            if((*this)(uint8_t((b << shift) | center), uint8_t((g << shift) | center), uint8_t((r << shift) | center)))
+              lookup_table_[index >> 3] |= uint8_t(1 << (index & 7));
+      
+      lookup_table_stale_ = false;
+    }
+    
+    void hsv_filter_t::build()
+    {
+      DLOG(INFO) << "build h-min, h-max, s-min, s-max, v-min, v-max: " << h_min_ << ", " << h_max_ << ", " << s_min_ << ", " << s_max_ << ", " << v_min_ << ", " << v_max_;
+      
+      // S と V
+      //   RGB2HSV_f: s = diff / (v + FLT_EPSILON) は v を固定すると diff について単調非減少なので、合格する diff は区間になる
+      for(int v = 0; v < 256; ++v)
+      {
+        int lo = 1, hi = 0;
+        
+        if(float(v) >= v_min_ && float(v) <= v_max_)
+          for(int diff = 0; diff <= v; ++diff)
+          {
+            const float s = float(diff) / (float(v) + FLT_EPSILON);
+            if(s >= s_min_ && s <= s_max_)
+            {
+              if(lo > hi)
+                lo = diff;
+              hi = diff;
+            }
+          }
+        
+        diff_lo_[v] = uint8_t(lo);
+        diff_hi_[v] = uint8_t(hi);
+      }
+      
+      // H
+      //   RGB2HSV_f: h = n * float(60. / (diff + FLT_EPSILON)) + { 0, 120, 240 }; h < 0 なら h += 360
+      //   場合分けと diff を固定すると h は n について単調非減少なので、合格する n は区間かその補集合になる
+      static const float offsets[branches]  = { 0.f, 120.f, 240.f, 0.f };
+      for(int branch = 0; branch < branches; ++branch)
+        for(int diff = 0; diff < 256; ++diff)
+        {
+          const float k = float(60. / (float(diff) + FLT_EPSILON));
+          
+          const int n_min = branch == branch_r ? 0 : -diff;
+          const int n_max = branch == branch_r_negative ? -1 : diff;
+          
+          int pass_lo = 1, pass_hi = 0, pass_count = 0;
+          int fail_lo = 1, fail_hi = 0, fail_count = 0;
+          
+          for(int n = n_min; n <= n_max; ++n)
+          {
+            // 積和が FMA にまとめられると丸めが OpenCV と変わるので、積を一度メモリへ落とす
+            volatile float product = float(n) * k;
+            float h = product + offsets[branch];
+            if(h < 0)
+              h += 360.f;
+            
+            if( ( h >= h_min_ && h <= h_max_ ) || ( h_max_ > 360.f && ( h >= h_min_ || h <= h_max_ - 360.f ) ) )
+            {
+              if(!pass_count++)
+                pass_lo = n;
+              pass_hi = n;
+            }
+            else
+            {
+              if(!fail_count++)
+                fail_lo = n;
+              fail_hi = n;
+            }
+          }
+          
+          auto& range = hue_ranges_[branch * 256 + diff];
+          if(pass_hi - pass_lo + 1 == pass_count)
+            range = { int16_t(pass_lo), int16_t(pass_hi), 0 };
+          else if(fail_hi - fail_lo + 1 == fail_count)
+            range = { int16_t(fail_lo), int16_t(fail_hi), 1 };
+          else
+            LOG(FATAL) << "hue predicate is not an interval; branch(" << branch << ") diff(" << diff << ")";
+        }
+    }
+    
+    uint8_t hsv_filter_t::operator()(const uint8_t b, const uint8_t g, const uint8_t r) const
+    {
+      const auto v    = std::max(std::max(r, g), b);
+      const auto vmin = std::min(std::min(r, g), b);
+      const auto diff = uint8_t(v - vmin);
+      
+      int n;
+      uint8_t branch;
+      if(v == r)
+      {
+        n = int(g) - int(b);
+        branch = n < 0 ? branch_r_negative : branch_r;
+      }
+      else if(v == g)
+      {
+        n = int(b) - int(r);
+        branch = branch_g;
+      }
+      else
+      {
+        n = int(r) - int(g);
+        branch = branch_b;
+      }
+      
+      return passes(v, diff, n, branch, diff_lo_.data(), diff_hi_.data(), hue_ranges_.data()) ? luma(b, g, r) : 0;
+    }
+    
+    void hsv_filter_t::operator()(const cv::Mat& src, cv::Mat& dst)
+    {
+      if(!built_)
+        LOG(FATAL) << "hsv_filter_t is not set";
+      
+      dst.create(src.rows, src.cols, CV_8UC1);
+      
+      if(use_lookup_table_)
+      {
+        if(lookup_table_stale_)
+          build_lookup_table();
+        
+        constexpr int shift = 8 - lookup_table_bits;
+        const auto table = lookup_table_.data();
+        
+        for(int row = 0; row < src.rows; ++row)
+        {
+          const auto* s = src.ptr<uint8_t>(row);
+                auto* d = dst.ptr<uint8_t>(row);
+          for(int col = 0; col < src.cols; ++col, s += 3)
+          {
+            const auto index = (uint32_t(s[2] >> shift) << (2 * lookup_table_bits)) | (uint32_t(s[1] >> shift) << lookup_table_bits) | uint32_t(s[0] >> shift);
+            *d++ = luma(s[0], s[1], s[2]) & -uint8_t((table[index >> 3] >> (index & 7)) & 1);
+          }
+        }
+        
+        return;
+      }
+      
+      for(int row = 0; row < src.rows; ++row)
+      {
+        const auto* s = src.ptr<uint8_t>(row);
+              auto* d = dst.ptr<uint8_t>(row);
+        int col = 0;
+
+#if defined(ARISIN_ETUPIRKA_HSV_FILTER_SSE2)
+        alignas(16) uint8_t v[32], diff[32], branch[32], y[32];
+        alignas(16) int16_t n[32];
+        for(; col + 32 <= src.cols; col += 32, s += 96, d += 32)
+        {
+          __m128i c[6];
+          for(int i = 0; i < 6; ++i)
+            c[i] = _mm_loadu_si128(reinterpret_cast<const __m128i*>(s) + i);
+          deinterleave_bgr24(c);
+          evaluate_sse2(c[0], c[2], c[4], v     , diff     , n     , branch     , y     );
+          evaluate_sse2(c[1], c[3], c[5], v + 16, diff + 16, n + 16, branch + 16, y + 16);
+          select_block(v, diff, n, branch, y, d, 32, diff_lo_.data(), diff_hi_.data(), hue_ranges_.data());
+        }
+#elif defined(ARISIN_ETUPIRKA_HSV_FILTER_NEON)
+        alignas(16) uint8_t v[16], diff[16], branch[16], y[16];
+        alignas(16) int16_t n[16];
+        for(; col + 16 <= src.cols; col += 16, s += 48, d += 16)
+        {
+          const auto bgr = vld3q_u8(s);
+          evaluate_neon(bgr.val[0], bgr.val[1], bgr.val[2], v, diff, n, branch, y);
+          select_block(v, diff, n, branch, y, d, 16, diff_lo_.data(), diff_hi_.data(), hue_ranges_.data());
+        }
+#endif
+
+        for(; col < src.cols; ++col, s += 3)
+          *d++ = (*this)(s[0], s[1], s[2]);
+      }
+    }
+    
+    const char* hsv_filter_t::kernel_name() const
+    {
+#if defined(ARISIN_ETUPIRKA_HSV_FILTER_SSE2)
+      return "sse2";
+#elif defined(ARISIN_ETUPIRKA_HSV_FILTER_NEON)
+      return "neon";
+#else
+      return "scalar";
+#endif
+    }
+    
+    const bool hsv_filter_t::lookup_table() const
+    { return use_lookup_table_; }
+  }
+}
@@ -0,0 +1,87 @@
+#pragma once
+
+#include <array>
+#include <cstdint>
+#include <vector>
+
+#include <opencv2/core/core.hpp>
+
+#include "logger.hxx"
+
+namespace arisin
+{
+  namespace etupirka
+  {
+    // BGR24 から HSV の範囲判定と輝度出力を1パスで行うフィルター
+    //   in : cv::Mat<CV_8UC3(BGR24)>
+    //   out: cv::Mat<CV_8UC1>; 判定を通った画素は (R + 4G + 2B) / 7、それ以外は 0
+    //   判定は OpenCV の float 版 BGR2HSV（H: 0..360, S: 0..1, V: 0..255）に対する
+    //     ( ( h_min <= h <= h_max ) || ( h_max > 360 && ( h >= h_min || h <= h_max - 360 ) ) )
+    //     && s_min <= s <= s_max && v_min <= v <= v_max
+    //   と画素単位で一致する。8bit の入力から取り得る値は有限なので、閾値の設定時にその判定を
+    //   整数の区間表へ焼き込み、画素毎の処理では浮動小数点演算を行わない。
+    //   lookup_table モードでは、更に各チャンネルを上位 lookup_table_bits ビットに量子化した
+    //   BGR の判定結果をビット表に焼き込み、画素毎の判定を表の1回の参照にする（量子化の分だけ近似になる）。
+    class hsv_filter_t final
+    {
+    public:
+      // 色相の場合分け（RGB2HSV_f の v == r / v == g / それ以外 に対応）
+      //   v == r の場合は h < 0 で 360 を足すため g - b の符号で更に分ける
+      enum branch_t : uint8_t
+      { branch_r          = 0 // v == r && g - b >= 0
+      , branch_g          = 1 // v == g
+      , branch_b          = 2 // それ以外
+      , branch_r_negative = 3 // v == r && g - b < 0
+      , branches
+      };
+      
+      // 色相の場合分けと diff( = max - min ) 毎の、n（場合分け毎の差分）の合格区間
+      //   invert が真なら区間外が合格
+      struct hue_range_t
+      {
+        int16_t lo;
+        int16_t hi;
+        uint8_t invert;
+      };
+      
+    private:
+      float h_min_, h_max_, s_min_, s_max_, v_min_, v_max_;
+      bool built_;
+      
+      // v 毎の、S と V の判定を通る diff の区間（空なら lo > hi）
+      std::array<uint8_t, 256> diff_lo_;
+      std::array<uint8_t, 256> diff_hi_;
+      
+      // [ branch * 256 + diff ]
+      std::array<hue_range_t, branches * 256> hue_ranges_;
+      
+      // 量子化した BGR 毎の判定結果のビット表（[ (r << 2 * bits) | (g << bits) | b ]）
+      //   閾値が変わると古くなり、次にフィルターを掛ける時に作り直す
+      bool use_lookup_table_;
+      bool lookup_table_stale_;
+      std::vector<uint8_t> lookup_table_;
+      
+      void build();
+      void build_lookup_table();
+      
+    public:
+      static constexpr int lookup_table_bits = 6;
+      
+      hsv_filter_t();
+      
+      // 閾値が変わった場合だけ判定表を作り直す
+      void set(float h_min, float h_max, float s_min, float s_max, float v_min, float v_max);
+      
+      void set_lookup_table(const bool enabled);
+      
+      // dst は必要な場合だけ確保し直す
+      void operator()(const cv::Mat& src, cv::Mat& dst);
+      
+      // 1画素分の判定（SIMD版の残りの画素と検証用）
+      uint8_t operator()(const uint8_t b, const uint8_t g, const uint8_t r) const;
+      
+      const char* kernel_name() const;
+      const bool lookup_table() const;
+    };
+  }
+}
@@ -0,0 +1,9 @@
+#include "image_processor.hxx"
+
+namespace arisin
+{
+  namespace etupirka
+  {
+    std::atomic<bool> image_processor_simd_enabled(true);
+  }
+}
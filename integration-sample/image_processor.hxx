@@ -4,8 +4,101 @@
 #include <opencv2/core/core.hpp>
 #include <opencv2/imgproc/imgproc.hpp>
 
+#include <atomic>
+#include <cassert>
+#include <cstring>
+#include <vector>
+
+#include "frame-arena.hxx"
+#include "logger.hxx"
+
+// SIMD 版カーネルの種類（ビルド時にどれか1つ）
+//   x86 では OpenCV の SSE2/SSE3 版、ARM では NEON 版、それ以外の GCC/Clang ではベクトル拡張による可搬版。
+//   ARISIN_ETUPIRKA_IMAGE_PROCESSOR_PORTABLE_SIMD を定義すると x86/ARM でも可搬版を使う（比較用）。
+//   各カーネルの分岐も CV_SSE* ではなくここで決めた IMAGE_PROCESSOR_SIMD_* で選ぶ。
+#if defined(ARISIN_ETUPIRKA_IMAGE_PROCESSOR_PORTABLE_SIMD) && defined(__GNUC__)
+  #define IMAGE_PROCESSOR_SIMD_VECTOR 1
+#elif CV_SSE2
+  #define IMAGE_PROCESSOR_SIMD_SSE 1
+#elif defined(__ARM_NEON) || defined(__ARM_NEON__)
+  #define IMAGE_PROCESSOR_SIMD_NEON 1
+  #include <arm_neon.h>
+  #if defined(__linux__) && !defined(__aarch64__)
+    #include <sys/auxv.h>
+    #include <asm/hwcap.h>
+  #endif
+#elif defined(__GNUC__)
+  #define IMAGE_PROCESSOR_SIMD_VECTOR 1
+#endif
+
+namespace arisin
+{
+  namespace etupirka
+  {
+    // SIMD 版カーネルを使うかの設定（全ての翻訳単位で共有する1つの実体を image_processor.cxx に置く）
+    extern std::atomic<bool> image_processor_simd_enabled;
+  }
+}
+
 namespace
 {
+  using arisin::etupirka::filter_scratch_t;
+  
+  // 実行中の CPU が SIMD 版カーネルに対応しているか
+  inline bool simd_supported()
+  {
+#if IMAGE_PROCESSOR_SIMD_SSE
+    return cv::checkHardwareSupport(CV_CPU_SSE2);
+#elif IMAGE_PROCESSOR_SIMD_NEON && defined(__aarch64__)
+    return true;
+#elif IMAGE_PROCESSOR_SIMD_NEON && defined(__linux__)
+    // 32bit ARM では NEON の無い CPU（ARMv6 の Raspberry Pi など）もあるので実行時に確かめる
+    static const bool neon = getauxval(AT_HWCAP) & HWCAP_NEON;
+    return neon;
+#elif IMAGE_PROCESSOR_SIMD_NEON || IMAGE_PROCESSOR_SIMD_VECTOR
+    return true;
+#else
+    return false;
+#endif
+  }
+  
+  // SIMD 版を使うか（対応していない CPU では有効にしてもスカラー版になる）
+  inline bool use_simd()
+  { return arisin::etupirka::image_processor_simd_enabled && simd_supported(); }
+  
+  inline void set_simd_enabled(const bool enabled)
+  { arisin::etupirka::image_processor_simd_enabled = enabled; }
+  
+  inline const char* simd_name()
+  {
+    if(!use_simd())
+      return "scalar";
+#if IMAGE_PROCESSOR_SIMD_SSE
+    return "sse";
+#elif IMAGE_PROCESSOR_SIMD_NEON
+    return "neon";
+#else
+    return "vector";
+#endif
+  }
+  
+  // bilateral の 4 近傍分をまとめて積和する float x4
+#if IMAGE_PROCESSOR_SIMD_NEON
+  typedef float32x4_t v4f;
+  inline v4f v4f_zero() { return vdupq_n_f32(0.f); }
+  inline v4f v4f_load(const float* p) { return vld1q_f32(p); }
+  inline v4f v4f_add(const v4f a, const v4f b) { return vaddq_f32(a, b); }
+  inline v4f v4f_mul(const v4f a, const v4f b) { return vmulq_f32(a, b); }
+  inline float v4f_sum(const v4f a)
+  { return (vgetq_lane_f32(a, 0) + vgetq_lane_f32(a, 1)) + (vgetq_lane_f32(a, 2) + vgetq_lane_f32(a, 3)); }
+#elif IMAGE_PROCESSOR_SIMD_VECTOR
+  typedef float v4f __attribute__((vector_size(16)));
+  inline v4f v4f_zero() { return v4f{ 0.f, 0.f, 0.f, 0.f }; }
+  inline v4f v4f_load(const float* p) { v4f v; std::memcpy(&v, p, sizeof(v)); return v; }
+  inline v4f v4f_add(const v4f a, const v4f b) { return a + b; }
+  inline v4f v4f_mul(const v4f a, const v4f b) { return a * b; }
+  inline float v4f_sum(const v4f a) { return (a[0] + a[1]) + (a[2] + a[3]); }
+#endif
 
 #if CV_MAJOR_VERSION < 2 || ( CV_MAJOR_VERSION == 2 && CV_MINOR_VERSION < 4)
   
@@ -45,11 +138,15 @@ namespace
     {
       int i, j, cn = dest->channels(), k;
       cv::Size size = dest->size();
-      #if CV_SSE3
+      #if IMAGE_PROCESSOR_SIMD_SSE && CV_SSE3
       int CV_DECL_ALIGNED(16) buf[4];
       float CV_DECL_ALIGNED(16) bufSum[4];
       static const int CV_DECL_ALIGNED(16) bufSignMask[] = { int(0x80000000), int(0x80000000), int(0x80000000), int(0x80000000) };
-      bool haveSSE3 = cv::checkHardwareSupport(CV_CPU_SSE3);
+      bool haveSSE3 = use_simd() && cv::checkHardwareSupport(CV_CPU_SSE3);
+      #elif IMAGE_PROCESSOR_SIMD_NEON || IMAGE_PROCESSOR_SIMD_VECTOR
+      bool haveSIMD = use_simd();
+      float CV_DECL_ALIGNED(16) bufVal[3][4];
+      float CV_DECL_ALIGNED(16) bufWeight[4];
       #endif
 
       for( i = range.start; i < range.end; i++ )
@@ -64,7 +161,7 @@ namespace
             float sum = 0, wsum = 0;
             int val0 = sptr[j];
             k = 0;
-            #if CV_SSE3
+            #if IMAGE_PROCESSOR_SIMD_SSE && CV_SSE3
             if( haveSSE3 )
             {
               __m128 _val0 = _mm_set1_ps(static_cast<float>(val0));
@@ -92,6 +189,28 @@ namespace
                 wsum += bufSum[0];
               }
             }
+            #elif IMAGE_PROCESSOR_SIMD_NEON || IMAGE_PROCESSOR_SIMD_VECTOR
+            if( haveSIMD )
+            {
+              v4f _sum = v4f_zero(), _wsum = v4f_zero();
+
+              for( ; k <= maxk - 4; k += 4 )
+              {
+                for( int t = 0; t < 4; t++ )
+                {
+                  int val = sptr[j + space_ofs[k+t]];
+                  bufVal[0][t] = (float)val;
+                  bufWeight[t] = color_weight[std::abs(val - val0)];
+                }
+
+                v4f _w = v4f_mul(v4f_load(bufWeight), v4f_load(space_weight+k));
+                _sum  = v4f_add(_sum, v4f_mul(_w, v4f_load(bufVal[0])));
+                _wsum = v4f_add(_wsum, _w);
+              }
+
+              sum += v4f_sum(_sum);
+              wsum += v4f_sum(_wsum);
+            }
             #endif
             for( ; k < maxk; k++ )
             {
@@ -112,7 +231,7 @@ namespace
             float sum_b = 0, sum_g = 0, sum_r = 0, wsum = 0;
             int b0 = sptr[j], g0 = sptr[j+1], r0 = sptr[j+2];
             k = 0;
-            #if CV_SSE3
+            #if IMAGE_PROCESSOR_SIMD_SSE && CV_SSE3
             if( haveSSE3 )
             {
               const __m128i izero = _mm_setzero_si128();
@@ -163,6 +282,35 @@ namespace
                 sum_r += bufSum[3];
               }
             }
+            #elif IMAGE_PROCESSOR_SIMD_NEON || IMAGE_PROCESSOR_SIMD_VECTOR
+            if( haveSIMD )
+            {
+              v4f _b = v4f_zero(), _g = v4f_zero(), _r = v4f_zero(), _wsum = v4f_zero();
+
+              for( ; k <= maxk - 4; k += 4 )
+              {
+                for( int t = 0; t < 4; t++ )
+                {
+                  const uchar* sptr_k = sptr + j + space_ofs[k+t];
+                  int b = sptr_k[0], g = sptr_k[1], r = sptr_k[2];
+                  bufVal[0][t] = (float)b;
+                  bufVal[1][t] = (float)g;
+                  bufVal[2][t] = (float)r;
+                  bufWeight[t] = color_weight[std::abs(b - b0) + std::abs(g - g0) + std::abs(r - r0)];
+                }
+
+                v4f _w = v4f_mul(v4f_load(bufWeight), v4f_load(space_weight+k));
+                _b = v4f_add(_b, v4f_mul(_w, v4f_load(bufVal[0])));
+                _g = v4f_add(_g, v4f_mul(_w, v4f_load(bufVal[1])));
+                _r = v4f_add(_r, v4f_mul(_w, v4f_load(bufVal[2])));
+                _wsum = v4f_add(_wsum, _w);
+              }
+
+              wsum  += v4f_sum(_wsum);
+              sum_b += v4f_sum(_b);
+              sum_g += v4f_sum(_g);
+              sum_r += v4f_sum(_r);
+            }
             #endif
 
             for( ; k < maxk; k++ )
@@ -194,6 +342,7 @@ namespace
   void bilateralFilter_8u
   ( const cv::Mat& src, cv::Mat& dst, int d
   , double sigma_color, double sigma_space
+  , filter_scratch_t& scratch
   , int borderType = cv::BORDER_DEFAULT
   )
   {
@@ -202,6 +351,7 @@ namespace
     cv::Size size = src.size();
 
     CV_Assert( (src.type() == CV_8UC1 || src.type() == CV_8UC3) && src.data != dst.data );
+    dst.create( size, src.type() );
 
     if( sigma_color <= 0 )
         sigma_color = 1;
@@ -218,7 +368,7 @@ namespace
     radius = MAX(radius, 1);
     d = radius*2 + 1;
 
-    cv::Mat temp;
+    cv::Mat temp = arisin::etupirka::reserve_view( scratch.bilateral_border, cv::Size( size.width + radius*2, size.height + radius*2 ), src.type() );
     copyMakeBorder( src, temp, radius, radius, radius, radius, borderType );
 
   #if defined HAVE_IPP && (IPP_VERSION_MAJOR >= 7)
@@ -231,9 +381,12 @@ namespace
     }
   #endif
 
-    std::vector<float> _color_weight(cn*256);
-    std::vector<float> _space_weight(d*d);
-    std::vector<int> _space_ofs(d*d);
+    std::vector<float>& _color_weight = scratch.color_weight;
+    std::vector<float>& _space_weight = scratch.space_weight;
+    std::vector<int>& _space_ofs = scratch.space_ofs;
+    _color_weight.resize(cn*256);
+    _space_weight.resize(d*d);
+    _space_ofs.resize(d*d);
     float* color_weight = &_color_weight[0];
     float* space_weight = &_space_weight[0];
     int* space_ofs = &_space_ofs[0];
@@ -262,6 +415,16 @@ namespace
     parallel_for(cv::Range(0, size.height), body, dst.total()/(double)(1<<16));
   }
   
+  inline void bilateralFilter_8u
+  ( const cv::Mat& src, cv::Mat& dst, int d
+  , double sigma_color, double sigma_space
+  , int borderType = cv::BORDER_DEFAULT
+  )
+  {
+    filter_scratch_t scratch;
+    bilateralFilter_8u( src, dst, d, sigma_color, sigma_space, scratch, borderType );
+  }
+  
   typedef ushort HT;
   
   typedef struct
@@ -270,7 +433,7 @@ namespace
       HT fine[16][16];
   } Histogram;
   
-#if CV_SSE2
+#if IMAGE_PROCESSOR_SIMD_SSE
   #define MEDIAN_HAVE_SIMD 1
 
   static inline void histogram_add_simd( const HT x[16], HT y[16] )
@@ -293,6 +456,46 @@ namespace
     _mm_store_si128(ry+1, r1);
   }
 
+#elif IMAGE_PROCESSOR_SIMD_NEON
+  #define MEDIAN_HAVE_SIMD 1
+
+  static inline void histogram_add_simd( const HT x[16], HT y[16] )
+  {
+    vst1q_u16(y,   vaddq_u16(vld1q_u16(y),   vld1q_u16(x)));
+    vst1q_u16(y+8, vaddq_u16(vld1q_u16(y+8), vld1q_u16(x+8)));
+  }
+
+  static inline void histogram_sub_simd( const HT x[16], HT y[16] )
+  {
+    vst1q_u16(y,   vsubq_u16(vld1q_u16(y),   vld1q_u16(x)));
+    vst1q_u16(y+8, vsubq_u16(vld1q_u16(y+8), vld1q_u16(x+8)));
+  }
+
+#elif IMAGE_PROCESSOR_SIMD_VECTOR
+  #define MEDIAN_HAVE_SIMD 1
+
+  typedef HT v8u16 __attribute__((vector_size(16)));
+
+  static inline void histogram_add_simd( const HT x[16], HT y[16] )
+  {
+    v8u16 a[2], b[2];
+    std::memcpy(a, y, sizeof(a));
+    std::memcpy(b, x, sizeof(b));
+    a[0] += b[0];
+    a[1] += b[1];
+    std::memcpy(y, a, sizeof(a));
+  }
+
+  static inline void histogram_sub_simd( const HT x[16], HT y[16] )
+  {
+    v8u16 a[2], b[2];
+    std::memcpy(a, y, sizeof(a));
+    std::memcpy(b, x, sizeof(b));
+    a[0] -= b[0];
+    a[1] -= b[1];
+    std::memcpy(y, a, sizeof(a));
+  }
+
 #else
   #define MEDIAN_HAVE_SIMD 0
 #endif
@@ -317,7 +520,7 @@ namespace
       y[i] = (HT)(y[i] + a * x[i]);
   }
 
-  static void medianBlur_8u_O1( const cv::Mat& _src, cv::Mat& _dst, int ksize )
+  static void medianBlur_8u_O1( const cv::Mat& _src, cv::Mat& _dst, int ksize, filter_scratch_t& scratch )
   {
   /**
   * HOP is short for Histogram OPeration. This macro makes an operation \a op on
@@ -338,12 +541,14 @@ namespace
 
       int STRIPE_SIZE = std::min( _dst.cols, 512/cn );
 
-      std::vector<HT> _h_coarse(1 * 16 * (STRIPE_SIZE + 2*r) * cn + 16);
-      std::vector<HT> _h_fine(16 * 16 * (STRIPE_SIZE + 2*r) * cn + 16);
+      std::vector<HT>& _h_coarse = scratch.h_coarse;
+      std::vector<HT>& _h_fine = scratch.h_fine;
+      _h_coarse.resize(1 * 16 * (STRIPE_SIZE + 2*r) * cn + 16);
+      _h_fine.resize(16 * 16 * (STRIPE_SIZE + 2*r) * cn + 16);
       HT* h_coarse = cv::alignPtr(&_h_coarse[0], 16);
       HT* h_fine = cv::alignPtr(&_h_fine[0], 16);
   #if MEDIAN_HAVE_SIMD
-      volatile bool useSIMD = cv::checkHardwareSupport(CV_CPU_SSE2);
+      volatile bool useSIMD = use_simd();
   #endif
 
       for( int x = 0; x < _dst.cols; x += STRIPE_SIZE )
@@ -784,7 +989,7 @@ namespace
     }
   };
 
-  #if CV_SSE2
+  #if IMAGE_PROCESSOR_SIMD_SSE
 
   struct MinMaxVec8u
   {
@@ -849,6 +1054,57 @@ namespace
     }
   };
 
+  #elif IMAGE_PROCESSOR_SIMD_NEON
+
+  #define MINMAX_VEC_NEON( name, T, VT, SZ, SUFFIX ) \
+  struct name \
+  { \
+    typedef T value_type; \
+    typedef VT arg_type; \
+    enum { SIZE = SZ }; \
+    arg_type load(const T* ptr) { return vld1q_##SUFFIX(ptr); } \
+    void store(T* ptr, arg_type val) { vst1q_##SUFFIX(ptr, val); } \
+    void operator()(arg_type& a, arg_type& b) const \
+    { \
+      arg_type t = a; \
+      a = vminq_##SUFFIX(a, b); \
+      b = vmaxq_##SUFFIX(b, t); \
+    } \
+  };
+
+  MINMAX_VEC_NEON( MinMaxVec8u , uchar , uint8x16_t , 16, u8  )
+  MINMAX_VEC_NEON( MinMaxVec16u, ushort, uint16x8_t ,  8, u16 )
+  MINMAX_VEC_NEON( MinMaxVec16s, short , int16x8_t  ,  8, s16 )
+  MINMAX_VEC_NEON( MinMaxVec32f, float , float32x4_t,  4, f32 )
+
+  #undef MINMAX_VEC_NEON
+
+  #elif IMAGE_PROCESSOR_SIMD_VECTOR
+
+  // 比較結果（要素毎の全ビット 1 / 0）のマスクで選ぶ
+  template<class T, class MaskT>
+  struct MinMaxVecPortable
+  {
+    typedef T value_type;
+    typedef T arg_type __attribute__((vector_size(16)));
+    typedef MaskT mask_type __attribute__((vector_size(16)));
+    enum { SIZE = 16 / sizeof(T) };
+    arg_type load(const T* ptr) { arg_type v; std::memcpy(&v, ptr, sizeof(v)); return v; }
+    void store(T* ptr, arg_type val) { std::memcpy(ptr, &val, sizeof(val)); }
+    void operator()(arg_type& a, arg_type& b) const
+    {
+      const mask_type m = (mask_type)(a < b);
+      const mask_type ma = (mask_type)a, mb = (mask_type)b;
+      a = (arg_type)((ma & m) | (mb & ~m));
+      b = (arg_type)((mb & m) | (ma & ~m));
+    }
+  };
+
+  typedef MinMaxVecPortable<uchar , signed char> MinMaxVec8u;
+  typedef MinMaxVecPortable<ushort, short      > MinMaxVec16u;
+  typedef MinMaxVecPortable<short , short      > MinMaxVec16s;
+  typedef MinMaxVecPortable<float , int        > MinMaxVec32f;
+
   #else
 
   typedef MinMax8u MinMaxVec8u;
@@ -874,7 +1130,7 @@ namespace
       int i, j, k, cn = _src.channels();
       Op op;
       VecOp vop;
-      volatile bool useSIMD = cv::checkHardwareSupport(CV_CPU_SSE2);
+      volatile bool useSIMD = VecOp::SIZE > 1 && use_simd();
 
       if( m == 3 )
       {
@@ -1070,12 +1326,12 @@ namespace
       }
   }
   
-  void medianBlur(const cv::Mat& src0, cv::Mat& dst, int ksize)
+  void medianBlur(const cv::Mat& src0, cv::Mat& dst, int ksize, filter_scratch_t& scratch)
   {
 
     if( ksize <= 1 )
     {
-      dst = src0.clone();
+      src0.copyTo(dst);
       return;
     }
     
@@ -1084,7 +1340,9 @@ namespace
     
     
     bool useSortNet = ksize == 3 || (ksize == 5
-#if !CV_SSE2
+#if IMAGE_PROCESSOR_SIMD_SSE || IMAGE_PROCESSOR_SIMD_NEON || IMAGE_PROCESSOR_SIMD_VECTOR
+            && ( use_simd() || src0.depth() > CV_8U )
+#else
             && src0.depth() > CV_8U
 #endif
         );
@@ -1111,61 +1369,23 @@ namespace
     }
     else
     {
+      src = arisin::etupirka::reserve_view( scratch.median_border, cv::Size( src0.cols + ksize/2*2, src0.rows ), src0.type() );
       cv::copyMakeBorder( src0, src, 0, 0, ksize/2, ksize/2, cv::BORDER_REPLICATE );
 
       int cn = src0.channels();
       CV_Assert( src.depth() == CV_8U && (cn == 1 || cn == 3 || cn == 4) );
 
       double img_size_mp = (double)(src0.total())/(1 << 20);
-      if( ksize <= 3 + (img_size_mp < 1 ? 12 : img_size_mp < 4 ? 6 : 2)*(MEDIAN_HAVE_SIMD && cv::checkHardwareSupport(CV_CPU_SSE2) ? 1 : 3))
+      if( ksize <= 3 + (img_size_mp < 1 ? 12 : img_size_mp < 4 ? 6 : 2)*(MEDIAN_HAVE_SIMD && use_simd() ? 1 : 3))
         medianBlur_8u_Om( src, dst, ksize );
       else
-        medianBlur_8u_O1( src, dst, ksize );
+        medianBlur_8u_O1( src, dst, ksize, scratch );
     }
   }
   
-  // in : cv::Mat<CV_8UC3(BGR24)>
-  // out: cv::Mat<CV_8UC1(B1)>
-  cv::Mat filter_hsv_from_BGR24_to_single_channel
-  ( const cv::Mat& src
-  , const float h_min, const float h_max
-  , const float s_min, const float s_max
-  , const float v_min, const float v_max
-  )
+  inline void medianBlur(const cv::Mat& src0, cv::Mat& dst, int ksize)
   {
-    cv::Mat hsv;
-    src.convertTo(hsv, CV_32F);
-    cv::cvtColor(hsv, hsv, CV_BGR2HSV);
-    
-    cv::Mat dst(src.rows, src.cols, CV_8UC1);
-    
-    using result_element_t = uint8_t;
-    using hsv_pixel_t = cv::Point3f;
-    using src_pixel_t = cv::Point3_<uint8_t>;
-    
-          auto ihsv = reinterpret_cast<hsv_pixel_t*>(hsv.data);
-    const auto ehsv = ihsv + hsv.total();
-          auto idst = reinterpret_cast<result_element_t*>(dst.data);
-          auto isrc = reinterpret_cast<src_pixel_t*>(src.data);
-    
-    while(ihsv < ehsv)
-    {
-      const auto& p = *ihsv++;
-      
-      *idst++ = 
-        (
-          ( ( p.x >= h_min && p.x <= h_max ) || ( h_max > 360.f &&  ( p.x >= h_min || p.x <= h_max - 360.f ) ) )
-          &&  p.y >= s_min && p.y <= s_max
-          &&  p.z >= v_min && p.z <= v_max
-        )
-          ? result_element_t((uint(isrc->z) + uint(isrc->y) * 4 + uint(isrc->x) * 2) / 7)
-          //? result_element_t(float(isrc->z) * 0.298912f + float(isrc->y) * 0.586611 + float(isrc->x) * 0.114478)
-          : 0
-          ;
-      
-      ++isrc;
-    }
-    
-    return dst;
+    filter_scratch_t scratch;
+    medianBlur( src0, dst, ksize, scratch );
   }
 }
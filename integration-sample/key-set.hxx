@@ -0,0 +1,62 @@
+#pragma once
+
+#include <array>
+#include <cstdint>
+#include <algorithm>
+
+#include "logger.hxx"
+
+namespace arisin
+{
+  namespace etupirka
+  {
+    // 1フレーム分の押下キー集合
+    //   std::unordered_set の代わりに固定長配列へ重複無しで詰める。
+    //   同時押下数は高々指の数（＋キー境界での重なり）なのでハッシュより線形探索の方が速く、
+    //   フレーム毎のヒープ確保も発生しない。
+    template<size_t T_capacity>
+    class basic_key_set_t final
+    {
+    public:
+      using value_type     = int32_t;
+      using const_iterator = const value_type*;
+      static constexpr size_t capacity = T_capacity;
+      
+    private:
+      std::array<value_type, capacity> keys_;
+      size_t size_ = 0;
+      
+    public:
+      void clear() { size_ = 0; }
+      
+      // 追加できた（または既に含まれていた）場合に true
+      bool emplace(const value_type key)
+      {
+        if(contains(key))
+          return true;
+        
+        if(size_ == capacity)
+        {
+          LOG(WARNING) << "key_set is full(capacity=" << capacity << "), drop key: " << key;
+          return false;
+        }
+        
+        keys_[size_++] = key;
+        return true;
+      }
+      
+      bool contains(const value_type key) const
+      { return std::find(begin(), end(), key) != end(); }
+      
+      const_iterator begin() const { return keys_.data(); }
+      const_iterator end()   const { return keys_.data() + size_; }
+      size_t size()  const { return size_; }
+      bool   empty() const { return size_ == 0; }
+    };
+    
+    template<size_t T_capacity>
+    constexpr size_t basic_key_set_t<T_capacity>::capacity;
+    
+    using key_set_t = basic_key_set_t<32>;
+  }
+}
\ No newline at end of file
@@ -0,0 +1,122 @@
+#pragma once
+
+#include <array>
+#include <chrono>
+#include <cstdint>
+#include <algorithm>
+#include <limits>
+
+namespace arisin
+{
+  namespace etupirka
+  {
+    // 遅延の対数ヒストグラム
+    //   2の冪毎の区間を sub_buckets 等分した桶に数える（相対誤差 1/sub_buckets 以下）。
+    //   桶は固定長配列なので record でヒープ確保は起きず、件数に依らず大きさが一定。
+    //   分位点は桶の上端（最大値を超えない）で近似する。
+    class latency_histogram_t final
+    {
+    public:
+      using duration_t = std::chrono::nanoseconds;
+      
+      static constexpr size_t sub_bucket_bits = 3;
+      static constexpr size_t sub_buckets     = size_t(1) << sub_bucket_bits;
+      static constexpr size_t buckets         = (64 - sub_bucket_bits + 1) * sub_buckets;
+      
+    private:
+      std::array<uint64_t, buckets> counts_;
+      uint64_t count_;
+      uint64_t total_;
+      uint64_t min_;
+      uint64_t max_;
+      
+      static size_t bucket_of(const uint64_t ns)
+      {
+        if(ns < sub_buckets)
+          return size_t(ns);
+        
+        size_t msb = 63;
+        while(!(ns >> msb))
+          --msb;
+        
+        const auto shift = msb - sub_bucket_bits;
+        return (shift + 1) * sub_buckets + size_t(ns >> shift) - sub_buckets;
+      }
+      
+      static uint64_t lower_of(const size_t bucket)
+      {
+        if(bucket < sub_buckets)
+          return bucket;
+        
+        const auto shift = bucket / sub_buckets - 1;
+        return uint64_t(sub_buckets + bucket % sub_buckets) << shift;
+      }
+      
+      static uint64_t upper_of(const size_t bucket)
+      { return bucket < sub_buckets ? bucket + 1 : lower_of(bucket) + (uint64_t(1) << (bucket / sub_buckets - 1)); }
+      
+    public:
+      latency_histogram_t()
+      { reset(); }
+      
+      void reset()
+      {
+        counts_.fill(0);
+        count_ = 0;
+        total_ = 0;
+        min_   = std::numeric_limits<uint64_t>::max();
+        max_   = 0;
+      }
+      
+      void record(const duration_t& d)
+      {
+        const auto ns = uint64_t(std::max(d.count(), duration_t::rep(0)));
+        ++counts_[bucket_of(ns)];
+        ++count_;
+        total_ += ns;
+        min_ = std::min(min_, ns);
+        max_ = std::max(max_, ns);
+      }
+      
+      void merge(const latency_histogram_t& other)
+      {
+        for(size_t n = 0; n < buckets; ++n)
+          counts_[n] += other.counts_[n];
+        count_ += other.count_;
+        total_ += other.total_;
+        min_ = std::min(min_, other.min_);
+        max_ = std::max(max_, other.max_);
+      }
+      
+      uint64_t count() const { return count_; }
+      duration_t total() const { return duration_t(total_); }
+      duration_t min() const { return duration_t(count_ ? min_ : 0); }
+      duration_t max() const { return duration_t(max_); }
+      duration_t mean() const { return duration_t(count_ ? total_ / count_ : 0); }
+      
+      // p [%] 分位点（桶の上端で近似）
+      duration_t percentile(const double p) const
+      {
+        if(!count_)
+          return duration_t(0);
+        
+        const auto rank = std::max(uint64_t(1), uint64_t(p / 100 * count_ + .5));
+        uint64_t seen = 0;
+        for(size_t n = 0; n < buckets; ++n)
+          if((seen += counts_[n]) >= rank)
+            return duration_t(std::max(min_, std::min(max_, upper_of(n) - 1)));
+        
+        return duration_t(max_);
+      }
+      
+      // 空でない桶について f(下端, 上端, 件数) を呼ぶ（区間は [下端, 上端)）
+      template<class F>
+      void for_each_bucket(F f) const
+      {
+        for(size_t n = 0; n < buckets; ++n)
+          if(counts_[n])
+            f(duration_t(lower_of(n)), duration_t(upper_of(n)), counts_[n]);
+      }
+    };
+  }
+}
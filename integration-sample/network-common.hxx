@@ -1,56 +1,86 @@
 #pragma once
 
-#include <vector>
 #include <array>
+#include <chrono>
+#include <cstdint>
+#include <vector>
 
-#include <opencv2/core/core.hpp>
+#include "configuration.hxx"
 
 namespace arisin
 {
   namespace etupirka
   {
-    struct frame_packet_t final
+    // main- から reciever+ へフレーム対を送る分割転送の形式
+    //   top と front の JPEG をそれぞれ断片（チャンク）に分け、1断片を1データグラムで送る。
+    //   [fragment_header_t][JPEG の chunk_offset から始まる断片]
+    //   データグラムの大きさは送信側の設定（既定は IP の断片化が起きない Ethernet の MTU 相当）で、
+    //   受信側は chunk_offset で書き込み位置が分かるので送信側の設定を知らなくてよい。
+    //   数値はホストのバイト順で書く（送受信とも同じ種類の計算機である前提）。
+    namespace frame_transport
     {
-      using sequence_id_t = uint8_t;
-      
-      uint16_t real_data_size;
-      uint8_t capture_id;
-      sequence_id_t sequence_id;
-      
-      static constexpr size_t info_size = sizeof(real_data_size) - sizeof(capture_id) - sizeof(sequence_id);
-      static constexpr size_t data_size = 65506 - info_size;
-      static constexpr size_t this_size = info_size + data_size;
+      constexpr uint32_t magic   = 0x46505445; // "ETPF"
+      constexpr int jpeg_quality = 60;
       
-      uint8_t data[data_size];
+      // IPv4 の UDP で送れる最大のペイロード
+      constexpr size_t max_datagram_size = 65507;
+      // 壊れた断片による巨大な確保を防ぐための1フレームの上限
+      constexpr uint32_t max_frame_size  = 16 << 20;
       
-      inline void set_data(const cv::Mat& m, const int jpeg_quality = 60)
+      struct fragment_header_t
       {
-        std::vector<uint8_t> buffer;
-        
-        cv::imencode(".jpg", m, buffer, { CV_IMWRITE_JPEG_QUALITY, jpeg_quality });
-        
-        if(buffer.size() > data_size)
-          throw std::runtime_error("encoded frame size is over.");
-        
-        std::copy(std::begin(buffer), std::end(buffer), &data[0]);
-        real_data_size = buffer.size();
-      }
+        uint32_t magic;
+        // 送信側の起動毎の乱数（送信側の再起動で frame_id が戻っても受信側が追従できる）
+        uint32_t session;
+        // top と front で共通のフレーム対の通し番号
+        uint32_t frame_id;
+        uint32_t frame_size;
+        uint32_t chunk_offset;
+        uint16_t chunk_index;
+        uint16_t chunk_count;
+        uint8_t  camera_id;
+        uint8_t  reserved[7];
+      };
       
-      inline const uint8_t* data_begin() const { return &data[0]; }
-      inline const uint8_t* data_end() const { return data_begin() + size_t(data_size); }
+      static_assert(sizeof(fragment_header_t) == 32, "fragment_header_t must be 32 bytes");
       
-      using mutate_array_t = std::array<uint8_t, this_size>;
-      
-      inline const mutate_array_t& mutate_to_const_array() const
-      { return *reinterpret_cast<const mutate_array_t*>(this); }
+      constexpr uint8_t top_camera_id   = 0;
+      constexpr uint8_t front_camera_id = 1;
+    }
+    
+    // main から reciever へ1フレーム分のキーシグナルをまとめて送る形式
+    //   [batch_header_t][key_signal_t × signal_count]
+    //   sequence はバッチ毎に1つ進むので、受信側は欠落と順序の入れ替わりを検出できる。
+    //   古いバッチを後から適用するとキーの状態が戻ってしまうので、受信側は捨てる。
+    namespace key_transport
+    {
+      constexpr uint32_t magic = 0x4b505445; // "ETPK"
       
-      inline mutate_array_t& mutate_to_array() const
-      { return *reinterpret_cast<mutate_array_t*>(const_cast<frame_packet_t*>(this)); }
+      struct batch_header_t
+      {
+        uint32_t magic;
+        // 送信側の起動毎の乱数（frame_transport と共通）
+        uint32_t session;
+        uint32_t sequence;
+        uint16_t signal_count;
+        uint16_t reserved;
+        // キーシグナルの元になったフレームの撮影時刻（system_clock の UNIX 時刻 [ns]）
+        //   送信側で steady_clock の撮影時刻から換算するので、時刻を同期した計算機間で遅延を比べられる。
+        int64_t  capture_time;
+      };
       
-      using vector_t = std::vector<uint8_t>;
+      static_assert(sizeof(batch_header_t) == 24, "batch_header_t must be 24 bytes");
+      static_assert(sizeof(key_signal_t)   ==  8, "key_signal_t must be 8 bytes");
       
-      inline vector_t to_vector() const
-      { return vector_t(data_begin(), data_end());}
+      constexpr size_t max_signals = (frame_transport::max_datagram_size - sizeof(batch_header_t)) / sizeof(key_signal_t);
+    }
+    
+    // 受信した1フレーム分のキーシグナル
+    struct key_batch_t
+    {
+      uint32_t sequence = 0;
+      std::chrono::system_clock::time_point capture_time;
+      std::vector<key_signal_t> key_signals;
     };
   }
 }
@@ -0,0 +1,250 @@
+#include "shm-ring.hxx"
+
+#include <cerrno>
+#include <ctime>
+#include <new>
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+namespace arisin
+{
+  namespace etupirka
+  {
+    shm_ring_t::shm_ring_t(const std::string& name, const bool owner, const size_t capacity)
+      : name_(name)
+      , owner_(owner)
+      , mapping_(MAP_FAILED)
+      , mapping_size_(0)
+      , inode_(0)
+      , header_(nullptr)
+      , data_(nullptr)
+      , capacity_(0)
+      , next_attach_check_()
+      , dropped_count_(0)
+      , dropping_(false)
+    {
+      if(!owner_)
+      {
+        // 受信側がまだ居なければ push の度に（間隔を空けて）開き直す
+        if(!attach())
+          LOG(WARNING) << "shared memory ring is not ready yet (reciever not running?): " << name_;
+        return;
+      }
+      
+      uint32_t rounded = 4096;
+      while(rounded < capacity && rounded < (uint32_t(1) << 30))
+        rounded <<= 1;
+      
+      // 前回の持ち主の残骸は捨てる（送信側は inode の違いで開き直す）
+      ::shm_unlink(name_.data());
+      
+      const auto fd = ::shm_open(name_.data(), O_CREAT | O_EXCL | O_RDWR, 0600);
+      if(fd < 0)
+        LOG(FATAL) << "can not create shared memory: " << name_ << ": " << std::strerror(errno);
+      
+      const auto size = shm_ring::aligned_header() + rounded;
+      if(::ftruncate(fd, off_t(size)) != 0 || !map(fd, size))
+      {
+        ::close(fd);
+        LOG(FATAL) << "can not map shared memory: " << name_ << ": " << std::strerror(errno);
+      }
+      ::close(fd);
+      
+      header_ = new(mapping_) shm_ring::header_t;
+      header_->magic    = shm_ring::magic;
+      header_->version  = shm_ring::version;
+      header_->capacity = rounded;
+      header_->head.store(0, std::memory_order_relaxed);
+      header_->tail.store(0, std::memory_order_relaxed);
+      if(::sem_init(&header_->records, 1, 0) != 0)
+        LOG(FATAL) << "can not initialize semaphore in shared memory: " << name_ << ": " << std::strerror(errno);
+      capacity_ = rounded;
+      data_     = static_cast<uint8_t*>(mapping_) + shm_ring::aligned_header();
+      
+      // 送信側には初期化し終えてから見せる
+      header_->ready.store(1, std::memory_order_release);
+      
+      DLOG(INFO) << "shared memory ring created: " << name_ << " capacity[bytes]: " << capacity_;
+    }
+    
+    shm_ring_t::~shm_ring_t()
+    {
+      if(owner_ && header_)
+      {
+        header_->ready.store(0, std::memory_order_release);
+        ::sem_destroy(&header_->records);
+        ::shm_unlink(name_.data());
+      }
+      unmap();
+    }
+    
+    bool shm_ring_t::map(const int fd, const size_t size)
+    {
+      mapping_ = ::mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+      if(mapping_ == MAP_FAILED)
+        return false;
+      
+      mapping_size_ = size;
+      
+      struct stat s;
+      inode_ = ::fstat(fd, &s) == 0 ? s.st_ino : 0;
+      return true;
+    }
+    
+    void shm_ring_t::unmap()
+    {
+      if(mapping_ != MAP_FAILED)
+        ::munmap(mapping_, mapping_size_);
+      
+      mapping_      = MAP_FAILED;
+      mapping_size_ = 0;
+      header_       = nullptr;
+      data_         = nullptr;
+      capacity_     = 0;
+    }
+    
+    bool shm_ring_t::attach()
+    {
+      next_attach_check_ = std::chrono::steady_clock::now() + std::chrono::seconds(1);
+      
+      const auto fd = ::shm_open(name_.data(), O_RDWR, 0);
+      if(fd < 0)
+      {
+        unmap();
+        return false;
+      }
+      
+      struct stat s;
+      if(::fstat(fd, &s) != 0 || size_t(s.st_size) < shm_ring::aligned_header())
+      {
+        ::close(fd);
+        unmap();
+        return false;
+      }
+      
+      // 開いているものと同じなら何もしない
+      if(header_ && s.st_ino == inode_)
+      {
+        ::close(fd);
+        return true;
+      }
+      
+      unmap();
+      const auto mapped = map(fd, size_t(s.st_size));
+      ::close(fd);
+      if(!mapped)
+        return false;
+      
+      const auto header = static_cast<shm_ring::header_t*>(mapping_);
+      if ( !header->ready.load(std::memory_order_acquire)
+        || header->magic != shm_ring::magic
+        || header->version != shm_ring::version
+        || shm_ring::aligned_header() + header->capacity != mapping_size_
+         )
+      {
+        unmap();
+        return false;
+      }
+      
+      header_   = header;
+      capacity_ = header->capacity;
+      data_     = static_cast<uint8_t*>(mapping_) + shm_ring::aligned_header();
+      
+      DLOG(INFO) << "shared memory ring attached: " << name_ << " capacity[bytes]: " << capacity_;
+      return true;
+    }
+    
+    bool shm_ring_t::attached()
+    {
+      if(!owner_ && std::chrono::steady_clock::now() >= next_attach_check_)
+        attach();
+      
+      return header_ && header_->ready.load(std::memory_order_acquire);
+    }
+    
+    bool shm_ring_t::push(const iovec* pieces, const size_t count)
+    {
+      size_t size = 0;
+      for(size_t n = 0; n < count; ++n)
+        size += pieces[n].iov_len;
+      
+      const auto record = shm_ring::aligned_record(size);
+      
+      auto drop = [&](const char* reason)
+      {
+        ++dropped_count_;
+        if(!dropping_)
+          LOG(WARNING) << "shared memory ring drops records: " << reason << ": " << name_;
+        dropping_ = true;
+        return false;
+      };
+      
+      if(!attached())
+        return drop("reciever is not running");
+      
+      if(record > capacity_ / 2)
+        return drop("record is too large");
+      
+      auto head = header_->head.load(std::memory_order_relaxed);
+      const auto tail = header_->tail.load(std::memory_order_acquire);
+      auto offset = head & (capacity_ - 1);
+      const auto contiguous = capacity_ - offset;
+      const auto needed = record + (record > contiguous ? contiguous : 0);
+      
+      if(needed > capacity_ - (head - tail))
+        return drop("ring is full");
+      
+      if(record > contiguous)
+      {
+        std::memcpy(data_ + offset, &shm_ring::wrap_marker, sizeof(shm_ring::wrap_marker));
+        head  += contiguous;
+        offset = 0;
+      }
+      
+      const auto size32 = uint32_t(size);
+      std::memcpy(data_ + offset, &size32, sizeof(size32));
+      auto destination = data_ + offset + sizeof(size32);
+      for(size_t n = 0; n < count; ++n)
+      {
+        std::memcpy(destination, pieces[n].iov_base, pieces[n].iov_len);
+        destination += pieces[n].iov_len;
+      }
+      
+      header_->head.store(head + record, std::memory_order_release);
+      ::sem_post(&header_->records);
+      
+      dropping_ = false;
+      return true;
+    }
+    
+    bool shm_ring_t::wait(const std::chrono::nanoseconds timeout)
+    {
+#ifdef __linux__
+      // sem_timedwait は CLOCK_REALTIME の絶対時刻で期限を受け取る
+      timespec deadline;
+      ::clock_gettime(CLOCK_REALTIME, &deadline);
+      const auto ns = int64_t(deadline.tv_nsec) + timeout.count();
+      deadline.tv_sec  += time_t(ns / 1000000000);
+      deadline.tv_nsec  = long(ns % 1000000000);
+      
+      return ::sem_timedwait(&header_->records, &deadline) == 0;
+#else
+      // OS X には sem_timedwait もプロセス間の名前の無いセマフォも無い
+      LOG(FATAL) << "shared memory transport is supported on Linux only";
+      return false;
+#endif
+    }
+    
+    const std::string& shm_ring_t::name() const
+    { return name_; }
+    
+    const size_t shm_ring_t::capacity() const
+    { return capacity_; }
+    
+    const size_t shm_ring_t::dropped_count() const
+    { return dropped_count_; }
+  }
+}
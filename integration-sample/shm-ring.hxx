@@ -0,0 +1,131 @@
+#pragma once
+
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <cstring>
+#include <string>
+
+#include <semaphore.h>
+#include <sys/types.h>
+#include <sys/uio.h>
+
+#include "logger.hxx"
+
+namespace arisin
+{
+  namespace etupirka
+  {
+    // 同じ計算機の main と reciever を繋ぐ共有メモリーのリング
+    //   送信側1つ・受信側1つの可変長レコードのリングで、UDP と同じデータグラム
+    //   （key_transport のバッチと frame_transport の断片）をそのまま載せる。
+    //   [header_t][data: capacity bytes]
+    //   レコードは [uint32_t 長さ][本体] を8バイト境界に揃えて置き、末尾に収まらなければ
+    //   wrap_marker を置いて先頭から書く。head/tail は一周を考慮した通し位置。
+    //   受信側が作って持ち主となり、送信側は後から開く（受信側が作り直したら開き直す）。
+    //   満杯なら UDP と同じく送信側で捨てる。
+    namespace shm_ring
+    {
+      constexpr uint32_t magic       = 0x52505445; // "ETPR"
+      constexpr uint32_t version     = 1;
+      constexpr uint32_t wrap_marker = 0xffffffff;
+      constexpr size_t   alignment   = 64;
+      
+      static_assert(ATOMIC_INT_LOCK_FREE == 2, "shm_ring needs address-free lock-free 32 bit atomics");
+      
+      struct header_t
+      {
+        std::atomic<uint32_t> ready;
+        uint32_t magic;
+        uint32_t version;
+        uint32_t capacity;
+        // 書かれたレコード毎に1つ post する（受信側の待ち合わせ用）
+        sem_t records;
+        alignas(alignment) std::atomic<uint32_t> head;
+        alignas(alignment) std::atomic<uint32_t> tail;
+      };
+      
+      inline constexpr uint32_t aligned_record(const size_t bytes)
+      { return uint32_t((sizeof(uint32_t) + bytes + 7) / 8 * 8); }
+      
+      inline constexpr size_t aligned_header()
+      { return (sizeof(header_t) + alignment - 1) / alignment * alignment; }
+    }
+    
+    class shm_ring_t final
+    {
+      std::string name_;
+      bool   owner_;
+      void*  mapping_;
+      size_t mapping_size_;
+      ino_t  inode_;
+      shm_ring::header_t* header_;
+      uint8_t*            data_;
+      uint32_t            capacity_;
+      
+      // 送信側が受信側のリングを開き直す確認の時刻
+      std::chrono::steady_clock::time_point next_attach_check_;
+      size_t dropped_count_;
+      bool   dropping_;
+      
+      bool map(const int fd, const size_t size);
+      void unmap();
+      bool attach();
+      
+    public:
+      // owner なら capacity [bytes]（2の冪に切り上げる）で作り直し、そうでなければ受信側が作ったものを開く
+      shm_ring_t(const std::string& name, const bool owner, const size_t capacity = 0);
+      ~shm_ring_t();
+      shm_ring_t(const shm_ring_t&) = delete;
+      shm_ring_t& operator=(const shm_ring_t&) = delete;
+      
+      // 受信側のリングを開いているか（送信側は開いていなければ間隔を空けて開き直す）
+      bool attached();
+      
+      // 送信側: pieces を繋げた1レコードを書く（受信側が居ない、または満杯なら捨てて false）
+      bool push(const iovec* pieces, const size_t count);
+      
+      // 受信側: レコードが書かれるか timeout まで待つ
+      bool wait(const std::chrono::nanoseconds timeout);
+      
+      // 受信側: 溜まっているレコードを順に f(data, size) へ渡す（f が false を返したらそこで止める）
+      //   data はリングを指すので f の中でだけ有効。
+      template<class F>
+      size_t drain(F f)
+      {
+        size_t n = 0;
+        auto tail = header_->tail.load(std::memory_order_relaxed);
+        
+        while(tail != header_->head.load(std::memory_order_acquire))
+        {
+          const auto offset = tail & (capacity_ - 1);
+          uint32_t size;
+          std::memcpy(&size, data_ + offset, sizeof(size));
+          
+          if(size == shm_ring::wrap_marker)
+          {
+            tail += capacity_ - offset;
+            header_->tail.store(tail, std::memory_order_release);
+            continue;
+          }
+          
+          const bool more = f(static_cast<const uint8_t*>(data_ + offset + sizeof(size)), size_t(size));
+          
+          tail += shm_ring::aligned_record(size);
+          header_->tail.store(tail, std::memory_order_release);
+          ++n;
+          
+          if(!more)
+            break;
+        }
+        
+        return n;
+      }
+      
+      const std::string& name() const;
+      // 開いているリングの容量 [bytes]（開いていなければ 0）
+      const size_t capacity() const;
+      const size_t dropped_count() const;
+    };
+  }
+}
@@ -11,6 +11,9 @@ namespace arisin
       , camera_fov_diagonal_(conf.space_converter.camera_fov_diagonal)
       , camera_sensor_size_(conf.space_converter.camera_sensor_size)
       , image_size_(conf.space_converter.image_size)
+      , calibrated_(conf.space_converter.calibrated)
+      , top_camera_calibration_(conf.space_converter.top_camera_calibration)
+      , front_camera_calibration_(conf.space_converter.front_camera_calibration)
     {
       DLOG(INFO) << "top_camera_positon[mm]: "    << to_string(top_camera_position_);
       DLOG(INFO) << "front_camera_position[mm]: " << to_string(front_camera_position_);
@@ -18,6 +21,7 @@ namespace arisin
       DLOG(INFO) << "camera_fov_diagonal[deg]: "   << camera_fov_diagonal_;
       DLOG(INFO) << "camera_sensor_size[mm]: "    << to_string(camera_sensor_size_);
       DLOG(INFO) << "image_size[mm]: "            << to_string(image_size_);
+      DLOG(INFO) << "calibrated: "                << calibrated_;
       
       initialize();
     }
@@ -70,48 +74,185 @@ namespace arisin
       DLOG(INFO) << "camera_fov[deg]: " << to_string(camera_fov);
 #endif
       
-    }
-    
-    space_converter_t::a3d_t space_converter_t::operator()
-    ( const a2d_t& top_image_target
-    , const a2d_t& front_image_target
-    ) const
-    {
-      DLOG(INFO) << "top-image-target: "   << to_string(top_image_target);
-      DLOG(INFO) << "front-image-target: " << to_string(front_image_target);
-      
-      // top-camのターゲットのピクセル値をsnorm値に
+      // 画素の列・行毎に射線の傾き tan を求めておく
+      //   射線の偏差角度は列（X）と行（Y）のそれぞれにしか依らないので、
+      //   operator() では表を引いて補間するだけで三角関数を呼ばずに済む。
+      //
+      // ターゲットのピクセル値をsnorm値に
       //   ※snorm値: "signed normalized value"、日本語にすると符号付き正規化値
       //            : 具体的には [-1.0〜+1.0] の範囲に、ものの値を正規化（尺度を整える）した値
       //   ※unorm値: "unsigned normalized value"、日本語では符号無し正規化値
       //            : 具体的には [ 0.0〜+1.0] に範囲に、ものの値を正規化した値
       //            : 基本的にはsnormもunormも対象を最大値に対する比率で表す方法です。
-      a2d_t top_image_target_snorm
-      {{ uvalue_to_snorm(x(top_image_target), x(image_size_))
-       , uvalue_to_snorm(y(top_image_target), y(image_size_))
-      }};
-      DLOG(INFO) << "top_image_target_snorm[-]: " << to_string(top_image_target_snorm);
+      // ターゲットピクセルへの偏差角度は snorm 値 × 1/2視野角
+      //   ※カメラの視線中心からターゲットピクセルへは(左右,上下)に何度ずれた射線となるか
+      //   ※画像の外側は各辺 1/4 ずつ持つ（それより外は端の区間を延長する）
+      table_margin_ = {{ std::floor(x(image_size_) / 4), std::floor(y(image_size_) / 4) }};
+      const auto columns = size_t(std::max(float_t(1), x(image_size_) + 2 * x(table_margin_))) + 1;
+      const auto rows    = size_t(std::max(float_t(1), y(image_size_) + 2 * y(table_margin_))) + 1;
       
-      // top-camのターゲットピクセルへの偏差角度
-      //   ※top-camの視線中心からターゲットピクセルへは(左右,上下)に何度ずれた射線となるか
+      // top-cam の XZ 平面での傾き
       //   ※要注意として、ここで、カメラのスクリーンに映ったイメージは
       //     カメラがZ軸-を向いて撮影したものだから、
       //     カメラスクリーンのX軸+方向は現実世界のX軸+方向と逆転しています。
       //     なので、このカメラのスクリーン座標系から現実世界への座標系への変換に伴い、
       //     X軸の符号反転が発生します。
-      a2d_t top_image_target_deviation_angle_rad
-      {{ -x(top_image_target_snorm) * x(camera_fov_div_2_rad_)
-       ,  y(top_image_target_snorm) * y(camera_fov_div_2_rad_)
-      }};
-      DLOG(INFO) << "top_image_target_deviation_angle_rad[rad]: " << to_string(top_image_target_deviation_angle_rad);
+      top_tan_x_.resize(columns);
+      for(size_t n = 0; n < columns; ++n)
+        top_tan_x_[n] = std::tan(-uvalue_to_snorm(float_t(n) - x(table_margin_), x(image_size_)) * x(camera_fov_div_2_rad_));
       
-      // top-camとそのターゲットピクセルを通る直線の傾き角度
+      // top-cam と front-cam の YZ 平面での傾き
       //   ※top-camはX軸回転(=「Z値に対する"Y値"の変動」)を持っている
-      a2d_t top_image_target_line_angle
-      {{ x(top_image_target_deviation_angle_rad)
-       , y(top_image_target_deviation_angle_rad) + top_camera_angle_x_rad_
+      //   ※front-camはXYZの全ての軸回転量は0で真正面を向いているという前提なので偏差角度と等しい。
+      top_tan_y_.resize(rows);
+      front_tan_y_.resize(rows);
+      for(size_t n = 0; n < rows; ++n)
+      {
+        const auto deviation_angle_rad = uvalue_to_snorm(float_t(n) - y(table_margin_), y(image_size_)) * y(camera_fov_div_2_rad_);
+        top_tan_y_[n]   = std::tan(deviation_angle_rad + top_camera_angle_x_rad_);
+        front_tan_y_[n] = std::tan(deviation_angle_rad);
+      }
+      DLOG(INFO) << "ray tangent tables: " << columns << " columns, " << rows << " rows";
+      
+      // 校正値がある場合は歪み補正と回転を済ませた射線の表を作る
+      if(calibrated_)
+      {
+        top_rays_   = make_ray_table(top_camera_calibration_  , image_size_);
+        front_rays_ = make_ray_table(front_camera_calibration_, image_size_);
+        DLOG(INFO) << "ray tables: " << top_rays_.columns << " columns, " << top_rays_.rows << " rows (step " << ray_table_step << " px)";
+      }
+    }
+    
+    space_converter_t::ray_table_t space_converter_t::make_ray_table(const camera_calibration_t& calibration, const a2d_t& image_size)
+    {
+      // 格子点の計算は一度きりなので倍精度で行う
+      const double fx = x(calibration.focal_length);
+      const double fy = y(calibration.focal_length);
+      const double cx = x(calibration.principal_point);
+      const double cy = y(calibration.principal_point);
+      const double k1 = calibration.distortion[0];
+      const double k2 = calibration.distortion[1];
+      const double p1 = calibration.distortion[2];
+      const double p2 = calibration.distortion[3];
+      const double k3 = calibration.distortion[4];
+      
+      // 回転ベクトルから世界座標→カメラ座標の回転行列 R を作る（Rodrigues の式）
+      //   カメラ座標の向き v の世界座標での向きは R^T v
+      const double rx = x(calibration.rotation), ry = y(calibration.rotation), rz = z(calibration.rotation);
+      const double theta = std::sqrt(rx * rx + ry * ry + rz * rz);
+      std::array<double, 9> r = {{ 1, 0, 0, 0, 1, 0, 0, 0, 1 }};
+      if(theta > 0)
+      {
+        const double ux = rx / theta, uy = ry / theta, uz = rz / theta;
+        const double c = std::cos(theta), s = std::sin(theta), t = 1 - c;
+        r = {{ t * ux * ux + c     , t * ux * uy - s * uz, t * ux * uz + s * uy
+             , t * ux * uy + s * uz, t * uy * uy + c     , t * uy * uz - s * ux
+             , t * ux * uz - s * uy, t * uy * uz + s * ux, t * uz * uz + c
+             }};
+      }
+      
+      ray_table_t table;
+      table.margin  = {{ std::floor(x(image_size) / 4), std::floor(y(image_size) / 4) }};
+      table.columns = size_t(std::ceil((x(image_size) + 2 * x(table.margin)) / ray_table_step)) + 1;
+      table.rows    = size_t(std::ceil((y(image_size) + 2 * y(table.margin)) / ray_table_step)) + 1;
+      table.x.resize(table.columns * table.rows);
+      table.y.resize(table.columns * table.rows);
+      table.z.resize(table.columns * table.rows);
+      
+      for(size_t row = 0; row < table.rows; ++row)
+        for(size_t column = 0; column < table.columns; ++column)
+        {
+          // 歪んだ正規化座標
+          const double xd = (double(column) * ray_table_step - x(table.margin) - cx) / fx;
+          const double yd = (double(row)    * ray_table_step - y(table.margin) - cy) / fy;
+          
+          // 歪みの逆変換は閉じた式が無いので不動点反復で解く（cv::undistortPoints と同じ方法）
+          double xu = xd, yu = yd;
+          for(int iteration = 0; iteration < 20; ++iteration)
+          {
+            const double r2 = xu * xu + yu * yu;
+            const double radial = 1 + ((k3 * r2 + k2) * r2 + k1) * r2;
+            const double dx = 2 * p1 * xu * yu + p2 * (r2 + 2 * xu * xu);
+            const double dy = p1 * (r2 + 2 * yu * yu) + 2 * p2 * xu * yu;
+            xu = (xd - dx) / radial;
+            yu = (yd - dy) / radial;
+          }
+          
+          // カメラ座標の射線 (xu, yu, 1) を世界座標へ回す
+          const auto n = row * table.columns + column;
+          table.x[n] = float_t(r[0] * xu + r[3] * yu + r[6]);
+          table.y[n] = float_t(r[1] * xu + r[4] * yu + r[7]);
+          table.z[n] = float_t(r[2] * xu + r[5] * yu + r[8]);
+        }
+      
+      return table;
+    }
+    
+    space_converter_t::a3d_t space_converter_t::ray(const ray_table_t& table, const a2d_t& image_target)
+    {
+      // 表の外は端の区間を延長する
+      const auto gx = (x(image_target) + x(table.margin)) / ray_table_step;
+      const auto gy = (y(image_target) + y(table.margin)) / ray_table_step;
+      const auto column = std::min(std::max(std::ptrdiff_t(std::floor(gx)), std::ptrdiff_t(0)), std::ptrdiff_t(table.columns) - 2);
+      const auto row    = std::min(std::max(std::ptrdiff_t(std::floor(gy)), std::ptrdiff_t(0)), std::ptrdiff_t(table.rows)    - 2);
+      const auto tx = gx - float_t(column);
+      const auto ty = gy - float_t(row);
+      
+      const auto n00 = size_t(row) * table.columns + size_t(column);
+      const auto n10 = n00 + table.columns;
+      const auto bilinear = [&](const std::vector<float_t>& v)
+      {
+        const auto top    = v[n00] + (v[n00 + 1] - v[n00]) * tx;
+        const auto bottom = v[n10] + (v[n10 + 1] - v[n10]) * tx;
+        return top + (bottom - top) * ty;
+      };
+      
+      return {{ bilinear(table.x), bilinear(table.y), bilinear(table.z) }};
+    }
+    
+    space_converter_t::a3d_t space_converter_t::triangulate(const a3d_t& top_position, const a3d_t& top_ray, const a3d_t& front_position, const a3d_t& front_ray)
+    {
+      // 2本の直線 P(s) = top_position + s top_ray, Q(t) = front_position + t front_ray の
+      // 最も近づく s, t を求め、P(s) と Q(t) の中点を交点とする
+      //   （校正誤差と検出誤差で2本の射線は一般に交わらない）
+      const auto dot = [](const a3d_t& a, const a3d_t& b){ return x(a) * x(b) + y(a) * y(b) + z(a) * z(b); };
+      const a3d_t w {{ x(top_position) - x(front_position), y(top_position) - y(front_position), z(top_position) - z(front_position) }};
+      
+      const auto a = dot(top_ray, top_ray);
+      const auto b = dot(top_ray, front_ray);
+      const auto c = dot(front_ray, front_ray);
+      const auto d = dot(top_ray, w);
+      const auto e = dot(front_ray, w);
+      const auto denominator = a * c - b * b;
+      
+      const auto s = (b * e - c * d) / denominator;
+      const auto t = (a * e - b * d) / denominator;
+      
+      return
+      {{ ( x(top_position) + s * x(top_ray) + x(front_position) + t * x(front_ray) ) / 2
+       , ( y(top_position) + s * y(top_ray) + y(front_position) + t * y(front_ray) ) / 2
+       , ( z(top_position) + s * z(top_ray) + z(front_position) + t * z(front_ray) ) / 2
       }};
-      DLOG(INFO) << "top_image_target_line_angle[rad]: " << to_string(top_image_target_line_angle);
+    }
+    
+    space_converter_t::float_t space_converter_t::interpolate(const std::vector<float_t>& table, const float_t v)
+    {
+      // 表の外は端の区間を延長する
+      const auto last = std::ptrdiff_t(table.size()) - 2;
+      const auto n = std::min(std::max(std::ptrdiff_t(std::floor(v)), std::ptrdiff_t(0)), last);
+      return table[n] + (table[n + 1] - table[n]) * (v - float_t(n));
+    }
+    
+    space_converter_t::a3d_t space_converter_t::operator()
+    ( const a2d_t& top_image_target
+    , const a2d_t& front_image_target
+    ) const
+    {
+      DLOG(INFO) << "top-image-target: "   << to_string(top_image_target);
+      DLOG(INFO) << "front-image-target: " << to_string(front_image_target);
+      
+      if(calibrated_)
+        return triangulate(top_camera_position_, ray(top_rays_, top_image_target), front_camera_position_, ray(front_rays_, front_image_target));
       
       // YZ平面(真横から見た平面図)における
       // top-camとそのスクリーンの中心を通る直線の式 y = f(z)
@@ -120,8 +261,9 @@ namespace arisin
       // y = a * z + b;
       //
       // a = dy/dz = tan(θ)
-      //   θ = y(top_image_target_line_angle)
-      const auto top_yz_a = std::tan(y(top_image_target_line_angle));
+      //   θ はtop-camとそのターゲットピクセルを通る直線のYZ平面での傾き角度
+      //   ※tan(θ) は initialize で作った行毎の表から引く
+      const auto top_yz_a = interpolate(top_tan_y_, y(top_image_target) + y(table_margin_));
       // b = y - a * z
       //  この直線の確実な通過点であるtop-camの位置座標(x,y,z)を代入
       // b = y0 - a * z0
@@ -130,34 +272,10 @@ namespace arisin
       const auto top_yz_b = y(top_camera_position_) - top_yz_a * z(top_camera_position_);
       DLOG(INFO) << "top YZ-plane line function [mm]: y = f(z) = " << top_yz_a << " z + " << top_yz_b;
       
-      // front-camのターゲットのピクセル値をsnorm値に
-      a2d_t front_image_target_snorm
-      {{ uvalue_to_snorm(x(front_image_target), x(image_size_))
-       , uvalue_to_snorm(y(front_image_target), y(image_size_))
-      }};
-      DLOG(INFO) << "front_image_target_snorm [-]: " << to_string(front_image_target_snorm);
-      
-      // front-camのターゲットピクセルへの偏差角度
-      //   ※front-camの視線中心からターゲットピクセルへは(左右,上下)に何度ずれた射線となるか
-      a2d_t front_image_target_deviation_angle_rad
-      {{ x(front_image_target_snorm) * x(camera_fov_div_2_rad_)
-       , y(front_image_target_snorm) * y(camera_fov_div_2_rad_)
-      }};
-      DLOG(INFO) << "front_image_target [rad]: " << to_string(front_image_target_deviation_angle_rad);
-      
-      // top-camとそのターゲットピクセルを通る直線の傾き角度
-      //   ※front-camはXYZの全ての軸回転量は0で真正面を向いている
-      //     という前提なので偏差角度と等しい。
-      a2d_t front_image_target_line_angle
-      {{ x(front_image_target_deviation_angle_rad)
-       , y(front_image_target_deviation_angle_rad)
-      }};
-      DLOG(INFO) << "front_image_target_line_angle [rad]: " << to_string(top_image_target_line_angle);
-      
       // YZ平面(真横から見た平面図)における
       // front-camとそのスクリーンの中心を通る直線の式 y = f(z)
       //   ※top-camと同様に傾き a と 切片 b を求める
-      const auto front_yz_a = std::tan(y(front_image_target_line_angle));
+      const auto front_yz_a = interpolate(front_tan_y_, y(front_image_target) + y(table_margin_));
       const auto front_yz_b = y(front_camera_position_) - front_yz_a * z(front_camera_position_);
       DLOG(INFO) << "front YZ-plane line function [mm]: y = f(z) = " << front_yz_a << " z + " << front_yz_b;
       
@@ -194,8 +312,9 @@ namespace arisin
         // 一次方程式の傾きaと切片bの標準形より
         // x = a * z + b
         //   a = dx/dy = tan(φ) ※φ（読み: ふぁい、θはさっきもう使ったから次の文字、というだけ）
-        //   φ = x(top_image_target_line_angle)
-        const auto top_xz_a = std::tan(x(top_image_target_line_angle));
+        //   φ はtop-camとそのターゲットピクセルを通る直線のXZ平面での傾き角度
+        //   ※tan(φ) は initialize で作った列毎の表から引く
+        const auto top_xz_a = interpolate(top_tan_x_, x(top_image_target) + x(table_margin_));
         //   b = x - a * z
         //     top-cam の位置座標(x,y,z)より x と z を代入して
         //   b = x(top_camera_position) - top_xy_a * z(top_camera_position)
@@ -221,5 +340,70 @@ namespace arisin
       return std::move(cross_point);
     }
     
+    void space_converter_t::operator()
+    ( const targets_t& top_image_targets
+    , const targets_t& front_image_targets
+    , points_t& points
+    ) const
+    {
+      const auto n = std::min(top_image_targets.size(), front_image_targets.size());
+      points.resize(n);
+      
+      if(!n)
+        return;
+      
+      if(calibrated_)
+      {
+        for(size_t i = 0; i < n; ++i)
+        {
+          const auto point = triangulate
+          ( top_camera_position_  , ray(top_rays_  , {{ top_image_targets.x[i]  , top_image_targets.y[i]   }})
+          , front_camera_position_, ray(front_rays_, {{ front_image_targets.x[i], front_image_targets.y[i] }})
+          );
+          points.x[i] = x(point);
+          points.y[i] = y(point);
+          points.z[i] = z(point);
+        }
+        return;
+      }
+      
+      // 各組の射線の傾きを表から引き、出力の配列へ一旦置く
+      //   x: top-cam の XZ 平面での傾き, y: top-cam の YZ 平面での傾き, z: front-cam の YZ 平面での傾き
+      float_t* const xs = points.x.data();
+      float_t* const ys = points.y.data();
+      float_t* const zs = points.z.data();
+      
+      for(size_t i = 0; i < n; ++i)
+      {
+        xs[i] = interpolate(top_tan_x_  , top_image_targets.x[i]   + x(table_margin_));
+        ys[i] = interpolate(top_tan_y_  , top_image_targets.y[i]   + y(table_margin_));
+        zs[i] = interpolate(front_tan_y_, front_image_targets.y[i] + y(table_margin_));
+      }
+      
+      // 以下は1組毎の operator() と同じ式（演算の順序も同じなので結果も一致する）
+      const auto top_x  = x(top_camera_position_);
+      const auto top_y  = y(top_camera_position_);
+      const auto top_z  = z(top_camera_position_);
+      const auto front_y = y(front_camera_position_);
+      const auto front_z = z(front_camera_position_);
+      
+      for(size_t i = 0; i < n; ++i)
+      {
+        const auto top_xz_a   = xs[i];
+        const auto top_yz_a   = ys[i];
+        const auto front_yz_a = zs[i];
+        
+        const auto top_yz_b   = top_y   - top_yz_a   * top_z;
+        const auto front_yz_b = front_y - front_yz_a * front_z;
+        
+        const auto cross_point_y = top_yz_a * ( (front_yz_b - top_yz_b) / (top_yz_a - front_yz_a) ) + top_yz_b;
+        const auto cross_point_z = (cross_point_y - top_yz_b) / top_yz_a;
+        
+        xs[i] = top_xz_a * cross_point_z + (top_x - top_xz_a * top_z);
+        ys[i] = cross_point_y;
+        zs[i] = cross_point_z;
+      }
+    }
+    
   }
 }
\ No newline at end of file
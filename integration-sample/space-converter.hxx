@@ -5,6 +5,7 @@
 #include <iostream>
 #include <memory>
 #include <typeinfo>
+#include <vector>
 #include <boost/math/constants/constants.hpp>
 #include "configuration.hxx"
 #include "logger.hxx"
@@ -19,6 +20,26 @@ namespace arisin
       using float_t = float;
       using a3d_t = std::array<float_t, 3>;
       using a2d_t = std::array<float_t, 2>;
+      using camera_calibration_t = configuration_t::space_converter_configuration_t::camera_calibration_t;
+      
+      // 複数の点を成分毎の配列（structure of arrays）で受け渡す
+      struct targets_t
+      {
+        std::vector<float_t> x, y;
+        
+        void clear() { x.clear(); y.clear(); }
+        void push_back(const a2d_t& v) { x.push_back(v[0]); y.push_back(v[1]); }
+        size_t size() const { return x.size(); }
+      };
+      
+      struct points_t
+      {
+        std::vector<float_t> x, y, z;
+        
+        void resize(const size_t n) { x.resize(n); y.resize(n); z.resize(n); }
+        size_t size() const { return x.size(); }
+        a3d_t operator[](const size_t n) const { return {{ x[n], y[n], z[n] }}; }
+      };
     
     private:
       template<class T> static constexpr typename T::value_type x(const T& a) { return a[0]; }
@@ -62,12 +83,52 @@ namespace arisin
       a2d_t camera_fov_div_2_rad_;
       float_t top_camera_angle_x_rad_;
       
+      // 画素の列・行毎の射線の傾き tan（initialize で作る）
+      //   [n] は画素座標 n - table_margin_ の値で、小数の座標は隣り合う2つを線形補間する。
+      //   円の下端のように画像の外に出る座標もあるので、画像の外側 table_margin_ 画素まで持つ。
+      //   top_tan_x_   : top-cam の XZ 平面での傾き（列毎）
+      //   top_tan_y_   : top-cam の YZ 平面での傾き（行毎; X軸回転を含む）
+      //   front_tan_y_ : front-cam の YZ 平面での傾き（行毎）
+      std::vector<float_t> top_tan_x_;
+      std::vector<float_t> top_tan_y_;
+      std::vector<float_t> front_tan_y_;
+      a2d_t table_margin_;
+      
+      static float_t interpolate(const std::vector<float_t>& table, const float_t v);
+      
+      // 校正済みのカメラの画素から世界座標系の射線の向きへの表（initialize で作る）
+      //   画像の外側 margin 画素までを ray_table_step 画素間隔の格子で持ち、間は双線形補間する。
+      //   歪み補正（反復計算）と回転は格子点毎に済ませてあるので、フレーム毎の計算は補間だけになる。
+      static constexpr int ray_table_step = 4;
+      
+      struct ray_table_t
+      {
+        size_t columns, rows;
+        a2d_t margin;
+        std::vector<float_t> x, y, z;
+      };
+      
+      const bool calibrated_;
+      const camera_calibration_t top_camera_calibration_;
+      const camera_calibration_t front_camera_calibration_;
+      ray_table_t top_rays_;
+      ray_table_t front_rays_;
+      
+      static ray_table_t make_ray_table(const camera_calibration_t& calibration, const a2d_t& image_size);
+      static a3d_t ray(const ray_table_t& table, const a2d_t& image_target);
+      // 2本の射線の最も近づく2点の中点
+      static a3d_t triangulate(const a3d_t& top_position, const a3d_t& top_ray, const a3d_t& front_position, const a3d_t& front_ray);
+      
     public:
       space_converter_t( const configuration_t& conf);
       
       void initialize();
       
       a3d_t operator()(const a2d_t& top_image_target, const a2d_t& front_image_target) const;
+      
+      // top_image_targets[n] と front_image_targets[n] の組をまとめて変換し points[n] に返す
+      //   表引きの後は分岐の無い成分毎のループなので、コンパイラーがベクトル化できる。
+      void operator()(const targets_t& top_image_targets, const targets_t& front_image_targets, points_t& points) const;
     };
   }
 }
\ No newline at end of file
@@ -1,81 +1,328 @@
 #include "udp-reciever.hxx"
 
+#include <algorithm>
+#include <cstring>
+
 namespace arisin
 {
   namespace etupirka
   {
     udp_reciever_t::udp_reciever_t(const configuration_t& conf)
-      : socket(io_service, boost::asio::ip::udp::endpoint(boost::asio::ip::udp::v4(), conf.udp_sender.port))
+      : socket(io_service)
       , port_(conf.udp_reciever.port)
+      , reassembler_(size_t(std::max(conf.udp_reciever.max_inflight_frames, 1)), std::chrono::milliseconds(conf.udp_reciever.frame_timeout_ms))
+      , datagram_(frame_transport::max_datagram_size)
+      , has_key_session_(false)
+      , key_session_(0)
+      , next_key_sequence_(0)
+      , lost_key_batches_(0)
+      , stale_key_batches_(0)
+      , latency_report_interval_(std::max(conf.udp_reciever.latency_report_interval_s, 0))
     {
+      if(conf.udp_sender.transport == "shm")
+      {
+        // 共有メモリーだけを使うので UDP のポートは開かない（使用中のポートに妨げられない）
+        shm_.reset(new shm_ring_t(conf.udp_sender.shm_name, true, size_t(std::max(conf.udp_sender.shm_size_mb, 1)) << 20));
+        DLOG(INFO) << "transport: shm(" << conf.udp_sender.shm_name << ")";
+        return;
+      }
+      
+      if(conf.udp_sender.transport != "udp")
+        LOG(FATAL) << "unknown udp_sender.transport: " << conf.udp_sender.transport;
+      
+      socket.open(boost::asio::ip::udp::v4());
+      socket.bind(boost::asio::ip::udp::endpoint(boost::asio::ip::udp::v4(), conf.udp_sender.port));
       DLOG(INFO) << "socket is initialized";
       DLOG(INFO) << "port(" << port_ << ")" ;
+      
+      // フレーム対の断片はまとまって届くので受信バッファを広げておく（上限はカーネルの rmem_max）
+      boost::system::error_code error;
+      socket.set_option(boost::asio::socket_base::receive_buffer_size(4 << 20), error);
+      if(error)
+        LOG(WARNING) << "can not set receive_buffer_size: " << error.message();
     }
     
-    key_signal_t udp_reciever_t::operator()()
+    bool udp_reciever_t::accept_key_batch(const uint8_t* data, const size_t len)
     {
-      using boost::asio::ip::udp;
+      key_transport::batch_header_t header;
       
-      key_signal_t           key_signal;
+      if(len < sizeof(header))
+        return false;
       
-      using buffer_t = boost::array<decltype(key_signal.char_array)::value_type, sizeof(key_signal.char_array) / sizeof(decltype(key_signal.char_array)::value_type)>;
-      buffer_t& buffer( *reinterpret_cast<buffer_t*>( key_signal.char_array.data()) );
+      std::memcpy(&header, data, sizeof(header));
       
-      udp::endpoint          endpoint;
-      boost::system::error_code error;
+      if(header.magic != key_transport::magic || len != sizeof(header) + header.signal_count * sizeof(key_signal_t))
+      {
+        LOG(WARNING) << "recieved broken key batch; len(" << len << ")";
+        return false;
+      }
       
-      DLOG(INFO) << "begin wait for socket_recieve_from";
+      if(!has_key_session_ || header.session != key_session_)
+      {
+        // 送信側が（再）起動した
+        DLOG(INFO) << "new key session: " << header.session;
+        has_key_session_   = true;
+        key_session_       = header.session;
+        next_key_sequence_ = header.sequence;
+      }
       
-      auto len = socket.receive_from(boost::asio::buffer(buffer), endpoint, 0, error);
+      // 通し番号の一周を考慮して比べる
+      const auto gap = int32_t(header.sequence - next_key_sequence_);
+      
+      if(gap < 0)
+      {
+        ++stale_key_batches_;
+        LOG(WARNING) << "drop stale key batch(" << header.sequence << "); expected(" << next_key_sequence_ << ") stale(" << stale_key_batches_ << ")";
+        return false;
+      }
       
-      DLOG(INFO) << "result of socket.recieve_from: len(" << len << ") endpoint(" << endpoint.address().to_string() << ") error(" << error << ")";
+      if(gap > 0)
+      {
+        lost_key_batches_ += size_t(gap);
+        LOG(WARNING) << "lost " << gap << " key batches before(" << header.sequence << ") lost(" << lost_key_batches_ << ")";
+      }
       
-      if(error && error != boost::asio::error::message_size)
-        throw boost::system::system_error(error);
+      next_key_sequence_ = header.sequence + 1;
       
-      DLOG(INFO) << "recieve key_signal code state: " << key_signal.code_state.code << ", " << key_signal.code_state.state;
+      key_batch_.sequence     = header.sequence;
+      key_batch_.capture_time = std::chrono::system_clock::time_point(std::chrono::duration_cast<std::chrono::system_clock::duration>(std::chrono::nanoseconds(header.capture_time)));
+      key_batch_.key_signals.resize(header.signal_count);
+      std::memcpy(key_batch_.key_signals.data(), data + sizeof(header), header.signal_count * sizeof(key_signal_t));
       
-      return key_signal;
+      return true;
     }
     
-    camera_capture_t::captured_frames_t udp_reciever_t::recieve_captured_frames()
+    const key_batch_t& udp_reciever_t::operator()()
     {
-      LOG(FATAL) << "NOT IMPLEMENTED";
-      
       using boost::asio::ip::udp;
       
-      camera_capture_t::captured_frames_t captured_frames;
-      frame_packet_t frame_packets[2];
-      
-      do
+      // リングに溜まっているものから順に1つずつ返す
+      while(shm_)
       {
-        frame_packet_t frame_packet;
+        bool accepted = false;
+        shm_->drain([&](const uint8_t* data, const size_t size){ return !(accepted = accept_key_batch(data, size)); });
         
-        auto& buffer( frame_packet.mutate_to_array() );
+        if(accepted)
+          return key_batch_;
         
+        shm_->wait(std::chrono::milliseconds(100));
+      }
+      
+      while(true)
+      {
         udp::endpoint          endpoint;
         boost::system::error_code error;
         
         DLOG(INFO) << "begin wait for socket_recieve_from";
         
-        auto len = socket.receive_from(boost::asio::buffer(buffer), endpoint, 0, error);
+        const auto len = socket.receive_from(boost::asio::buffer(datagram_), endpoint, 0, error);
         
         DLOG(INFO) << "result of socket.recieve_from: len(" << len << ") endpoint(" << endpoint.address().to_string() << ") error(" << error << ")";
         
-        if(error && error != boost::asio::error::message_size)
+        if(error == boost::asio::error::message_size)
+          continue;
+        
+        if(error)
           throw boost::system::system_error(error);
         
-        frame_packets[frame_packet.capture_id] = std::move(frame_packet);
+        if(accept_key_batch(datagram_.data(), len))
+          break;
       }
-      while(frame_packets[0].real_data_size > 0 && frame_packets[0].sequence_id == frame_packets[1].sequence_id);
       
-      captured_frames.top   = cv::imdecode(cv::Mat(frame_packets[0].to_vector(), true), CV_LOAD_IMAGE_COLOR);
-      captured_frames.front = cv::imdecode(cv::Mat(frame_packets[1].to_vector(), true), CV_LOAD_IMAGE_COLOR);
+      DLOG(INFO) << "recieve key batch(" << key_batch_.sequence << ") signals: " << key_batch_.key_signals.size();
+      
+      return key_batch_;
+    }
+    
+    void udp_reciever_t::report_key_latency(const char* label, const latency_histogram_t& latency) const
+    {
+      const auto us = [](const latency_histogram_t::duration_t& d){ return std::chrono::duration<double, std::micro>(d).count(); };
+      LOG(INFO) << label << " key latency[us]: batches(" << latency.count()
+                << ") mean(" << us(latency.mean())
+                << ") p50("  << us(latency.percentile(50))
+                << ") p99("  << us(latency.percentile(99))
+                << ") max("  << us(latency.max())
+                << ") lost(" << lost_key_batches_
+                << ") stale(" << stale_key_batches_ << ")";
+    }
+    
+    void udp_reciever_t::run_key_batches(const key_batch_handler_t& handler, const std::function<bool()>& is_running)
+    {
+      // 受信を待つ間に止める要求と遅延の報告を見回る間隔
+      constexpr auto tick = std::chrono::milliseconds(100);
+      
+      boost::asio::steady_timer timer(io_service);
+      latency_histogram_t window_latency;
+      auto next_report = std::chrono::steady_clock::now() + latency_report_interval_;
+      
+      const auto dispatch = [&](const uint8_t* data, const size_t len)
+      {
+        if(!accept_key_batch(data, len))
+          return;
+        
+        handler(key_batch_);
+        
+        // 時刻を同期していない計算機間では負になり得る（その場合は 0 として数える）
+        const auto latency = std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::system_clock::now() - key_batch_.capture_time);
+        key_latency_.record(latency);
+        window_latency.record(latency);
+      };
+      
+      const auto report_if_due = [&]()
+      {
+        if(latency_report_interval_.count() && std::chrono::steady_clock::now() >= next_report)
+        {
+          report_key_latency("recent", window_latency);
+          window_latency.reset();
+          next_report += latency_report_interval_;
+        }
+      };
+      
+      std::function<void()> receive;
+      receive = [&]()
+      {
+        socket.async_receive_from(boost::asio::buffer(datagram_), remote_endpoint_, [&](const boost::system::error_code& error, const size_t len)
+        {
+          if(error == boost::asio::error::operation_aborted)
+            return;
+          
+          if(error && error != boost::asio::error::message_size)
+            throw boost::system::system_error(error);
+          
+          if(!error)
+            dispatch(datagram_.data(), len);
+          
+          // 溜まっているデータグラムは次の待ちを挟まずに全て捌く
+          while(true)
+          {
+            boost::system::error_code drain_error;
+            const auto n = socket.receive_from(boost::asio::buffer(datagram_), remote_endpoint_, 0, drain_error);
+            
+            if(drain_error == boost::asio::error::would_block)
+              break;
+            
+            if(drain_error == boost::asio::error::message_size)
+              continue;
+            
+            if(drain_error)
+              throw boost::system::system_error(drain_error);
+            
+            dispatch(datagram_.data(), n);
+          }
+          
+          receive();
+        });
+      };
+      
+      std::function<void()> wait_tick;
+      wait_tick = [&]()
+      {
+        timer.expires_from_now(tick);
+        timer.async_wait([&](const boost::system::error_code& error)
+        {
+          if(error == boost::asio::error::operation_aborted)
+            return;
+          
+          if(!is_running())
+          {
+            socket.cancel();
+            return;
+          }
+          
+          report_if_due();
+          wait_tick();
+        });
+      };
+      
+      if(shm_)
+      {
+        // 共有メモリーではリングへの書き込みを待ち、溜まっているものを全て捌く
+        while(is_running())
+        {
+          shm_->wait(tick);
+          shm_->drain([&](const uint8_t* data, const size_t size){ dispatch(data, size); return true; });
+          report_if_due();
+        }
+      }
+      else
+      {
+        // 溜まった分を捌く同期の受信は待たずに would_block で戻るようにする
+        socket.non_blocking(true);
+        
+        io_service.reset();
+        receive();
+        wait_tick();
+        io_service.run();
+        
+        socket.non_blocking(false);
+      }
+      
+      report_key_latency("total", key_latency_);
+    }
+    
+    camera_capture_t::captured_frames_t udp_reciever_t::recieve_captured_frames()
+    {
+      using boost::asio::ip::udp;
+      
+      camera_capture_t::captured_frames_t captured_frames;
+      
+      DLOG(INFO) << "begin wait for fragments";
+      
+      // リングに溜まっている断片は全て組み立てに回し、揃った中で最新のフレーム対を返す
+      for(bool completed = false; shm_ && !completed; )
+      {
+        shm_->drain([&](const uint8_t* data, const size_t size)
+        {
+          completed |= reassembler_(data, size, frame_reassembler_t::steady_clock_t::now(), encoded_frames_);
+          return true;
+        });
+        
+        if(!completed)
+          shm_->wait(std::chrono::milliseconds(100));
+      }
+      
+      while(!shm_)
+      {
+        udp::endpoint          endpoint;
+        boost::system::error_code error;
+        
+        const auto len = socket.receive_from(boost::asio::buffer(datagram_), endpoint, 0, error);
+        
+        if(error == boost::asio::error::message_size)
+          continue;
+        
+        if(error)
+          throw boost::system::system_error(error);
+        
+        if(reassembler_(datagram_.data(), len, frame_reassembler_t::steady_clock_t::now(), encoded_frames_))
+          break;
+      }
+      
+      DLOG(INFO) << "frames reassembled; completed(" << reassembler_.completed_count()
+                 << ") expired(" << reassembler_.expired_count()
+                 << ") evicted(" << reassembler_.evicted_count()
+                 << ") late(" << reassembler_.late_count()
+                 << ") invalid(" << reassembler_.invalid_count() << ")";
+      
+      // 受信バッファを指すヘッダーから直接デコードする
+      auto& top   = encoded_frames_[frame_transport::top_camera_id];
+      auto& front = encoded_frames_[frame_transport::front_camera_id];
+      captured_frames.top   = cv::imdecode(cv::Mat(1, int(top.size())  , CV_8UC1, top.data())  , CV_LOAD_IMAGE_COLOR);
+      captured_frames.front = cv::imdecode(cv::Mat(1, int(front.size()), CV_8UC1, front.data()), CV_LOAD_IMAGE_COLOR);
       
       return captured_frames;
     }
     
     const int udp_reciever_t::port() const
     { return port_; }
+    
+    const latency_histogram_t& udp_reciever_t::key_latency() const
+    { return key_latency_; }
+    
+    const size_t udp_reciever_t::lost_key_batches() const
+    { return lost_key_batches_; }
+    
+    const size_t udp_reciever_t::stale_key_batches() const
+    { return stale_key_batches_; }
   }
 }
\ No newline at end of file
@@ -1,6 +1,10 @@
 #pragma once
 
+#include <chrono>
+#include <functional>
+#include <memory>
 #include <string>
+#include <vector>
 
 #include <boost/array.hpp>
 #include <boost/asio.hpp>
@@ -9,7 +13,10 @@
 #include "logger.hxx"
 
 #include "camera-capture.hxx"
+#include "frame-reassembler.hxx"
+#include "latency-histogram.hxx"
 #include "network-common.hxx"
+#include "shm-ring.hxx"
 
 namespace arisin
 {
@@ -20,12 +27,49 @@ namespace arisin
       boost::asio::io_service      io_service;
       boost::asio::ip::udp::socket socket;
       int port_;
+      
+      // reciever+ のフレーム対の組み立て
+      frame_reassembler_t                   reassembler_;
+      std::vector<uint8_t>                  datagram_;
+      frame_reassembler_t::encoded_frames_t encoded_frames_;
+      
+      // main からのキーシグナルのバッチ
+      key_batch_t key_batch_;
+      bool        has_key_session_;
+      uint32_t    key_session_;
+      uint32_t    next_key_sequence_;
+      size_t      lost_key_batches_;
+      size_t      stale_key_batches_;
+      
+      // run_key_batches の非同期受信と遅延の集計
+      boost::asio::ip::udp::endpoint remote_endpoint_;
+      latency_histogram_t            key_latency_;
+      std::chrono::seconds           latency_report_interval_;
+      
+      // transport が shm なら UDP の代わりに使う共有メモリーのリング（受信側が作って持つ）
+      std::unique_ptr<shm_ring_t> shm_;
+      
+      bool accept_key_batch(const uint8_t* data, const size_t len);
+      void report_key_latency(const char* label, const latency_histogram_t& latency) const;
+      
     public:
       udp_reciever_t(const configuration_t& conf);
-      key_signal_t operator()();
+      // 次のキーシグナルのバッチを待つ（壊れたもの、古いものは読み飛ばす）
+      //   返すバッチは次の呼び出しまで有効。
+      const key_batch_t& operator()();
+      
+      using key_batch_handler_t = std::function<void(const key_batch_t&)>;
+      // キーシグナルのバッチが届く度に直ちに handler を呼ぶ非同期の受信ループ
+      //   届いたデータグラムは待たずに全て捌き、is_running が false を返すと戻る。
+      //   撮影から handler を終えるまでの遅延を key_latency に溜め、定期的にログへ出す。
+      void run_key_batches(const key_batch_handler_t& handler, const std::function<bool()>& is_running);
+      const latency_histogram_t& key_latency() const;
       camera_capture_t::captured_frames_t recieve_captured_frames();
       template<class T> T recieve();
       const int port() const;
+      // 欠落したバッチと、遅れて届いたため捨てたバッチ（重複を含む）の数
+      const size_t lost_key_batches() const;
+      const size_t stale_key_batches() const;
     };
   }
 }
\ No newline at end of file
@@ -1,5 +1,11 @@
 #include "udp-sender.hxx"
 
+#include <algorithm>
+#include <cerrno>
+#include <cstring>
+#include <limits>
+#include <random>
+
 namespace arisin
 {
   namespace etupirka
@@ -8,9 +14,28 @@ namespace arisin
       : address_(conf.udp_sender.address)
       , port_(conf.udp_sender.port)
       , socket(io_service)
+      , max_datagram_size_(std::min(std::max(size_t(conf.udp_sender.max_datagram_size), sizeof(frame_transport::fragment_header_t) + 1), frame_transport::max_datagram_size))
+      , session_(std::random_device()())
+      , frame_id_(0)
+      , key_sequence_(0)
     {
       DLOG(INFO) << "address(" << address_ << ") port(" << port_ << "), socket initialized" ;
       
+      if(conf.udp_sender.transport == "shm")
+      {
+        shm_.reset(new shm_ring_t(conf.udp_sender.shm_name, false));
+        DLOG(INFO) << "transport: shm(" << conf.udp_sender.shm_name << ") session: " << session_;
+        return;
+      }
+      
+      if(conf.udp_sender.transport != "udp")
+        LOG(FATAL) << "unknown udp_sender.transport: " << conf.udp_sender.transport;
+      
+      if(max_datagram_size_ != size_t(conf.udp_sender.max_datagram_size))
+        LOG(WARNING) << "udp_sender.max_datagram_size(" << conf.udp_sender.max_datagram_size << ") is out of range; use " << max_datagram_size_;
+      
+      DLOG(INFO) << "max_datagram_size[bytes]: " << max_datagram_size_ << " session: " << session_;
+      
       // try without resolver
       try
       {
@@ -31,55 +56,170 @@ namespace arisin
       DLOG(INFO) << "socket opened";
     }
     
-    void udp_sender_t::operator()(const key_signal_t& key_signal)
+    void udp_sender_t::operator()(const std::vector<key_signal_t>& key_signals, const camera_capture_t::steady_clock_t::time_point capture_time)
     {
-      DLOG(INFO) << "key_signal code, state: " << key_signal.code_state.code << "," << key_signal.code_state.state;
+      // steady_clock の撮影時刻を system_clock へ換算する
+      const auto capture_age  = camera_capture_t::steady_clock_t::now() - capture_time;
+      const auto capture_wall = std::chrono::system_clock::now() - std::chrono::duration_cast<std::chrono::system_clock::duration>(capture_age);
       
-      using buffer_t = boost::array<decltype(key_signal.char_array)::value_type, sizeof(key_signal.char_array) / sizeof(decltype(key_signal.char_array)::value_type)>;
-      const buffer_t& buffer( *reinterpret_cast<const buffer_t*>( key_signal.char_array.data()) );
+      key_transport::batch_header_t header = {};
+      header.magic        = key_transport::magic;
+      header.session      = session_;
+      header.capture_time = std::chrono::duration_cast<std::chrono::nanoseconds>(capture_wall.time_since_epoch()).count();
       
+      // 1データグラムに収まらない数（実際のキーボードではあり得ない）なら分けて送る
+      for(size_t offset = 0; offset < key_signals.size(); offset += key_transport::max_signals)
+      {
+        const auto count = std::min(key_signals.size() - offset, key_transport::max_signals);
+        header.sequence     = key_sequence_++;
+        header.signal_count = uint16_t(count);
+        
+        if(shm_)
+        {
+          const iovec pieces[2]
+          { { &header, sizeof(header) }
+          , { const_cast<key_signal_t*>(key_signals.data() + offset), count * sizeof(key_signal_t) }
+          };
+          shm_->push(pieces, 2);
+          continue;
+        }
+        
+        const std::array<boost::asio::const_buffer, 2> buffers
+        {{ boost::asio::buffer(&header, sizeof(header))
+         , boost::asio::buffer(key_signals.data() + offset, count * sizeof(key_signal_t))
+        }};
+        
 #ifndef NDEBUG
-      auto n =
+        auto n =
 #endif
-      socket.send_to(boost::asio::buffer(buffer), endpoint);
+        socket.send_to(buffers, endpoint);
 #ifndef NDEBUG
-      DLOG(INFO) << "message sent [bytes]: " << n;
+        DLOG(INFO) << "key batch(" << header.sequence << ") " << count << " signals sent [bytes]: " << n;
 #endif
+      }
     }
     
-    void udp_sender_t::operator()(const camera_capture_t::captured_frames_t& captured_frames)
+    bool udp_sender_t::queue_fragments(const uint8_t camera_id)
     {
-      frame_packet_t frame_packets[2];
-      
-      frame_packets[0].capture_id = 0;
-      frame_packets[1].capture_id = 1;
-      frame_packets[0].sequence_id = frame_packets[1].sequence_id = sequence_id;
+      const auto& encoded = encoded_[camera_id];
+      const auto chunk_payload_size = max_datagram_size_ - sizeof(frame_transport::fragment_header_t);
+      const auto chunk_count = std::max((encoded.size() + chunk_payload_size - 1) / chunk_payload_size, size_t(1));
       
-      try
+      if(encoded.size() > frame_transport::max_frame_size || chunk_count > std::numeric_limits<uint16_t>::max())
       {
-        frame_packets[0].set_data(captured_frames.top);
-        frame_packets[1].set_data(captured_frames.front);
+        LOG(WARNING) << "skip frame; encoded frame is too large: " << encoded.size() << " [bytes]";
+        return false;
       }
-      catch(const std::runtime_error& e)
+      
+      frame_transport::fragment_header_t header = {};
+      header.magic       = frame_transport::magic;
+      header.session     = session_;
+      header.frame_id    = frame_id_;
+      header.frame_size  = uint32_t(encoded.size());
+      header.chunk_count = uint16_t(chunk_count);
+      header.camera_id   = camera_id;
+      
+      for(size_t chunk_index = 0; chunk_index < chunk_count; ++chunk_index)
       {
-        LOG(WARNING) << "skip frame; frame_packet set exception: " << e.what();
-        return;
+        header.chunk_offset = uint32_t(chunk_index * chunk_payload_size);
+        header.chunk_index  = uint16_t(chunk_index);
+        headers_.push_back(header);
       }
       
-      ++sequence_id;
+      return true;
+    }
+    
+    bool udp_sender_t::send_queued_fragments()
+    {
+      // headers_ が伸び終わってから iovec を作る（途中で再確保されるとポインターが無効になる）
+      iovecs_.resize(headers_.size() * 2);
+      messages_.resize(headers_.size());
       
-      for(const auto& frame_packet : frame_packets)
+      for(size_t n = 0; n < headers_.size(); ++n)
       {
-        const auto& buffer( frame_packet.mutate_to_const_array() );
+        const auto& header  = headers_[n];
+        const auto& encoded = encoded_[header.camera_id];
+        const auto payload_size = std::min(max_datagram_size_ - sizeof(header), encoded.size() - header.chunk_offset);
+        
+        iovecs_[n * 2    ].iov_base = const_cast<frame_transport::fragment_header_t*>(&header);
+        iovecs_[n * 2    ].iov_len  = sizeof(header);
+        iovecs_[n * 2 + 1].iov_base = const_cast<uint8_t*>(encoded.data() + header.chunk_offset);
+        iovecs_[n * 2 + 1].iov_len  = payload_size;
+        
+        auto& message = messages_[n];
+        message = message_t();
+        message.msg_hdr.msg_name    = endpoint.data();
+        message.msg_hdr.msg_namelen = endpoint.size();
+        message.msg_hdr.msg_iov     = &iovecs_[n * 2];
+        message.msg_hdr.msg_iovlen  = 2;
+      }
       
-#ifndef NDEBUG
-        auto n =
-#endif
-        socket.send_to(boost::asio::buffer(buffer), endpoint);
-#ifndef NDEBUG
-        DLOG(INFO) << "message sent [bytes]: " << n;
-#endif
+      if(shm_)
+      {
+        for(const auto& message : messages_)
+          if(!shm_->push(message.msg_hdr.msg_iov, message.msg_hdr.msg_iovlen))
+            return false;
+        
+        DLOG(INFO) << "frame(" << frame_id_ << ") pushed in " << messages_.size() << " fragments";
+        return true;
       }
+      
+#ifdef __linux__
+      // sendmmsg は送れた件数を返すので、残りを送り直す
+      for(size_t sent = 0; sent < messages_.size(); )
+      {
+        const auto n = ::sendmmsg(socket.native_handle(), &messages_[sent], unsigned(messages_.size() - sent), 0);
+        
+        if(n < 0)
+        {
+          if(errno == EINTR)
+            continue;
+          
+          LOG(WARNING) << "skip rest of frame; sendmmsg failed after " << sent << " fragments: " << std::strerror(errno);
+          return false;
+        }
+        
+        sent += size_t(n);
+      }
+#else
+      for(size_t sent = 0; sent < messages_.size(); )
+      {
+        if(::sendmsg(socket.native_handle(), &messages_[sent].msg_hdr, 0) < 0)
+        {
+          if(errno == EINTR)
+            continue;
+          
+          LOG(WARNING) << "skip rest of frame; sendmsg failed after " << sent << " fragments: " << std::strerror(errno);
+          return false;
+        }
+        
+        ++sent;
+      }
+#endif
+      
+      DLOG(INFO) << "frame(" << frame_id_ << ") sent in " << messages_.size() << " fragments";
+      
+      return true;
+    }
+    
+    void udp_sender_t::operator()(const camera_capture_t::captured_frames_t& captured_frames)
+    {
+      // imencode は既存の容量を使い回す
+      cv::imencode(".jpg", captured_frames.top  , encoded_[frame_transport::top_camera_id]  , { CV_IMWRITE_JPEG_QUALITY, frame_transport::jpeg_quality });
+      cv::imencode(".jpg", captured_frames.front, encoded_[frame_transport::front_camera_id], { CV_IMWRITE_JPEG_QUALITY, frame_transport::jpeg_quality });
+      
+      headers_.clear();
+      
+      // 共有メモリーにはデータグラムの大きさの制約が無いので、フレームはリングの 1/8 までの大きな断片で送る
+      //   大きさは設定ではなく受信側が実際に作ったリングの容量から決める（受信側が作り直せば変わる）
+      if(shm_ && shm_->attached())
+        max_datagram_size_ = std::max(shm_->capacity() / 8, sizeof(frame_transport::fragment_header_t) + 1);
+      
+      // 受信側は top と front が揃ったフレーム対だけを使う
+      if(queue_fragments(frame_transport::top_camera_id) && queue_fragments(frame_transport::front_camera_id))
+        send_queued_fragments();
+      
+      ++frame_id_;
     }
     
     const std::string& udp_sender_t::address() const
@@ -1,6 +1,12 @@
 #pragma once
 
+#include <array>
+#include <memory>
 #include <string>
+#include <vector>
+
+#include <sys/socket.h>
+#include <sys/uio.h>
 
 #include <boost/array.hpp>
 #include <boost/asio.hpp>
@@ -10,6 +16,7 @@
 
 #include "camera-capture.hxx"
 #include "network-common.hxx"
+#include "shm-ring.hxx"
 
 namespace arisin
 {
@@ -27,11 +34,36 @@ namespace arisin
       boost::asio::ip::udp::endpoint        endpoint;
       boost::asio::ip::udp::socket          socket;
 
-      frame_packet_t::sequence_id_t sequence_id;
+      // フレーム対の分割転送（network-common.hxx の frame_transport）
+      size_t   max_datagram_size_;
+      uint32_t session_;
+      uint32_t frame_id_;
+      uint32_t key_sequence_;
+      
+      // 送信の度に使い回すバッファ
+      //   JPEG は encoded_ に符号化し、各データグラムは断片ヘッダーと encoded_ の一部の2つの iovec で
+      //   組み立てるので、ペイロードを送信用に複写しない。
+      std::array<std::vector<uint8_t>, 2>             encoded_;
+      std::vector<frame_transport::fragment_header_t> headers_;
+      std::vector<iovec>                              iovecs_;
+#ifdef __linux__
+      using message_t = mmsghdr;
+#else
+      // sendmmsg の無い環境（OS X）では1断片ずつ sendmsg で送る
+      struct message_t { msghdr msg_hdr; };
+#endif
+      std::vector<message_t>                          messages_;
+      
+      // transport が shm なら UDP の代わりに使う共有メモリーのリング
+      std::unique_ptr<shm_ring_t> shm_;
+      
+      bool queue_fragments(const uint8_t camera_id);
+      bool send_queued_fragments();
       
     public:
       udp_sender_t(const configuration_t& conf);
-      void operator()(const key_signal_t& key_signal);
+      // 1フレーム分のキーシグナルを1データグラムで送る（capture_time はフレームの撮影時刻）
+      void operator()(const std::vector<key_signal_t>& key_signals, const camera_capture_t::steady_clock_t::time_point capture_time);
       void operator()(const camera_capture_t::captured_frames_t& captured_frames);
       const std::string& address() const;
       const int port() const;
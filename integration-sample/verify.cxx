@@ -0,0 +1,363 @@
+// etupirka-verify: 速くしたカーネルや索引を参照実装（スカラー版、置き換える前の実装）と突き合わせる検査
+//   検査毎に PASS / FAIL を標準出力へ出し、1つでも一致しなければ終了コード 1 で終わる。
+//   例: make verify
+
+#include <algorithm>
+#include <cstdint>
+#include <functional>
+#include <iostream>
+#include <random>
+#include <set>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+#include <opencv2/core/core.hpp>
+#include <opencv2/imgproc/imgproc.hpp>
+
+#include "commandline_helper.hxx"
+#include "hsv-filter.hxx"
+#include "image_processor.hxx"
+#include "logger.hxx"
+#include "virtual-keyboard.hxx"
+
+namespace
+{
+  using namespace arisin::etupirka;
+  
+  struct options_t
+  {
+    std::string conf_file = "etupirka.conf";
+    std::string filter;
+  };
+  
+  options_t interpret(const std::vector<std::string>& arguments)
+  {
+    options_t o;
+    for(auto i = std::begin(arguments) + 1, e = std::end(arguments); i < e; ++i)
+    {
+      const auto has_value = i + 1 < e;
+      if((*i == "-c" || *i == "--conf-file") && has_value)
+        o.conf_file = *++i;
+      else if(*i == "--filter" && has_value)
+        o.filter = *++i;
+      else
+      {
+        std::cerr
+          << "usage: etupirka-verify [options]\n"
+             "  -c, --conf-file PATH        also check the thresholds in this configuration (default: etupirka.conf)\n"
+             "  --filter TEXT               run only checks whose name contains TEXT\n"
+          ;
+        exit(*i == "-h" || *i == "--help" ? 0 : 1);
+      }
+    }
+    return o;
+  }
+  
+  // hsv_filter_t に置き換える前の float 版 HSV フィルター（hsv_filter_t の参照実装）
+  // in : cv::Mat<CV_8UC3(BGR24)>
+  // out: cv::Mat<CV_8UC1(B1)>
+  cv::Mat filter_hsv_from_BGR24_to_single_channel
+  ( const cv::Mat& src
+  , const float h_min, const float h_max
+  , const float s_min, const float s_max
+  , const float v_min, const float v_max
+  )
+  {
+    cv::Mat hsv;
+    src.convertTo(hsv, CV_32F);
+    cv::cvtColor(hsv, hsv, CV_BGR2HSV);
+    
+    cv::Mat dst(src.rows, src.cols, CV_8UC1);
+    
+    using result_element_t = uint8_t;
+    using hsv_pixel_t = cv::Point3f;
+    using src_pixel_t = cv::Point3_<uint8_t>;
+    
+          auto ihsv = reinterpret_cast<hsv_pixel_t*>(hsv.data);
+    const auto ehsv = ihsv + hsv.total();
+          auto idst = reinterpret_cast<result_element_t*>(dst.data);
+          auto isrc = reinterpret_cast<src_pixel_t*>(src.data);
+    
+    while(ihsv < ehsv)
+    {
+      const auto& p = *ihsv++;
+      
+      *idst++ =
+        (
+          ( ( p.x >= h_min && p.x <= h_max ) || ( h_max > 360.f &&  ( p.x >= h_min || p.x <= h_max - 360.f ) ) )
+          &&  p.y >= s_min && p.y <= s_max
+          &&  p.z >= v_min && p.z <= v_max
+        )
+          ? result_element_t((uint(isrc->z) + uint(isrc->y) * 4 + uint(isrc->x) * 2) / 7)
+          : 0
+          ;
+      
+      ++isrc;
+    }
+    
+    return dst;
+  }
+  
+  // image_processor の SIMD 版カーネルをスカラー版と乱数画像で比べる
+  //   bilateral は積和の順序が違うため丸めによる ±1 の差を許し、median は完全一致を求める。
+  //   幅は SIMD のブロックに割り切れない大きさも混ぜ、行末の端数の処理も通す。
+  struct simd_kernel_t
+  {
+    std::string name;
+    double tolerance;
+    std::function<void(const cv::Mat& src1, const cv::Mat& src3, cv::Mat& dst, filter_scratch_t& scratch)> run;
+  };
+  
+  std::vector<simd_kernel_t> simd_kernels()
+  {
+    return
+    { { "bilateral(1ch)", 1, [](const cv::Mat& s1, const cv::Mat&   , cv::Mat& d, filter_scratch_t& scratch){ ::bilateralFilter_8u( s1, d, 7, 40, 3, scratch ); } }
+    , { "bilateral(3ch)", 1, [](const cv::Mat&   , const cv::Mat& s3, cv::Mat& d, filter_scratch_t& scratch){ ::bilateralFilter_8u( s3, d, 7, 40, 3, scratch ); } }
+    , { "median(3)"     , 0, [](const cv::Mat& s1, const cv::Mat&   , cv::Mat& d, filter_scratch_t& scratch){ ::medianBlur( s1, d, 3, scratch ); } }
+    , { "median(5,3ch)" , 0, [](const cv::Mat&   , const cv::Mat& s3, cv::Mat& d, filter_scratch_t& scratch){ ::medianBlur( s3, d, 5, scratch ); } }
+    , { "median(17)"    , 0, [](const cv::Mat& s1, const cv::Mat&   , cv::Mat& d, filter_scratch_t& scratch){ ::medianBlur( s1, d, 17, scratch ); } }
+    , { "median(41)"    , 0, [](const cv::Mat& s1, const cv::Mat&   , cv::Mat& d, filter_scratch_t& scratch){ ::medianBlur( s1, d, 41, scratch ); } }
+    };
+  }
+  
+  bool verify_simd_kernel(const simd_kernel_t& kernel, const cv::Size& size)
+  {
+    std::mt19937 engine(size.width * size.height);
+    std::uniform_int_distribution<int> distribution(0, 255);
+    
+    cv::Mat src1(size, CV_8UC1), src3(size, CV_8UC3);
+    for(int row = 0; row < size.height; ++row)
+    {
+      for(int col = 0; col < size.width; ++col)
+        src1.ptr(row)[col] = uchar(distribution(engine));
+      for(int col = 0; col < size.width * 3; ++col)
+        src3.ptr(row)[col] = uchar(distribution(engine));
+    }
+    
+    filter_scratch_t scratch;
+    cv::Mat simd, scalar;
+    
+    set_simd_enabled(true);
+    kernel.run(src1, src3, simd, scratch);
+    set_simd_enabled(false);
+    kernel.run(src1, src3, scalar, scratch);
+    set_simd_enabled(true);
+    
+    const auto error = cv::norm(simd, scalar, cv::NORM_INF);
+    if(error <= kernel.tolerance)
+      return true;
+    
+    LOG(ERROR) << simd_name() << " " << kernel.name << " " << size.width << "x" << size.height << " differs from scalar by " << error;
+    return false;
+  }
+  
+  struct hsv_thresholds_t
+  {
+    std::string name;
+    float h_min, h_max, s_min, s_max, v_min, v_max;
+  };
+  
+  // 全ての BGR の値（2^24 通り）で hsv_filter_t を参照実装と比べる
+  //   1行を 4096 + 1 画素にして、SIMD 版で処理する部分と行末のスカラー版の部分の両方を通し、
+  //   画素毎の operator()(b, g, r) も比べる。
+  bool verify_hsv_filter(const hsv_thresholds_t& t)
+  {
+    hsv_filter_t filter;
+    filter.set(t.h_min, t.h_max, t.s_min, t.s_max, t.v_min, t.v_max);
+    
+    constexpr int colors    = 4096;
+    constexpr int band_rows = 256;
+    cv::Mat src(band_rows, colors + 1, CV_8UC3);
+    cv::Mat dst;
+    
+    size_t mismatches = 0;
+    size_t passed     = 0;
+    
+    for(int band = 0; band < colors; band += band_rows)
+    {
+      for(int row = 0; row < band_rows; ++row)
+      {
+        auto s = src.ptr<uint8_t>(row);
+        for(int col = 0; col <= colors; ++col, s += 3)
+        {
+          const auto color = uint32_t(band + row) * colors + uint32_t(col % colors);
+          s[0] = uint8_t(color);
+          s[1] = uint8_t(color >> 8);
+          s[2] = uint8_t(color >> 16);
+        }
+      }
+      
+      const auto expected = filter_hsv_from_BGR24_to_single_channel(src, t.h_min, t.h_max, t.s_min, t.s_max, t.v_min, t.v_max);
+      filter(src, dst);
+      
+      for(int row = 0; row < band_rows; ++row)
+      {
+        const auto s = src.ptr<uint8_t>(row);
+        const auto e = expected.ptr<uint8_t>(row);
+        const auto d = dst.ptr<uint8_t>(row);
+        for(int col = 0; col <= colors; ++col)
+        {
+          const auto b = s[col * 3], g = s[col * 3 + 1], r = s[col * 3 + 2];
+          const auto pixel = filter(b, g, r);
+          passed += e[col] != 0;
+          if(d[col] == e[col] && pixel == e[col])
+            continue;
+          
+          if(mismatches++ < 8)
+            LOG(ERROR)
+              << t.name << ": bgr(" << int(b) << "," << int(g) << "," << int(r) << ")"
+              << " expected " << int(e[col]) << " " << filter.kernel_name() << " " << int(d[col]) << " scalar " << int(pixel)
+              ;
+        }
+      }
+    }
+    
+    DLOG(INFO) << t.name << ": pixels passed the thresholds: " << passed << " mismatches: " << mismatches;
+    return mismatches == 0;
+  }
+  
+  std::vector<hsv_thresholds_t> hsv_threshold_sets(const configuration_t& conf)
+  {
+    const auto& top   = conf.finger_detector_top;
+    const auto& front = conf.finger_detector_front;
+    return
+    { { "conf top"                      , top.hsv_h_min  , top.hsv_h_max  , top.hsv_s_min  , top.hsv_s_max  , top.hsv_v_min  , top.hsv_v_max   }
+    , { "conf front"                    , front.hsv_h_min, front.hsv_h_max, front.hsv_s_min, front.hsv_s_max, front.hsv_v_min, front.hsv_v_max }
+    , { "all"                           ,   0.f  , 360.f, 0.f   , 1.f   ,   0.f, 255.f }
+    , { "narrow"                        ,  10.f  ,  20.f, 0.5f  , 0.6f  ,  50.f,  60.f }
+    , { "empty"                         ,   0.f  ,   0.f, 0.f   , 0.f   ,   0.f,   0.f }
+    , { "single hue"                    ,  60.f  ,  60.f, 0.2f  , 1.f   ,   1.f, 255.f }
+    , { "negative h_min"                , -10.f  ,  30.f, 0.f   , 1.f   ,   0.f, 255.f }
+    , { "wraparound"                    , 300.f  , 420.f, 0.f   , 1.f   ,   0.f, 255.f }
+    , { "wraparound near 360"           , 359.9f , 365.f, 0.f   , 0.01f ,   0.f, 255.f }
+    , { "wraparound skin tone"         , 356.33f, 390.f, 0.1105f, 0.3118f, 199.f, 255.f }
+    , { "wraparound beyond 720"         , 200.f  , 600.f, 0.3f  , 0.31f ,   0.f, 255.f }
+    };
+  }
+  
+  // 設定のキーテーブルで、索引による判定（use_sqlite_query = false）を SQLite の問い合わせと比べる
+  //   全てのキーの辺（x, x + w, y, y + h）とストローク s のそれぞれ僅かに内側・丁度・僅かに外側の値を
+  //   組み合わせた格子の全ての点で pressing_keys() を比べる。
+  bool verify_virtual_keyboard(configuration_t conf)
+  {
+    conf.virtual_keyboard.use_sqlite_query = true;
+    virtual_keyboard_t sqlite(conf);
+    conf.virtual_keyboard.use_sqlite_query = false;
+    virtual_keyboard_t index(conf);
+    
+    WonderRabbitProject::SQLite3::sqlite3_t database(conf.virtual_keyboard.database);
+    const auto rows = database.execute_data<double, double, double, double, double>
+      ( "select x, y, w, h, s from " + conf.virtual_keyboard.table );
+    
+    constexpr double epsilon = 1e-6;
+    std::set<double> xs, ys, strokes;
+    const auto add_edge = [&](std::set<double>& values, const double edge)
+    {
+      values.insert(edge - epsilon);
+      values.insert(edge);
+      values.insert(edge + epsilon);
+    };
+    
+    for(const auto& row : rows)
+    {
+      // 点の x は add_test の中で x_shift() を足される
+      const auto x = std::get<0>(row) - sqlite.x_shift();
+      add_edge(xs, x);
+      add_edge(xs, x + std::get<2>(row));
+      add_edge(ys, std::get<1>(row));
+      add_edge(ys, std::get<1>(row) + std::get<3>(row));
+      add_edge(strokes, std::get<4>(row));
+    }
+    
+    const auto sorted = [](const virtual_keyboard_t::pressing_keys_t& keys)
+    {
+      std::vector<int32_t> ids(keys.begin(), keys.end());
+      std::sort(ids.begin(), ids.end());
+      return ids;
+    };
+    
+    const auto describe = [](const std::vector<int32_t>& ids)
+    {
+      std::string text;
+      for(const auto id : ids)
+        text += (text.empty() ? "" : ",") + std::to_string(id);
+      return "{" + text + "}";
+    };
+    
+    size_t points = 0, pressed = 0, mismatches = 0;
+    for(const auto x : xs)
+      for(const auto y : ys)
+        for(const auto stroke : strokes)
+        {
+          sqlite.reset();
+          index.reset();
+          sqlite.add_test(x, y, stroke);
+          index.add_test(x, y, stroke);
+          
+          const auto expected = sorted(sqlite.pressing_keys());
+          const auto actual   = sorted(index.pressing_keys());
+          ++points;
+          pressed += !expected.empty();
+          if(expected == actual)
+            continue;
+          
+          if(mismatches++ < 8)
+            LOG(ERROR)
+              << "virtual_keyboard(" << conf.virtual_keyboard.table << "): point(" << x << "," << y << "," << stroke << ")"
+              << " sqlite " << describe(expected) << " index " << describe(actual)
+              ;
+        }
+    
+    DLOG(INFO) << "virtual_keyboard: rows: " << rows.size() << " points: " << points << " pressed: " << pressed << " mismatches: " << mismatches;
+    return !rows.empty() && mismatches == 0;
+  }
+}
+
+int main(const int number_of_arguments, const char* const* const arguments)
+{
+  using namespace arisin::etupirka;
+  logger::initialize();
+  
+  const auto options = interpret({arguments, arguments + number_of_arguments});
+  
+  auto conf = commandline_helper_t::load_default();
+  commandline_helper_t::load_file(conf, options.conf_file);
+  
+  size_t failures = 0;
+  const auto check = [&](const std::string& name, const std::function<bool()>& body)
+  {
+    if(!options.filter.empty() && name.find(options.filter) == std::string::npos)
+      return;
+    
+    bool ok = false;
+    try
+    { ok = body(); }
+    catch(const std::exception& e)
+    { LOG(ERROR) << name << ": " << e.what(); }
+    
+    std::cout << (ok ? "PASS " : "FAIL ") << name << std::endl;
+    failures += !ok;
+  };
+  
+  set_simd_enabled(true);
+  for(const auto& size : { cv::Size(67, 29), cv::Size(640, 480), cv::Size(33, 3) })
+    for(const auto& kernel : simd_kernels())
+      check
+      ( std::string("simd(") + simd_name() + ") " + kernel.name + " " + std::to_string(size.width) + "x" + std::to_string(size.height)
+      , [&]{ return verify_simd_kernel(kernel, size); }
+      );
+  
+  for(const auto& t : hsv_threshold_sets(conf))
+    check("hsv_filter(" + t.name + ")", [&]{ return verify_hsv_filter(t); });
+  
+  check
+  ( "virtual_keyboard(" + conf.virtual_keyboard.database + ":" + conf.virtual_keyboard.table + ")"
+  , [&]{ return verify_virtual_keyboard(conf); }
+  );
+  
+  if(failures)
+    LOG(ERROR) << failures << " checks failed";
+  
+  return failures ? 1 : 0;
+}
@@ -1,5 +1,9 @@
 #include "virtual-keyboard.hxx"
 
+#include <cmath>
+#include <limits>
+#include <algorithm>
+
 namespace arisin
 {
   namespace etupirka
@@ -17,9 +21,12 @@ namespace arisin
           " s <= ?"
         )
       )
+      , use_sqlite_query_(conf.virtual_keyboard.use_sqlite_query)
     {
       DLOG(INFO) << "database(" << database_ << ") table(" << table_ << ")";
+      DLOG(INFO) << "use_sqlite_query: " << use_sqlite_query_;
       load_x_shift();
+      load_index();
     }
     
     void virtual_keyboard_t::load_x_shift()
@@ -31,6 +38,92 @@ namespace arisin
       DLOG(INFO) << "x_shift_: " << x_shift_;
     }
     
+    void virtual_keyboard_t::load_index()
+    {
+      // SQLite 版の判定式では NULL との比較は偽、文字列・BLOB は数値より大きいので、
+      // x, y, s が数値でない行はどの点にも一致しない（w, h は足し算で数値に変換される）。
+      // 索引では 0 として読まれてしまうので、そのような行は SQL と同じく最初から除く。
+      const auto sql = std::string("select x, y, w, h, s, id from ") + table() +
+        " where typeof(x) in ('integer', 'real')"
+        " and typeof(y) in ('integer', 'real')"
+        " and typeof(s) in ('integer', 'real')"
+        " and w is not null and h is not null";
+      DLOG(INFO) << "SQL: " << sql;
+      
+      auto select_all = database_object.prepare(sql);
+      const auto rows = select_all.data<double, double, double, double, double, int32_t>();
+      
+      keys_.clear();
+      keys_.reserve(rows.size());
+      for(const auto& row : rows)
+        keys_.push_back({ std::get<0>(row), std::get<1>(row), std::get<2>(row), std::get<3>(row), std::get<4>(row), std::get<5>(row) });
+      DLOG(INFO) << "keys: " << keys_.size();
+      
+      const auto all_rows = size_t(std::get<0>(database_object.execute_data<int64_t>(std::string("select count(*) from ") + table())[0]));
+      if(all_rows != keys_.size())
+        LOG(WARNING) << "table(" << table_ << ") has " << (all_rows - keys_.size()) << " rows with non-numeric x/y/s or NULL w/h; they never match any point";
+      
+      grid_offsets_.assign(1, 0);
+      grid_keys_.clear();
+      grid_cols_ = grid_rows_ = 0;
+      
+      if(keys_.empty())
+      {
+        LOG(WARNING) << "table(" << table_ << ") has no keys";
+        return;
+      }
+      
+      // グリッドの範囲はキー矩形群の外接矩形、セルの大きさは最小のキーの幅・高さとする
+      grid_x_min_ = grid_y_min_ =  std::numeric_limits<double>::max();
+      grid_x_max_ = grid_y_max_ = -std::numeric_limits<double>::max();
+      grid_cell_w_ = grid_cell_h_ = std::numeric_limits<double>::max();
+      for(const auto& k : keys_)
+      {
+        grid_x_min_ = std::min(grid_x_min_, k.x);
+        grid_y_min_ = std::min(grid_y_min_, k.y);
+        grid_x_max_ = std::max(grid_x_max_, k.x + k.w);
+        grid_y_max_ = std::max(grid_y_max_, k.y + k.h);
+        if(k.w > 0) grid_cell_w_ = std::min(grid_cell_w_, k.w);
+        if(k.h > 0) grid_cell_h_ = std::min(grid_cell_h_, k.h);
+      }
+      if(grid_cell_w_ == std::numeric_limits<double>::max()) grid_cell_w_ = 1;
+      if(grid_cell_h_ == std::numeric_limits<double>::max()) grid_cell_h_ = 1;
+      
+      grid_cols_ = std::max(1, int(std::ceil((grid_x_max_ - grid_x_min_) / grid_cell_w_)));
+      grid_rows_ = std::max(1, int(std::ceil((grid_y_max_ - grid_y_min_) / grid_cell_h_)));
+      DLOG(INFO) << "grid cols, rows: " << grid_cols_ << ", " << grid_rows_;
+      
+      // 各キーを、その矩形の両端を含む全てのセルに登録する（2パスでCSR形式に詰める）
+      const size_t cells = size_t(grid_cols_) * size_t(grid_rows_);
+      grid_offsets_.assign(cells + 1, 0);
+      
+      for(const auto& k : keys_)
+        for(auto r = grid_row(k.y), re = grid_row(k.y + k.h); r <= re; ++r)
+          for(auto c = grid_col(k.x), ce = grid_col(k.x + k.w); c <= ce; ++c)
+            ++grid_offsets_[size_t(r) * grid_cols_ + c + 1];
+      
+      for(size_t n = 1; n <= cells; ++n)
+        grid_offsets_[n] += grid_offsets_[n - 1];
+      
+      grid_keys_.resize(grid_offsets_[cells]);
+      auto cursors = std::vector<uint32_t>(std::begin(grid_offsets_), std::end(grid_offsets_) - 1);
+      
+      for(uint32_t n = 0; n < keys_.size(); ++n)
+      {
+        const auto& k = keys_[n];
+        for(auto r = grid_row(k.y), re = grid_row(k.y + k.h); r <= re; ++r)
+          for(auto c = grid_col(k.x), ce = grid_col(k.x + k.w); c <= ce; ++c)
+            grid_keys_[cursors[size_t(r) * grid_cols_ + c]++] = n;
+      }
+      DLOG(INFO) << "grid entries: " << grid_keys_.size();
+    }
+    
+    int virtual_keyboard_t::grid_col(const double x) const
+    { return std::min(int(std::floor((x - grid_x_min_) / grid_cell_w_)), grid_cols_ - 1); }
+    
+    int virtual_keyboard_t::grid_row(const double y) const
+    { return std::min(int(std::floor((y - grid_y_min_) / grid_cell_h_)), grid_rows_ - 1); }
+    
     void virtual_keyboard_t::reset()
     { pressing_keys_.clear(); }
     
@@ -38,6 +131,33 @@ namespace arisin
     {
       DLOG(INFO) << "x(" << x << ") y(" << y << ") stroke(" << stroke << ")";
       
+      if(use_sqlite_query_)
+        add_test_sqlite(x, y, stroke);
+      else
+        add_test_index(x, y, stroke);
+    }
+    
+    void virtual_keyboard_t::add_tests(const point_t* points, const size_t size)
+    {
+      DLOG(INFO) << "points: " << size;
+      
+      // 1フレーム分の指先群をまとめて判定する
+      //   ※point_t は (x, y, stroke) の順
+      const auto end = points + size;
+      
+      if(use_sqlite_query_)
+        for(auto p = points; p < end; ++p)
+          add_test_sqlite((*p)[0], (*p)[1], (*p)[2]);
+      else
+        for(auto p = points; p < end; ++p)
+          add_test_index((*p)[0], (*p)[1], (*p)[2]);
+    }
+    
+    void virtual_keyboard_t::add_tests(const std::vector<point_t>& points)
+    { add_tests(points.data(), points.size()); }
+    
+    void virtual_keyboard_t::add_test_sqlite(const double x, const double y, const double stroke)
+    {
       const auto x_shifted = x + x_shift_;
       DLOG(INFO) << "x_shifted: " << x_shifted;
       
@@ -58,9 +178,42 @@ namespace arisin
       }
     }
     
+    void virtual_keyboard_t::add_test_index(const double x, const double y, const double stroke)
+    {
+      const auto x_shifted = x + x_shift_;
+      DLOG(INFO) << "x_shifted: " << x_shifted;
+      
+      // 外接矩形の外（NaNを含む）にはどのキーも無い
+      if( grid_cols_ == 0
+       || !( x_shifted >= grid_x_min_ && x_shifted <= grid_x_max_
+          && y         >= grid_y_min_ && y         <= grid_y_max_
+           )
+        )
+        return;
+      
+      const auto cell = size_t(grid_row(y)) * grid_cols_ + grid_col(x_shifted);
+      
+      // SQLite版と同じ判定式を候補キーにだけ適用する
+      for(auto n = grid_offsets_[cell], e = grid_offsets_[cell + 1]; n < e; ++n)
+      {
+        const auto& k = keys_[grid_keys_[n]];
+        if( k.x <= x_shifted && k.x + k.w >= x_shifted
+         && k.y <= y         && k.y + k.h >= y
+         && k.s <= stroke
+          )
+        {
+          DLOG(INFO) << "key: id(" << k.id << ")";
+          pressing_keys_.emplace(k.id);
+        }
+      }
+    }
+    
     const virtual_keyboard_t::pressing_keys_t& virtual_keyboard_t::pressing_keys() const
     { return pressing_keys_; }
     
+    const double virtual_keyboard_t::x_shift() const
+    { return x_shift_; }
+    
     const std::string& virtual_keyboard_t::database() const
     { return database_; }
     
@@ -1,9 +1,10 @@
 #pragma once
 
 #include <string>
-#include <unordered_set>
+#include <vector>
 #include <WonderRabbitProject/SQLite3.hpp>
 #include "configuration.hxx"
+#include "key-set.hxx"
 #include "logger.hxx"
 
 namespace arisin
@@ -13,22 +14,52 @@ namespace arisin
     class virtual_keyboard_t final
     {
     public:
-      using pressing_keys_t = std::unordered_set<int32_t>;
+      using pressing_keys_t = key_set_t;
+      using point_t = configuration_t::space_converter_configuration_t::a3d_t;
       
     private:
+      // キーテーブルの1行分( x, y, w, h, s, id )
+      struct key_t
+      {
+        double x, y, w, h, s;
+        int32_t id;
+      };
+      
       WonderRabbitProject::SQLite3::sqlite3_t database_object;
       std::string database_;
       std::string table_;
       WonderRabbitProject::SQLite3::prepare_t statement;
       pressing_keys_t pressing_keys_;
       double x_shift_;
+      bool use_sqlite_query_;
+      
+      // 一様グリッドによるキー索引
+      //   grid_offsets_[cell] から grid_offsets_[cell + 1] までの grid_keys_ が
+      //   そのセルに掛かるキーの keys_ 上の添字
+      std::vector<key_t>    keys_;
+      std::vector<uint32_t> grid_offsets_;
+      std::vector<uint32_t> grid_keys_;
+      double grid_x_min_, grid_y_min_, grid_x_max_, grid_y_max_;
+      double grid_cell_w_, grid_cell_h_;
+      int grid_cols_, grid_rows_;
+      
+      int grid_col(const double x) const;
+      int grid_row(const double y) const;
+      
+      void add_test_sqlite(const double x, const double y, const double stroke);
+      void add_test_index(const double x, const double y, const double stroke);
       
     public:
       explicit virtual_keyboard_t(const configuration_t& conf);
       void load_x_shift();
+      void load_index();
       void reset();
       void add_test(const double x, const double y, const double stroke);
+      void add_tests(const point_t* points, const size_t size);
+      void add_tests(const std::vector<point_t>& points);
       const pressing_keys_t& pressing_keys() const;
+      // add_test の x に足してキーテーブルの座標にする量
+      const double x_shift() const;
       const std::string& database() const;
       const std::string& table() const;
     };
@@ -0,0 +1,155 @@
+#include "worker-pool.hxx"
+
+#include <algorithm>
+
+#ifdef __linux__
+  #include <pthread.h>
+  #include <sched.h>
+#endif
+
+namespace arisin
+{
+  namespace etupirka
+  {
+    worker_pool_t::task_t::task_t(std::function<void()> function)
+      : function_(std::move(function))
+      , pending_(false)
+    { }
+    
+    void worker_pool_t::task_t::run()
+    {
+      std::exception_ptr exception;
+      
+      try
+      { function_(); }
+      catch(...)
+      { exception = std::current_exception(); }
+      
+      {
+        std::lock_guard<std::mutex> lock(mutex_);
+        exception_ = exception;
+        pending_   = false;
+      }
+      condition_.notify_all();
+    }
+    
+    void worker_pool_t::task_t::wait()
+    {
+      std::unique_lock<std::mutex> lock(mutex_);
+      condition_.wait(lock, [this]{ return !pending_; });
+      
+      if(exception_)
+      {
+        auto exception = exception_;
+        exception_ = nullptr;
+        std::rethrow_exception(exception);
+      }
+    }
+    
+    worker_pool_t::worker_pool_t(const configuration_t& conf)
+      : first_cpu_(conf.worker_pool.first_cpu)
+    {
+      const auto size = size_t(std::max(1, conf.worker_pool.threads));
+      DLOG(INFO) << "threads: "   << size;
+      DLOG(INFO) << "first-cpu: " << first_cpu_;
+      
+      workers_.reserve(size);
+      for(size_t n = 0; n < size; ++n)
+      {
+        workers_.emplace_back(new worker_t());
+        // 投入のたびに確保が起きないよう、待ち行列は先に確保しておく
+        workers_.back()->pending.reserve(8);
+        workers_.back()->running.reserve(8);
+      }
+      
+      for(size_t n = 0; n < size; ++n)
+        workers_[n]->thread = std::thread([this, n]{ worker_loop(n); });
+    }
+    
+    worker_pool_t::~worker_pool_t()
+    {
+      for(auto& worker : workers_)
+      {
+        {
+          std::lock_guard<std::mutex> lock(worker->mutex);
+          worker->is_running = false;
+        }
+        worker->condition.notify_one();
+      }
+      
+      for(auto& worker : workers_)
+        if(worker->thread.joinable())
+          worker->thread.join();
+    }
+    
+    void worker_pool_t::set_affinity(const size_t index)
+    {
+      if(first_cpu_ < 0)
+        return;
+      
+      const auto cpus = std::max(1u, std::thread::hardware_concurrency());
+      const auto cpu  = (unsigned(first_cpu_) + unsigned(index)) % cpus;
+
+#ifdef __linux__
+      cpu_set_t cpu_set;
+      CPU_ZERO(&cpu_set);
+      CPU_SET(cpu, &cpu_set);
+      
+      if(const auto error = pthread_setaffinity_np(pthread_self(), sizeof(cpu_set), &cpu_set))
+        LOG(WARNING) << "worker(" << index << ") can not set affinity to cpu(" << cpu << "); error: " << error;
+      else
+        DLOG(INFO) << "worker(" << index << ") pinned to cpu(" << cpu << ")";
+#else
+      LOG(WARNING) << "worker(" << index << ") can not set affinity to cpu(" << cpu << ") on this platform";
+#endif
+    }
+    
+    void worker_pool_t::worker_loop(const size_t index)
+    {
+      set_affinity(index);
+      
+      auto& worker = *workers_[index];
+      
+      while(true)
+      {
+        {
+          std::unique_lock<std::mutex> lock(worker.mutex);
+          worker.condition.wait(lock, [&]{ return !worker.pending.empty() || !worker.is_running; });
+          
+          if(worker.pending.empty())
+            return;
+          
+          // 容量ごと入れ替えるので、ここでも確保は起きない
+          std::swap(worker.pending, worker.running);
+        }
+        
+        for(const auto task : worker.running)
+          task->run();
+        
+        worker.running.clear();
+      }
+    }
+    
+    void worker_pool_t::submit(task_t& task, const size_t worker)
+    {
+      {
+        std::lock_guard<std::mutex> lock(task.mutex_);
+        task.pending_   = true;
+        task.exception_ = nullptr;
+      }
+      
+      auto& w = *workers_[worker % workers_.size()];
+      {
+        std::lock_guard<std::mutex> lock(w.mutex);
+        w.pending.push_back(&task);
+      }
+      w.condition.notify_one();
+    }
+    
+    const size_t worker_pool_t::size() const
+    { return workers_.size(); }
+    
+    const int worker_pool_t::first_cpu() const
+    { return first_cpu_; }
+  }
+}
@@ -0,0 +1,75 @@
+#pragma once
+
+#include <condition_variable>
+#include <exception>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+#include "configuration.hxx"
+#include "logger.hxx"
+
+namespace arisin
+{
+  namespace etupirka
+  {
+    // 常駐ワーカースレッド群
+    //   フレーム毎に std::async でスレッドを起こす代わりに、起動時に作ったスレッドへタスクを投げる。
+    //   タスクは投入先のワーカーを指定する（同じ検出器を毎回同じスレッド・同じCPUで回すため）。
+    class worker_pool_t final
+    {
+    public:
+      // 再利用可能なタスク
+      //   関数は生成時に一度だけ設定し、フレーム毎には submit と wait だけを行う。
+      class task_t final
+      {
+        friend class worker_pool_t;
+        
+        std::function<void()> function_;
+        std::exception_ptr    exception_;
+        bool                  pending_;
+        std::mutex              mutex_;
+        std::condition_variable condition_;
+        
+        void run();
+        
+      public:
+        explicit task_t(std::function<void()> function);
+        task_t(const task_t&) = delete;
+        task_t& operator=(const task_t&) = delete;
+        
+        // 完了を待つ。タスクが例外を投げていた場合はここで再送出する。
+        void wait();
+      };
+      
+    private:
+      struct worker_t
+      {
+        std::thread thread;
+        std::mutex              mutex;
+        std::condition_variable condition;
+        std::vector<task_t*> pending;
+        std::vector<task_t*> running;
+        bool is_running = true;
+      };
+      
+      std::vector<std::unique_ptr<worker_t>> workers_;
+      int first_cpu_;
+      
+      void worker_loop(const size_t index);
+      void set_affinity(const size_t index);
+      
+    public:
+      explicit worker_pool_t(const configuration_t& conf);
+      ~worker_pool_t();
+      
+      // worker 番目（ワーカー数で剰余を取る）のワーカーにタスクを投入する
+      void submit(task_t& task, const size_t worker);
+      
+      const size_t size() const;
+      const int first_cpu() const;
+    };
+  }
+}